@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "cache.h"
+
+int noncoherent_enabled(void)
+{
+    const char *value = secure_getenv(NONCOHERENT_ENV);
+
+    return value && !strcmp(value, "1");
+}
+
+static size_t get_cache_line_size(void)
+{
+    static size_t line_size;
+    size_t size = __atomic_load_n(&line_size, __ATOMIC_RELAXED);
+
+    if (!size) {
+        long value = -1;
+
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+        value = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+#endif
+        /* Not every architecture reports it; 64 bytes is the common size */
+        size = (value > 0) ? (size_t)value : 64;
+        __atomic_store_n(&line_size, size, __ATOMIC_RELAXED);
+    }
+
+    return size;
+}
+
+/*!
+ * Write back and invalidate the CPU cache lines holding a range of memory.
+ * Does nothing on architectures without a user-space instruction for it.
+ */
+void flush_cache_range(const void *addr, size_t size)
+{
+    size_t line_size = get_cache_line_size();
+    uintptr_t p = (uintptr_t)addr & ~(uintptr_t)(line_size - 1);
+    uintptr_t end = (uintptr_t)addr + size;
+
+    if (!size) {
+        return;
+    }
+
+#ifdef __SSE2__
+    for (; p < end; p += line_size) {
+        _mm_clflush((const void *)p);
+    }
+
+    _mm_mfence();
+#elif defined(__aarch64__)
+    for (; p < end; p += line_size) {
+        __asm__ volatile("dc civac, %0" : : "r"(p) : "memory");
+    }
+
+    __asm__ volatile("dsb sy" : : : "memory");
+#else
+    (void)p;
+    (void)end;
+#endif
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SOFTWARE_CACHE_H__
+#define __SOFTWARE_CACHE_H__
+
+#include <stddef.h>
+
+/*!
+ * Environment variable that, when set to 1, makes the software driver
+ * treat its memory as if a device that doesn't snoop CPU caches accessed
+ * it, writing back and invalidating the cache lines of each range CPU
+ * access syncs.  Useful for measuring how much partial updates save on such
+ * devices.  It is ignored in setuid and setgid processes.
+ */
+#define NONCOHERENT_ENV "ALLOCATOR_SOFTWARE_NONCOHERENT"
+
+extern int noncoherent_enabled(void);
+
+extern void flush_cache_range(const void *addr, size_t size);
+
+#endif /* __SOFTWARE_CACHE_H__ */
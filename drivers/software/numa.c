@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "numa.h"
+
+#define NUMA_MASK_BITS (NUMA_MASK_LONGS * 8 * sizeof(unsigned long))
+
+/*!
+ * Get the number of nodes to pretend the system has, or 0 to use the real
+ * topology.
+ */
+static uint32_t get_fake_numa_nodes(void)
+{
+    const char *value = secure_getenv(FAKE_NUMA_NODES_ENV);
+    unsigned long count;
+    char *end;
+
+    if (!value || !*value) {
+        return 0;
+    }
+
+    count = strtoul(value, &end, 10);
+
+    return (*end || (count > NUMA_MASK_BITS)) ? 0 : (uint32_t)count;
+}
+
+/*!
+ * Count the real nodes, from the highest ID in sysfs' list of online nodes,
+ * e.g. "0-1,3".
+ */
+static uint32_t get_real_numa_nodes(void)
+{
+    char buf[256];
+    const char *p;
+    uint32_t count = 1;
+    ssize_t len;
+    int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 1;
+    }
+
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+
+    if (len <= 0) {
+        return 1;
+    }
+
+    buf[len] = '\0';
+
+    for (p = buf; *p; ) {
+        char *end;
+        unsigned long id = strtoul(p, &end, 10);
+
+        if (end == p) {
+            p++;
+            continue;
+        }
+
+        if (id + 1 > count) {
+            count = (uint32_t)(id + 1);
+        }
+
+        p = end;
+    }
+
+    return (count > NUMA_MASK_BITS) ? NUMA_MASK_BITS : count;
+}
+
+/*!
+ * Get the number of nodes memory can be placed on, fake ones included.
+ */
+uint32_t get_num_numa_nodes(void)
+{
+    uint32_t fake = get_fake_numa_nodes();
+
+    return fake ? fake : get_real_numa_nodes();
+}
+
+/*!
+ * Get the node of the CPU the calling thread is running on.
+ */
+uint32_t get_local_numa_node(void)
+{
+    uint32_t fake = get_fake_numa_nodes();
+    unsigned int cpu = 0;
+    unsigned int node = 0;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL)) {
+        return 0;
+    }
+
+    return fake ? cpu % fake : node;
+}
+
+/*!
+ * Map a possibly fake node to a real one.
+ */
+static uint32_t get_real_node(uint32_t node)
+{
+    return node % get_real_numa_nodes();
+}
+
+/*!
+ * Prefer placing the pages of a mapping on a node.
+ *
+ * For shared memory the policy belongs to the underlying file, so it
+ * applies to every later mapping as well, whichever thread faults the
+ * pages in.  A preferred rather than a bound policy falls back to other
+ * nodes when the node runs out of memory, instead of failing the fault.
+ *
+ * \return 0 on success, -1 if the kernel doesn't support NUMA policies.
+ */
+int bind_numa_node(void *addr, uint64_t size, uint32_t node)
+{
+    unsigned long mask[NUMA_MASK_LONGS] = { 0 };
+    uint32_t real = get_real_node(node);
+
+    mask[real / (8 * sizeof(unsigned long))] |=
+        1UL << (real % (8 * sizeof(unsigned long)));
+
+    return syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask,
+                   NUMA_MASK_BITS + 1, 0) ? -1 : 0;
+}
+
+/*!
+ * Prefer placing memory the calling thread allocates on a node, saving the
+ * thread's previous policy in <old_mode> and <old_nodes>, which must hold
+ * NUMA_MASK_LONGS longs.
+ *
+ * \return 0 on success, -1 if the kernel doesn't support NUMA policies.
+ */
+int set_thread_numa_node(uint32_t node, int *old_mode,
+                         unsigned long *old_nodes)
+{
+    unsigned long mask[NUMA_MASK_LONGS] = { 0 };
+    uint32_t real = get_real_node(node);
+
+    if (syscall(SYS_get_mempolicy, old_mode, old_nodes, NUMA_MASK_BITS + 1,
+                NULL, 0)) {
+        return -1;
+    }
+
+    mask[real / (8 * sizeof(unsigned long))] |=
+        1UL << (real % (8 * sizeof(unsigned long)));
+
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                   NUMA_MASK_BITS + 1) ? -1 : 0;
+}
+
+void restore_thread_numa_node(int old_mode, const unsigned long *old_nodes)
+{
+    syscall(SYS_set_mempolicy, old_mode,
+            (old_mode == MPOL_DEFAULT) ? NULL : old_nodes,
+            NUMA_MASK_BITS + 1);
+}
+
+/*!
+ * Populate a shared mapping with writable pages, so they are allocated now,
+ * under the mapping's policy, instead of on first touch.
+ */
+void prefault_memory(void *addr, uint64_t size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    volatile char *p = addr;
+    uint64_t offset;
+
+#ifdef MADV_POPULATE_WRITE
+    if (!madvise(addr, size, MADV_POPULATE_WRITE)) {
+        return;
+    }
+#endif
+
+    /* Freshly created memory reads as zeros, so writing zeros is harmless */
+    for (offset = 0; offset < size; offset += page_size) {
+        p[offset] = 0;
+    }
+}
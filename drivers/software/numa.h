@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SOFTWARE_NUMA_H__
+#define __SOFTWARE_NUMA_H__
+
+#include <stdint.h>
+
+/*!
+ * Environment variable giving the number of NUMA nodes to pretend the
+ * system has, so placement can be tested on single-node machines.  CPU n
+ * belongs to fake node n modulo the count, and memory placed on fake node
+ * n goes to real node n modulo the real count.  It is ignored in setuid
+ * and setgid processes.
+ */
+#define FAKE_NUMA_NODES_ENV "ALLOCATOR_FAKE_NUMA_NODES"
+
+extern uint32_t get_num_numa_nodes(void);
+
+extern uint32_t get_local_numa_node(void);
+
+extern int bind_numa_node(void *addr, uint64_t size, uint32_t node);
+
+extern int set_thread_numa_node(uint32_t node, int *old_mode,
+                                unsigned long *old_nodes);
+
+extern void restore_thread_numa_node(int old_mode,
+                                     const unsigned long *old_nodes);
+
+extern void prefault_memory(void *addr, uint64_t size);
+
+/*! Longs in the node masks saved by set_thread_numa_node() */
+#define NUMA_MASK_LONGS 16
+
+#endif /* __SOFTWARE_NUMA_H__ */
@@ -0,0 +1,794 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A driver allocating CPU memory from memfds, for headless rendering and for
+ * running the allocator on machines without GPUs.  It supports the memory
+ * character device /dev/zero.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/magic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "cache.h"
+#include "numa.h"
+#include "zero_pool.h"
+
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+     ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/*! Device number of /dev/zero */
+#define ZERO_MAJOR 1
+#define ZERO_MINOR 5
+
+/*! Surface size and pitch limits */
+#define SOFTWARE_MAX_WIDTH 16384
+#define SOFTWARE_MAX_HEIGHT 16384
+#define SOFTWARE_MAX_PITCH (SOFTWARE_MAX_WIDTH * 8)
+
+/*! Pitch alignment, one cache line, so rows never share one */
+#define SOFTWARE_PITCH_ALIGNMENT 64
+
+/*!
+ * Tile size of block tiled surfaces.  With 32-bit pixels a tile row is 32
+ * bytes, and a tile four cache lines.
+ */
+#define SOFTWARE_TILE_WIDTH 8
+#define SOFTWARE_TILE_HEIGHT 8
+
+/*!
+ * Allocations at least this large are rounded up to a multiple of it and
+ * backed by huge pages when the system has some reserved, or else laid out
+ * so transparent huge pages can back them.
+ */
+#define SOFTWARE_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+static const uint32_t software_formats[] = {
+    FOURCC('A', 'R', '2', '4'),
+    FOURCC('X', 'R', '2', '4'),
+    FOURCC('A', 'B', '2', '4'),
+    FOURCC('X', 'B', '2', '4'),
+    FOURCC('A', 'R', '3', '0'),
+    FOURCC('X', 'R', '3', '0'),
+    FOURCC('R', 'G', '1', '6'),
+    FOURCC('R', '8', ' ', ' '),
+    FOURCC('N', 'V', '1', '2'),
+    FOURCC('Y', 'U', '1', '2'),
+};
+
+typedef struct software_allocation {
+    allocation_t base;
+    int fd;
+
+    /*! Set if the memfd is backed by huge pages, reserved when created */
+    int huge_pages;
+
+    /*! Mapping used to flush caches, set atomically when first needed */
+    void *addr;
+} software_allocation_t;
+
+/*!
+ * Check whether every usage is one the software device can satisfy: any
+ * base usage, since the CPU can access the memory of any allocation.
+ *
+ * \param[in,out] num_constraints Incremented by the number of constraints
+ *                                appended to <constraints>.
+ *
+ * \param[out] constraints Receives the NUMA placement requested, if any, as
+ *                         a CONSTRAINT_NUMA_NODE constraint, and a
+ *                         CONSTRAINT_UNINITIALIZED constraint if the
+ *                         allocations needn't be cleared.  Must have room
+ *                         for two constraints.  May be NULL.
+ */
+static int software_supports_uses(uint32_t num_uses,
+                                  const usage_t *uses,
+                                  uint32_t *num_constraints,
+                                  constraint_t *constraints)
+{
+    const usage_numa_placement_t *numa = NULL;
+    const usage_numa_placement_t *request;
+    int uninitialized = 0;
+    uint32_t i;
+
+    for (i = 0; i < num_uses; i++) {
+        if (uses[i].usage->vendor != VENDOR_BASE) {
+            return 0;
+        }
+
+        switch (uses[i].usage->name) {
+        case USAGE_BASE_TEXTURE:
+        case USAGE_BASE_DISPLAY:
+            break;
+        case USAGE_BASE_NUMA_PLACEMENT:
+            request = (const usage_numa_placement_t *)uses[i].usage;
+
+            /* Memory can only be placed on one node */
+            if ((numa && (numa->node != request->node)) ||
+                ((request->node != USAGE_BASE_NUMA_NODE_LOCAL) &&
+                 (request->node >= get_num_numa_nodes()))) {
+                return 0;
+            }
+
+            numa = request;
+            break;
+        case USAGE_BASE_UNINITIALIZED:
+            uninitialized = 1;
+            break;
+        default:
+            return 0;
+        }
+    }
+
+    if (!constraints) {
+        return 1;
+    }
+
+    if (numa) {
+        memset(constraints, 0, sizeof(*constraints));
+        constraints->name = CONSTRAINT_NUMA_NODE;
+        constraints->u.numa_node.node = numa->node;
+        constraints->u.numa_node.flags = numa->flags;
+        constraints++;
+        (*num_constraints)++;
+    }
+
+    if (uninitialized) {
+        memset(constraints, 0, sizeof(*constraints));
+        constraints->name = CONSTRAINT_UNINITIALIZED;
+        (*num_constraints)++;
+    }
+
+    return 1;
+}
+
+static const constraint_t *find_constraint(const capability_set_t *set,
+                                           uint32_t name)
+{
+    uint32_t i;
+
+    for (i = 0; i < set->num_constraints; i++) {
+        if (set->constraints[i].name == name) {
+            return &set->constraints[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * Allocate a copy of a capability set, with the library's allocator so it
+ * can be freed with free_capability_sets().
+ */
+static capability_set_t *copy_capability_set(const capability_set_t *set)
+{
+    capability_set_t *copy = NULL;
+    size_t data_size;
+    void *data;
+
+    if (serialize_capability_set(set, &data_size, &data)) {
+        return NULL;
+    }
+
+    if (deserialize_capability_set(data_size, data, &copy)) {
+        copy = NULL;
+    }
+
+    free(data);
+
+    return copy;
+}
+
+/*!
+ * Append a capability set with the given constraints and layout capability
+ * to <sets>, unless the surface can't be laid out with them.
+ *
+ * \return 0 on success, -1 if memory allocation failed.
+ */
+static int add_capability_set(const assertion_t *assertion,
+                              uint32_t num_constraints,
+                              const constraint_t *constraints,
+                              const capability_header_t *capability,
+                              uint32_t *num_sets,
+                              capability_set_t *sets)
+{
+    capability_set_t set;
+    capability_set_t *copy;
+    layout_t layout;
+
+    set.num_constraints = num_constraints;
+    set.constraints = constraints;
+    set.num_capabilities = 1;
+    set.capabilities = &capability;
+
+    /* Rule out unknown formats and surfaces exceeding the max pitch */
+    if (device_plan_layout(DEVICE_NONE, assertion, &set, &layout)) {
+        return 0;
+    }
+
+    copy = copy_capability_set(&set);
+
+    if (!copy) {
+        return -1;
+    }
+
+    /* Move the copy's arrays into the caller's array of sets */
+    sets[(*num_sets)++] = *copy;
+    free(copy);
+
+    return 0;
+}
+
+static int software_get_capabilities(device_t *dev,
+                                     const assertion_t *assertion,
+                                     uint32_t num_uses,
+                                     const usage_t *uses,
+                                     uint32_t *num_sets,
+                                     capability_set_t **capability_sets)
+{
+    capability_pitch_linear_t pitch_linear;
+    capability_block_tiled_t block_tiled;
+    constraint_t constraints[5];
+    capability_set_t *sets;
+    uint32_t num_constraints = 3;
+    uint32_t count = 0;
+    int display = 0;
+    uint32_t i;
+
+    *num_sets = 0;
+    *capability_sets = NULL;
+
+    memset(constraints, 0, sizeof(constraints));
+
+    if (!software_supports_uses(num_uses, uses, &num_constraints,
+                                &constraints[3]) ||
+        (assertion->width > SOFTWARE_MAX_WIDTH) ||
+        (assertion->height > SOFTWARE_MAX_HEIGHT)) {
+        return 0;
+    }
+
+    for (i = 0; i < num_uses; i++) {
+        if (uses[i].usage->name == USAGE_BASE_DISPLAY) {
+            display = 1;
+        }
+    }
+
+    sets = calloc(2, sizeof(*sets));
+
+    if (!sets) {
+        return -1;
+    }
+
+    constraints[0].name = CONSTRAINT_ADDRESS_ALIGNMENT;
+    constraints[0].u.address_alignment.value = sysconf(_SC_PAGESIZE);
+    constraints[1].name = CONSTRAINT_PITCH_ALIGNMENT;
+    constraints[1].u.pitch_alignment.value = SOFTWARE_PITCH_ALIGNMENT;
+    constraints[2].name = CONSTRAINT_MAX_PITCH;
+    constraints[2].u.max_pitch.value = SOFTWARE_MAX_PITCH;
+
+    /* Capabilities are compared with memcmp(), so padding must be zeroed */
+    memset(&pitch_linear, 0, sizeof(pitch_linear));
+    pitch_linear.header.common.vendor = VENDOR_BASE;
+    pitch_linear.header.common.name = CAP_BASE_PITCH_LINEAR;
+    pitch_linear.header.common.length_in_words =
+        CAPABILITY_LENGTH_IN_WORDS(capability_pitch_linear_t);
+    pitch_linear.header.required = 1;
+
+    memset(&block_tiled, 0, sizeof(block_tiled));
+    block_tiled.header.common.vendor = VENDOR_BASE;
+    block_tiled.header.common.name = CAP_BASE_BLOCK_TILED;
+    block_tiled.header.common.length_in_words =
+        CAPABILITY_LENGTH_IN_WORDS(capability_block_tiled_t);
+    block_tiled.header.required = 1;
+    block_tiled.tile_width = SOFTWARE_TILE_WIDTH;
+    block_tiled.tile_height = SOFTWARE_TILE_HEIGHT;
+
+    if (add_capability_set(assertion, num_constraints, constraints,
+                           &pitch_linear.header, &count, sets)) {
+        goto fail;
+    }
+
+    /* Displays scan out pitch linear surfaces only */
+    if (!display &&
+        add_capability_set(assertion, num_constraints, constraints,
+                           &block_tiled.header, &count, sets)) {
+        goto fail;
+    }
+
+    if (!count) {
+        free(sets);
+        return 0;
+    }
+
+    *num_sets = count;
+    *capability_sets = sets;
+
+    return 0;
+
+fail:
+    free_capability_sets(count, sets);
+
+    return -1;
+}
+
+static int software_get_assertion_hints(device_t *dev,
+                                        uint32_t num_uses,
+                                        const usage_t *uses,
+                                        uint32_t *num_hints,
+                                        assertion_hint_t **hints)
+{
+    uint32_t *formats;
+
+    *num_hints = 0;
+    *hints = NULL;
+
+    if (!software_supports_uses(num_uses, uses, NULL, NULL)) {
+        return 0;
+    }
+
+    formats = malloc(sizeof(software_formats));
+    *hints = malloc(sizeof(**hints));
+
+    if (!formats || !*hints) {
+        free(formats);
+        free(*hints);
+        *hints = NULL;
+        return -1;
+    }
+
+    memcpy(formats, software_formats, sizeof(software_formats));
+
+    {
+        assertion_hint_t hint = {
+            SOFTWARE_MAX_WIDTH,
+            SOFTWARE_MAX_HEIGHT,
+            sizeof(software_formats) / sizeof(software_formats[0]),
+            formats,
+            NULL
+        };
+
+        memcpy(*hints, &hint, sizeof(hint));
+    }
+
+    *num_hints = 1;
+
+    return 0;
+}
+
+/*!
+ * Create a memfd of <size> bytes with its pages allocated, placed on NUMA
+ * node <node> unless it is -1.  <flags> are extra memfd_create() flags,
+ * e.g. MFD_HUGETLB.
+ *
+ * Huge pages are reserved up front, since faulting in a page the system has
+ * run out of would kill the process with SIGBUS.  Pages are allocated
+ * without mapping them, under the calling thread's memory policy, so the
+ * policy is switched to the node while they are.
+ *
+ * \return The memfd, or -1 on failure, e.g. if the system has too few huge
+ *         pages.
+ */
+static int create_populated_memfd(uint64_t size,
+                                  int64_t node,
+                                  unsigned int flags)
+{
+    unsigned long old_nodes[NUMA_MASK_LONGS];
+    int old_mode;
+    int placed = 0;
+    int status;
+    int fd = memfd_create("allocator-software",
+                          MFD_CLOEXEC | MFD_ALLOW_SEALING | flags);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(fd, size)) {
+        close(fd);
+        return -1;
+    }
+
+    if (node >= 0) {
+        placed = !set_thread_numa_node((uint32_t)node, &old_mode, old_nodes);
+    }
+
+    status = fallocate(fd, 0, 0, size);
+
+    if (placed) {
+        restore_thread_numa_node(old_mode, old_nodes);
+    }
+
+    if (status) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*!
+ * Create a memfd of <size> bytes, placed on NUMA node <node> unless it is
+ * -1, and populated if <prefault> is non-zero.
+ */
+static int create_memfd(uint64_t size, int64_t node, int prefault)
+{
+    void *addr;
+    int fd = memfd_create("allocator-software",
+                          MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(fd, size)) {
+        close(fd);
+        return -1;
+    }
+
+    if ((node < 0) && !prefault) {
+        return fd;
+    }
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (addr == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    /* Placement is a hint, so kernels without NUMA support are fine */
+    if (node >= 0) {
+        bind_numa_node(addr, size, (uint32_t)node);
+    }
+
+    if (prefault) {
+        prefault_memory(addr, size);
+    }
+
+    munmap(addr, size);
+
+    return fd;
+}
+
+/*!
+ * Create the memfd of an allocation of <size> bytes, backed by huge pages
+ * if it is large enough and the system has some reserved.
+ */
+static int create_allocation_memfd(uint64_t size, int64_t node, int prefault)
+{
+    int fd = -1;
+
+    if (size >= SOFTWARE_HUGE_PAGE_SIZE) {
+        fd = create_populated_memfd(size, node, MFD_HUGETLB);
+    }
+
+    if (fd < 0) {
+        fd = create_memfd(size, node, prefault);
+    }
+
+    return fd;
+}
+
+/*!
+ * Create a memfd for the zero pool, with its pages allocated and cleared so
+ * allocations taking it don't stall on the kernel doing so.  The pages are
+ * never mapped, so the pool's thread doesn't contend for the address space
+ * with the application's.
+ */
+static int create_pooled_memfd(uint64_t size, int64_t node)
+{
+    int fd = -1;
+
+    if (size >= SOFTWARE_HUGE_PAGE_SIZE) {
+        fd = create_populated_memfd(size, node, MFD_HUGETLB);
+    }
+
+    if (fd < 0) {
+        fd = create_populated_memfd(size, node, 0);
+    }
+
+    return fd;
+}
+
+static int software_create_allocation(device_t *dev,
+                                      const assertion_t *assertion,
+                                      const capability_set_t *capability_set,
+                                      allocation_t **allocation)
+{
+    software_allocation_t *alloc;
+    const constraint_t *placement;
+    long page_size = sysconf(_SC_PAGESIZE);
+    struct statfs fs;
+    int64_t node = -1;
+    int prefault = 0;
+    uint64_t size;
+    layout_t layout;
+
+    if (device_plan_layout(DEVICE_NONE, assertion, capability_set, &layout) ||
+        (layout.alignment > SOFTWARE_HUGE_PAGE_SIZE) ||
+        (SOFTWARE_HUGE_PAGE_SIZE % layout.alignment)) {
+        return -1;
+    }
+
+    alloc = calloc(1, sizeof(*alloc));
+
+    if (!alloc) {
+        return -1;
+    }
+
+    alloc->fd = -1;
+
+    placement = find_constraint(capability_set, CONSTRAINT_NUMA_NODE);
+
+    if (placement) {
+        node = (placement->u.numa_node.node == USAGE_BASE_NUMA_NODE_LOCAL) ?
+            get_local_numa_node() : placement->u.numa_node.node;
+        prefault = !!(placement->u.numa_node.flags &
+                      USAGE_BASE_NUMA_PREFAULT);
+    }
+
+    if (layout.size >= SOFTWARE_HUGE_PAGE_SIZE) {
+        size = (layout.size + SOFTWARE_HUGE_PAGE_SIZE - 1) /
+            SOFTWARE_HUGE_PAGE_SIZE * SOFTWARE_HUGE_PAGE_SIZE;
+    } else {
+        size = (layout.size + page_size - 1) / page_size * page_size;
+    }
+
+    /*
+     * Memfds are always cleared by the kernel, so allocations that needn't
+     * be leave the pool's populated memory to those that benefit from it,
+     * and fault their pages in as they are written.
+     */
+    if (!find_constraint(capability_set, CONSTRAINT_UNINITIALIZED)) {
+        alloc->fd = zero_pool_take(size, node);
+    }
+
+    if ((alloc->fd < 0) &&
+        ((alloc->fd = create_allocation_memfd(size, node, prefault)) < 0)) {
+        goto fail;
+    }
+
+    if (!fstatfs(alloc->fd, &fs) && (fs.f_type == HUGETLBFS_MAGIC)) {
+        alloc->huge_pages = 1;
+    }
+
+    /* Importers may map the whole allocation, so it must never shrink */
+    fcntl(alloc->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+    alloc->base.capability_set = copy_capability_set(capability_set);
+
+    if (!alloc->base.capability_set) {
+        goto fail;
+    }
+
+    alloc->base.size = size;
+    *allocation = &alloc->base;
+
+    return 0;
+
+fail:
+    if (alloc->fd >= 0) {
+        close(alloc->fd);
+    }
+
+    free(alloc);
+
+    return -1;
+}
+
+static void software_destroy_allocation(device_t *dev,
+                                        allocation_t *allocation)
+{
+    software_allocation_t *alloc = (software_allocation_t *)allocation;
+
+    if (alloc->addr) {
+        munmap(alloc->addr, allocation->size);
+    }
+
+    close(alloc->fd);
+    free_capability_sets(1, (capability_set_t *)allocation->capability_set);
+    free(alloc);
+}
+
+static int software_get_allocation_fd(device_t *dev,
+                                      const allocation_t *allocation,
+                                      int *fd)
+{
+    const software_allocation_t *alloc =
+        (const software_allocation_t *)allocation;
+
+    *fd = fcntl(alloc->fd, F_DUPFD_CLOEXEC, 0);
+
+    return (*fd < 0) ? -1 : 0;
+}
+
+/*!
+ * Free an allocation's pages by punching a hole over the whole memfd, which
+ * keeps its size, so it reads as zeroes and is faulted back in when used.
+ *
+ * Huge pages are left alone: they were reserved so that faulting them in
+ * can't fail, which wouldn't hold once they were given back.
+ */
+static int software_purge_allocation(device_t *dev, allocation_t *allocation)
+{
+    const software_allocation_t *alloc =
+        (const software_allocation_t *)allocation;
+
+    if (alloc->huge_pages) {
+        return -1;
+    }
+
+    return fallocate(alloc->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                     0, allocation->size) ? -1 : 0;
+}
+
+/*!
+ * Emulate a device that doesn't snoop CPU caches, by writing back CPU
+ * writes when access ends, and discarding stale lines before reads.
+ */
+static int software_sync_allocation(device_t *dev,
+                                    allocation_t *allocation,
+                                    uint32_t flags,
+                                    uint32_t num_ranges,
+                                    const allocation_range_t *ranges)
+{
+    software_allocation_t *alloc = (software_allocation_t *)allocation;
+    void *addr = __atomic_load_n(&alloc->addr, __ATOMIC_ACQUIRE);
+    void *expected = NULL;
+    uint32_t i;
+
+    if (!(((flags & ALLOCATION_SYNC_END) && (flags & ALLOCATION_SYNC_WRITE)) ||
+          ((flags & ALLOCATION_SYNC_START) && (flags & ALLOCATION_SYNC_READ)))) {
+        return 0;
+    }
+
+    if (!addr) {
+        addr = mmap(NULL, allocation->size, PROT_READ, MAP_SHARED,
+                    alloc->fd, 0);
+
+        if (addr == MAP_FAILED) {
+            return -1;
+        }
+
+        if (!__atomic_compare_exchange_n(&alloc->addr, &expected, addr, 0,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE)) {
+            munmap(addr, allocation->size);
+            addr = expected;
+        }
+    }
+
+    for (i = 0; i < num_ranges; i++) {
+        flush_cache_range((const char *)addr + ranges[i].offset,
+                          ranges[i].size);
+    }
+
+    return 0;
+}
+
+/*!
+ * Import memory any process can map, e.g. a memfd or shared memory file.
+ */
+static int software_import_allocation(device_t *dev,
+                                      const capability_set_t *capability_set,
+                                      uint64_t size,
+                                      int fd,
+                                      allocation_t **allocation)
+{
+    software_allocation_t *alloc;
+    struct stat stats;
+
+    if (fstat(fd, &stats) || !S_ISREG(stats.st_mode) ||
+        ((uint64_t)stats.st_size < size)) {
+        return -1;
+    }
+
+    alloc = calloc(1, sizeof(*alloc));
+
+    if (!alloc) {
+        return -1;
+    }
+
+    alloc->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    alloc->base.capability_set = copy_capability_set(capability_set);
+
+    if ((alloc->fd < 0) || !alloc->base.capability_set) {
+        if (alloc->fd >= 0) {
+            close(alloc->fd);
+        }
+
+        free_capability_sets(1,
+                             (capability_set_t *)alloc->base.capability_set);
+        free(alloc);
+        return -1;
+    }
+
+    alloc->base.size = size;
+    *allocation = &alloc->base;
+
+    return 0;
+}
+
+static void software_device_destroy(device_t *dev)
+{
+    free(dev);
+}
+
+static int software_is_fd_supported(driver_t *driver, int dev_fd)
+{
+    struct stat stats;
+
+    return !fstat(dev_fd, &stats) && S_ISCHR(stats.st_mode) &&
+        (major(stats.st_rdev) == ZERO_MAJOR) &&
+        (minor(stats.st_rdev) == ZERO_MINOR);
+}
+
+static device_t *software_device_create_from_fd(driver_t *driver, int dev_fd)
+{
+    device_t *dev = calloc(1, sizeof(*dev));
+
+    if (!dev) {
+        return NULL;
+    }
+
+    dev->driver = driver;
+    dev->destroy = software_device_destroy;
+    dev->get_capabilities = software_get_capabilities;
+    dev->get_assertion_hints = software_get_assertion_hints;
+    dev->create_allocation = software_create_allocation;
+    dev->destroy_allocation = software_destroy_allocation;
+    dev->get_allocation_fd = software_get_allocation_fd;
+    dev->import_allocation = software_import_allocation;
+    dev->purge_allocation = software_purge_allocation;
+
+    if (noncoherent_enabled()) {
+        dev->sync_allocation = software_sync_allocation;
+    }
+
+    return dev;
+}
+
+static void software_destroy(driver_t *driver)
+{
+    fini_zero_pool();
+}
+
+int allocator_driver_init(driver_t *driver)
+{
+    driver->is_fd_supported = software_is_fd_supported;
+    driver->device_create_from_fd = software_device_create_from_fd;
+    driver->destroy = software_destroy;
+
+    init_zero_pool(create_pooled_memfd);
+
+    return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A pool of memfds whose pages are already allocated and zeroed, refilled
+ * by a background thread, so creating an allocation doesn't stall on the
+ * kernel zeroing its memory.
+ *
+ * The pool learns which sizes to keep from the allocations requested: the
+ * first allocation of a size is created synchronously, and the worker then
+ * keeps ZERO_POOL_DEPTH memfds of that size ready until more recently
+ * requested sizes push it out.  Memfds are only ever handed out once, so
+ * no allocation can see another's contents.  A forked child starts with an
+ * empty pool, since the parent may hand out the memfds it inherited.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "zero_pool.h"
+
+typedef struct zero_pool_class {
+    /*! Size and NUMA node of the memfds, or 0 if the class is unused */
+    uint64_t size;
+    int64_t node;
+
+    int fds[ZERO_POOL_DEPTH];
+    uint32_t num_fds;
+
+    /*! When the class was last requested, to find the least recent one */
+    uint64_t last_used;
+
+    /*! Set when creating a memfd failed, until the size is requested again */
+    int failed;
+} zero_pool_class_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+
+    zero_pool_class_t classes[ZERO_POOL_MAX_SIZES];
+    uint64_t pooled_bytes;
+    uint64_t clock;
+
+    zero_pool_create_func create;
+    int enabled;
+
+    /*! The worker thread, if running */
+    int worker_running;
+    pthread_t worker;
+    int stopping;
+} pool = {
+    PTHREAD_MUTEX_INITIALIZER,
+    PTHREAD_COND_INITIALIZER,
+};
+
+static void clear_class(zero_pool_class_t *class)
+{
+    uint32_t i;
+
+    for (i = 0; i < class->num_fds; i++) {
+        close(class->fds[i]);
+    }
+
+    pool.pooled_bytes -= class->num_fds * class->size;
+    memset(class, 0, sizeof(*class));
+}
+
+static zero_pool_class_t *find_class(uint64_t size, int64_t node)
+{
+    uint32_t i;
+
+    for (i = 0; i < ZERO_POOL_MAX_SIZES; i++) {
+        if ((pool.classes[i].size == size) && (pool.classes[i].node == node)) {
+            return &pool.classes[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * Find a class the worker should add a memfd to.  Called with the lock
+ * held.
+ */
+static zero_pool_class_t *find_class_to_fill(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < ZERO_POOL_MAX_SIZES; i++) {
+        zero_pool_class_t *class = &pool.classes[i];
+
+        if (class->size && !class->failed &&
+            (class->num_fds < ZERO_POOL_DEPTH) &&
+            (pool.pooled_bytes + class->size <= ZERO_POOL_MAX_BYTES)) {
+            return class;
+        }
+    }
+
+    return NULL;
+}
+
+static void zero_pool_prepare_fork(void)
+{
+    pthread_mutex_lock(&pool.lock);
+}
+
+static void zero_pool_parent_fork(void)
+{
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/*!
+ * Empty the child's copy of the pool.  Its memfds are shared with the
+ * parent, and the thread filling it isn't running in the child.
+ */
+static void zero_pool_child_fork(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < ZERO_POOL_MAX_SIZES; i++) {
+        clear_class(&pool.classes[i]);
+    }
+
+    /* Drop the room the parent's worker may have reserved */
+    pool.pooled_bytes = 0;
+    pool.worker_running = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+static void register_fork_handlers(void)
+{
+    pthread_atfork(zero_pool_prepare_fork, zero_pool_parent_fork,
+                   zero_pool_child_fork);
+}
+
+static void *zero_pool_worker(void *arg)
+{
+    struct sched_param param = { 0 };
+
+    /* Only use CPU time the application leaves unused */
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    pthread_mutex_lock(&pool.lock);
+
+    while (!pool.stopping) {
+        zero_pool_class_t *class = find_class_to_fill();
+        uint64_t size;
+        int64_t node;
+        int fd;
+
+        if (!class) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+            continue;
+        }
+
+        /* Reserve room, since the class may change while unlocked */
+        size = class->size;
+        node = class->node;
+        pool.pooled_bytes += size;
+
+        pthread_mutex_unlock(&pool.lock);
+        fd = pool.create(size, node);
+        pthread_mutex_lock(&pool.lock);
+
+        pool.pooled_bytes -= size;
+        class = find_class(size, node);
+
+        if (fd < 0) {
+            if (class) {
+                class->failed = 1;
+            }
+        } else if (class && (class->num_fds < ZERO_POOL_DEPTH)) {
+            class->fds[class->num_fds++] = fd;
+            pool.pooled_bytes += size;
+        } else {
+            close(fd);
+        }
+    }
+
+    pthread_mutex_unlock(&pool.lock);
+
+    return NULL;
+}
+
+/*!
+ * Start the worker thread.  It blocks all signals, which are meant for the
+ * application's threads.
+ *
+ * Must be called with the lock held.
+ */
+static void start_worker(void)
+{
+    sigset_t all_signals, old_signals;
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+    if (!pthread_create(&pool.worker, NULL, zero_pool_worker, NULL)) {
+        pool.worker_running = 1;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+}
+
+/*!
+ * Set up the pool.  It stays empty, and no thread is started, until memory
+ * is first requested.
+ *
+ * \param[in] create Creates the pool's memfds.
+ */
+void init_zero_pool(zero_pool_create_func create)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    const char *value = secure_getenv(ZERO_POOL_ENV);
+
+    pthread_once(&once, register_fork_handlers);
+
+    pthread_mutex_lock(&pool.lock);
+    pool.create = create;
+    pool.enabled = !value || strcmp(value, "0");
+    pool.stopping = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/*!
+ * Stop the worker thread and close every pooled memfd.
+ */
+void fini_zero_pool(void)
+{
+    uint32_t i;
+    int join;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = 1;
+    join = pool.worker_running;
+    pool.worker_running = 0;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    if (join) {
+        pthread_join(pool.worker, NULL);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+
+    for (i = 0; i < ZERO_POOL_MAX_SIZES; i++) {
+        clear_class(&pool.classes[i]);
+    }
+
+    pool.enabled = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/*!
+ * Take a zeroed memfd of <size> bytes on NUMA node <node> from the pool,
+ * and have the worker keep memfds of that size ready for later requests.
+ *
+ * \return The memfd, or -1 if the pool has none ready, in which case the
+ *         caller should create one itself.
+ */
+int zero_pool_take(uint64_t size, int64_t node)
+{
+    zero_pool_class_t *class;
+    int fd = -1;
+    uint32_t i;
+
+    /*
+     * The worker may be waiting for the CPU while it holds the lock, so
+     * rather than wait for it, miss.
+     */
+    if (pthread_mutex_trylock(&pool.lock)) {
+        return -1;
+    }
+
+    if (!pool.enabled || (size > ZERO_POOL_MAX_BYTES / ZERO_POOL_DEPTH)) {
+        pthread_mutex_unlock(&pool.lock);
+        return -1;
+    }
+
+    class = find_class(size, node);
+
+    if (!class) {
+        /* Replace an unused class, or else the least recently used one */
+        class = &pool.classes[0];
+
+        for (i = 1; i < ZERO_POOL_MAX_SIZES; i++) {
+            if (pool.classes[i].last_used < class->last_used) {
+                class = &pool.classes[i];
+            }
+        }
+
+        clear_class(class);
+        class->size = size;
+        class->node = node;
+    }
+
+    class->last_used = ++pool.clock;
+    class->failed = 0;
+
+    if (class->num_fds) {
+        fd = class->fds[--class->num_fds];
+        pool.pooled_bytes -= size;
+    }
+
+    if (!pool.worker_running) {
+        start_worker();
+    }
+
+    pthread_cond_signal(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    return fd;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SOFTWARE_ZERO_POOL_H__
+#define __SOFTWARE_ZERO_POOL_H__
+
+#include <stdint.h>
+
+/*!
+ * Environment variable that, when set to 0, disables the pool of
+ * pre-zeroed memfds, so every allocation creates its own.  It is ignored in
+ * setuid and setgid processes.
+ */
+#define ZERO_POOL_ENV "ALLOCATOR_SOFTWARE_ZERO_POOL"
+
+/*! Most allocation sizes the pool keeps memfds of */
+#define ZERO_POOL_MAX_SIZES 4
+
+/*! Memfds kept ready for each size */
+#define ZERO_POOL_DEPTH 2
+
+/*! Most bytes of memfds the pool holds */
+#define ZERO_POOL_MAX_BYTES (128 * 1024 * 1024)
+
+/*!
+ * Create a populated memfd of <size> bytes, placed on NUMA node <node>
+ * unless it is -1.
+ *
+ * \return The memfd, or -1 on failure.
+ */
+typedef int (*zero_pool_create_func)(uint64_t size, int64_t node);
+
+extern void init_zero_pool(zero_pool_create_func create);
+
+extern void fini_zero_pool(void);
+
+extern int zero_pool_take(uint64_t size, int64_t node);
+
+#endif /* __SOFTWARE_ZERO_POOL_H__ */
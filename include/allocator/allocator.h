@@ -33,16 +33,113 @@ extern "C" {
  * \file Allocator constructs specific to allocator clients/applications.
  */
 
+/*!
+ * A device node that may be used to create a device context.
+ */
+typedef struct device_node {
+    /*! Path of the device node, e.g. "/dev/dri/renderD128" */
+    const char *path;
+
+    /*! Kernel subsystem of the node, e.g. "drm" or "video4linux" */
+    const char *subsystem;
+
+    /*! Kernel driver bound to the node's device, or NULL if there is none */
+    const char *kernel_driver;
+
+    /*! Device number of the node */
+    uint32_t major;
+    uint32_t minor;
+} device_node_t;
+
+/*!
+ * List the device nodes on which device_create() may succeed.
+ *
+ * The nodes of the drm, accel, video4linux, and dma_heap device classes are
+ * read from sysfs.  Nodes that no installed driver can support according to
+ * the "match" data in the driver config files are left out, without opening
+ * any node.  Creating a device on a listed node may still fail.
+ *
+ * The sysfs scan is cached until device nodes are added or removed, as
+ * reported by kernel uevents.  The ALLOCATOR_SYSFS_ROOT and
+ * ALLOCATOR_DEV_ROOT environment variables override where sysfs is mounted
+ * and where device nodes are created, in which case changes are detected
+ * through the modification times of the class directories instead.
+ *
+ * The caller is responsible for freeing the memory pointed to by
+ * <device_nodes>:
+ *
+ *     free_device_nodes(*num_device_nodes, *device_nodes);
+ */
+extern int device_enumerate(uint32_t *num_device_nodes,
+                            device_node_t **device_nodes);
+
+/*!
+ * Free an array of device nodes returned by device_enumerate()
+ */
+extern void free_device_nodes(uint32_t num_device_nodes,
+                              device_node_t *device_nodes);
+
 /*!
  * Initialize a device context on the specified device file descriptor.
+ *
+ * If device sharing is enabled with set_device_sharing(), a device context
+ * already created on the same device node is returned instead, with its
+ * reference count incremented.
  */
 extern device_t *device_create(int dev_fd);
 
 /*!
  * Tear down a device context returned by dev_create().
+ *
+ * Shared device contexts are only torn down when the last reference to them
+ * is destroyed.
  */
 extern void device_destroy(device_t *dev);
 
+/*!
+ * Select whether device_create() shares device contexts.
+ *
+ * When sharing is enabled, device_create() identifies the device node behind
+ * the file descriptor by its st_dev and st_rdev values.  If a shared context
+ * already exists for that node, it is returned and its reference count is
+ * incremented.  Otherwise, a new context is created on a duplicate of the file
+ * descriptor owned by the library, so callers may close their descriptor at
+ * any time.  Each device_create() call must be matched by a device_destroy()
+ * call.
+ *
+ * Sharing is disabled by default.  Changing the mode doesn't affect existing
+ * device contexts.
+ */
+extern void set_device_sharing(int enable);
+
+/*!
+ * Start watching the driver search path for driver config files being added,
+ * changed, or removed.
+ *
+ * Returns a file descriptor that becomes readable when changes are pending,
+ * or -1 on failure.  The descriptor is owned by the library.  Applications
+ * should poll it and call driver_watch_dispatch() when it becomes readable.
+ * Calling this function again returns the same descriptor.
+ */
+extern int driver_watch_start(void);
+
+/*!
+ * Load, reload, or unload drivers according to the pending changes reported
+ * on the descriptor returned by driver_watch_start().  Only the config files
+ * that changed are read.
+ *
+ * Drivers whose config files changed or were removed are no longer used to
+ * create devices.  Their libraries are unloaded once every device created
+ * from them has been destroyed.
+ */
+extern int driver_watch_dispatch(void);
+
+/*!
+ * Stop watching the driver search path and close the descriptor returned by
+ * driver_watch_start().
+ */
+extern void driver_watch_stop(void);
+
 /*!
  * Query device capabilities for a given assertion.
  *
@@ -58,6 +155,83 @@ extern int device_get_capabilities(device_t *dev,
                                    uint32_t *num_capability_sets,
                                    capability_set_t** capability_sets);
 
+/*!
+ * Query device capabilities for a given assertion, returning library-owned
+ * results.
+ *
+ * Results are cached per device, so repeating a query with equivalent
+ * parameters doesn't call into the driver again unless the driver has
+ * invalidated its earlier results.  The memory pointed to by
+ * <capability_sets> must not be modified or freed by the caller, and remains
+ * valid until device_flush_query_cache() is called or the device is
+ * destroyed.
+ *
+ * device_get_capabilities() uses the same cache, but returns a copy of the
+ * results the caller owns.
+ */
+extern int device_query_capabilities(device_t *dev,
+                                     const assertion_t *assertion,
+                                     uint32_t num_uses,
+                                     const usage_t *uses,
+                                     uint32_t *num_capability_sets,
+                                     const capability_set_t **capability_sets);
+
+/*!
+ * Runs tasks on behalf of the allocator library, for applications that
+ * manage their own thread pools.
+ */
+typedef struct executor {
+    /*!
+     * Arrange for func(arg) to be called, typically on another thread.
+     *
+     * \return 0 if the call was arranged.  -1 otherwise, in which case the
+     *         library calls func(arg) itself.
+     */
+    int (*submit)(void *data, void (*func)(void *arg), void *arg);
+
+    /*! Passed to submit() */
+    void *data;
+} executor_t;
+
+/*!
+ * One query of a device_get_capabilities_multi() call.
+ */
+typedef struct capability_query {
+    /*! The device to query */
+    device_t *dev;
+
+    /*! The assertion and uses, as passed to device_get_capabilities() */
+    const assertion_t *assertion;
+    uint32_t num_uses;
+    const usage_t *uses;
+
+    /*! Set to 0 if the query succeeded, -1 otherwise */
+    int status;
+
+    /*!
+     * The capability sets, if the query succeeded.  The caller is responsible
+     * for freeing them:
+     *
+     *     free_capability_sets(num_capability_sets, capability_sets);
+     */
+    uint32_t num_capability_sets;
+    capability_set_t *capability_sets;
+} capability_query_t;
+
+/*!
+ * Query the capabilities of several devices concurrently.
+ *
+ * Runs the equivalent of device_get_capabilities() for each query, on
+ * <executor> if it is non-NULL or on the library's worker threads otherwise.
+ * The calling thread runs one of the queries itself.  Returns once every
+ * query has finished, with each query's result in its status field.
+ *
+ * \return 0 if every query succeeded, -1 if any failed.
+ */
+extern int device_get_capabilities_multi(uint32_t num_queries,
+                                         capability_query_t *queries,
+                                         const executor_t *executor);
+
 /*!
  * Compute a list of common capabilities by determining the compatible combination
  * of two existing capability set lists.
@@ -90,11 +264,92 @@ extern int device_get_assertion_hints(device_t *dev,
                                       uint32_t *num_hints,
                                       assertion_hint_t **hints);
 
+/*!
+ * Query device assertion hints for a given usage, returning library-owned
+ * results.
+ *
+ * Cached the same way as device_query_capabilities().  The memory pointed to
+ * by <hints> must not be modified or freed by the caller, and remains valid
+ * until device_flush_query_cache() is called or the device is destroyed.
+ */
+extern int device_query_assertion_hints(device_t *dev,
+                                        uint32_t num_uses,
+                                        const usage_t *uses,
+                                        uint32_t *num_hints,
+                                        const assertion_hint_t **hints);
+
+/*!
+ * Discard a device's cached query results.
+ *
+ * Frees every result previously returned by device_query_capabilities() and
+ * device_query_assertion_hints() for the device.  Stale results are kept
+ * until this is called or the device is destroyed, so long-lived applications
+ * whose drivers invalidate results often should call this periodically, once
+ * they no longer reference any earlier results.
+ */
+extern void device_flush_query_cache(device_t *dev);
+
 /*!
  * Free an array of assertion hints created by the allocator library
  */
 extern void free_assertion_hints(uint32_t num_hints, assertion_hint_t *hints);
 
+/*!
+ * Compute the memory layout of a surface conforming to an assertion and
+ * capability set, without allocating it.
+ *
+ * <layout> receives the pitch, offset and size of each plane, in the order
+ * of the assertion's format, along with the size and address alignment the
+ * allocation needs.  The format is a DRM fourcc code, and defaults to
+ * DRM_FORMAT_ARGB8888 if the assertion doesn't specify one.
+ *
+ * If <dev> is DEVICE_NONE, the layout is computed from the capability set's
+ * constraints alone, as it would be for a driver that doesn't compute
+ * layouts itself.  Only pitch linear and block tiled surfaces can be laid
+ * out that way.
+ *
+ * \return 0 on success, -1 if the format is unknown, the capability set
+ *         can't be laid out, or the surface violates its constraints.
+ */
+extern int device_plan_layout(device_t *dev,
+                              const assertion_t *assertion,
+                              const capability_set_t *capability_set,
+                              layout_t *layout);
+
+/*!
+ * Copy a plane of <width> x <height> pixels from a pitch linear buffer to a
+ * CAP_BASE_BLOCK_TILED one, e.g. to upload an image into a tiled
+ * allocation.  Padding in the tiled buffer is left untouched.
+ *
+ * \param[in] tiled_pitch The pitch of the tiled plane, as reported by
+ *                        device_plan_layout().
+ *
+ * \return 0 on success, -1 if the tile size is 0 or a pitch is too small.
+ */
+extern int copy_to_block_tiled(uint32_t tile_width,
+                               uint32_t tile_height,
+                               uint32_t bytes_per_pixel,
+                               uint32_t width,
+                               uint32_t height,
+                               const void *linear,
+                               uint32_t linear_pitch,
+                               void *tiled,
+                               uint32_t tiled_pitch);
+
+/*!
+ * Copy a plane from a CAP_BASE_BLOCK_TILED buffer to a pitch linear one,
+ * the reverse of copy_to_block_tiled().
+ */
+extern int copy_from_block_tiled(uint32_t tile_width,
+                                 uint32_t tile_height,
+                                 uint32_t bytes_per_pixel,
+                                 uint32_t width,
+                                 uint32_t height,
+                                 const void *tiled,
+                                 uint32_t tiled_pitch,
+                                 void *linear,
+                                 uint32_t linear_pitch);
+
 /*!
  * Create an allocation conforming to an assertion and capability set on the
  * specified device.
@@ -104,15 +359,183 @@ extern int device_create_allocation(device_t *dev,
                                     const capability_set_t *capability_set,
                                     allocation_t **allocation);
 
+/*!
+ * Create several identical allocations conforming to an assertion and
+ * capability set on the specified device, e.g. the buffers of a swapchain.
+ *
+ * Either all <count> allocations are created and stored in <allocations>,
+ * or none are.  Each must be destroyed with device_destroy_allocation().
+ */
+extern int device_create_allocations(device_t *dev,
+                                     const assertion_t *assertion,
+                                     const capability_set_t *capability_set,
+                                     uint32_t count,
+                                     allocation_t **allocations);
+
+/*!
+ * An allocation being created in the background.
+ */
+typedef struct allocation_request allocation_request_t;
+
+/*!
+ * Start creating an allocation on a library worker thread, so large
+ * allocations don't stall the caller's event loop.
+ *
+ * The parameters are copied and needn't outlive the call.  The device must
+ * not be destroyed until every request created on it has been destroyed.
+ *
+ * \return The request, which must be destroyed with
+ *         allocation_request_destroy(), or NULL on failure.
+ */
+extern allocation_request_t *
+device_create_allocation_async(device_t *dev,
+                               const assertion_t *assertion,
+                               const capability_set_t *capability_set);
+
+/*!
+ * Get an eventfd that becomes readable once the request completes, fails,
+ * or is cancelled, for use with poll() or epoll.
+ *
+ * The file descriptor is owned by the request.  The library never reads it,
+ * so it stays readable until the application does.
+ */
+extern int allocation_request_get_fd(const allocation_request_t *request);
+
+/*!
+ * Cancel a request that hasn't started yet.
+ *
+ * \return 0 if the request was cancelled, -1 if it already started or
+ *         completed.
+ */
+extern int allocation_request_cancel(allocation_request_t *request);
+
+/*!
+ * Wait for a request to complete and collect its allocation.
+ *
+ * Returns immediately once the request's eventfd is readable.  A request
+ * that hasn't started yet runs on the calling thread.
+ *
+ * \return 0 on success, in which case the caller takes ownership of the
+ *         allocation returned in <allocation>.  -1 if creating the
+ *         allocation failed, the request was cancelled, or the allocation was
+ *         already collected.
+ */
+extern int allocation_request_wait(allocation_request_t *request,
+                                   allocation_t **allocation);
+
+/*!
+ * Destroy a request, cancelling it if it hasn't started.
+ *
+ * A request still running finishes in the background, and an allocation not
+ * collected with allocation_request_wait() is destroyed.
+ */
+extern void allocation_request_destroy(allocation_request_t *request);
+
 /*!
  * Destroy an allocation previously created on the specified device.
  */
 extern void device_destroy_allocation(device_t *dev,
                                       allocation_t *allocation);
 
+/*!
+ * Make device_create_allocation() and device_create_allocations() leave room
+ * for surfaces to grow, e.g. while a window is resized.
+ *
+ * Widths and heights are increased by <percent> percent, then rounded up to
+ * a multiple of <granularity> pixels, before the driver creates the
+ * allocations.  The allocations still describe the requested surface, and
+ * device_reassert_allocation() can later switch them to any other size that
+ * fits.  Allocations are created without headroom if the larger ones can't
+ * be, e.g. because they would exceed a memory budget.  Assertions with a
+ * non-NULL ext pointer never get headroom, and neither do devices whose
+ * driver plans its own layouts but can't switch an allocation to another
+ * surface.
+ *
+ * Passing 0 for both disables headroom, which is the default.
+ */
+extern void device_set_allocation_headroom(device_t *dev,
+                                           uint32_t granularity,
+                                           uint32_t percent);
+
+/*!
+ * Switch an allocation to a surface of a different width and height, reusing
+ * its memory, instead of destroying it and creating another.
+ *
+ * Succeeds if the layout device_plan_layout() gives for <assertion> and the
+ * allocation's capability set fits within the allocation, and the driver
+ * agrees to the switch.  The allocation
+ * then describes <assertion> for device_fill_allocation() and
+ * device_damage_allocation_rects(), and is pooled as an allocation of that
+ * size.  Its contents are undefined.  Importers must be given the new
+ * assertion to plan the same layout.
+ *
+ * The allocation must not be mapped, and must not be used by other threads
+ * meanwhile.
+ *
+ * \return 0 on success, -1 if the allocation can't hold the surface, was
+ *         created with a non-NULL assertion ext pointer, <assertion> has a
+ *         different format or a non-NULL ext pointer, or the device can't
+ *         switch the allocation's layout.  The allocation is unchanged on
+ *         failure.
+ */
+extern int device_reassert_allocation(device_t *dev,
+                                      allocation_t *allocation,
+                                      const assertion_t *assertion);
+
+/*!
+ * Keep allocations released by device_destroy_allocation() for reuse.
+ *
+ * Pooling is disabled by default.  While it is enabled, a released
+ * allocation is kept if it fits within the limits, and
+ * device_create_allocation() returns a pooled allocation instead of creating
+ * one if the pool holds an allocation created with the same width, height,
+ * format, and capability set.  The contents of a recycled allocation are
+ * undefined.  Allocations created with a non-NULL assertion ext pointer, or
+ * while pooling was disabled, are never pooled.  Neither are allocations that
+ * were ever exported, since other processes may still be using their memory.
+ *
+ * When a released allocation doesn't fit, the least recently released
+ * allocations are destroyed to make room.
+ *
+ * \param[in] max_allocations The maximum number of pooled allocations.  0
+ *                            disables pooling and destroys every pooled
+ *                            allocation.
+ *
+ * \param[in] max_bytes The maximum total size of the pooled allocations.
+ */
+extern void device_set_allocation_pool_limits(device_t *dev,
+                                              uint32_t max_allocations,
+                                              uint64_t max_bytes);
+
+/*!
+ * Release the memory of the least recently released pooled allocations until
+ * the pool holds at most <max_bytes> bytes, e.g. when the application is
+ * notified of memory pressure.  Pass 0 to release all of it.
+ *
+ * Allocations whose device can purge them, giving their memory back to the
+ * system while keeping the allocation, stay pooled and are backed by fresh
+ * zeroed memory when reused.  Others are destroyed.  The memory budgets and
+ * memory pressure trimming release pooled memory the same way.
+ */
+extern void device_trim_allocation_pool(device_t *dev, uint64_t max_bytes);
+
+/*!
+ * Check whether device_create_allocation() recycled an allocation from the
+ * allocation pool after its memory was purged, discarding its contents.
+ *
+ * \return 1 if the allocation was recycled after being purged, in which case
+ *         it reads as zeroes, 0 otherwise.
+ */
+extern int device_allocation_contents_discarded(device_t *dev,
+                                                const allocation_t *allocation);
+
 /*!
  * Export an allocation previously created on the specified device.
  *
+ * The library exports each allocation from the driver once, and later
+ * exports return a duplicate of the same file descriptor, with
+ * close-on-exec set.
+ *
  * On success, the caller takes ownership of the file descriptor returned in
  * <fd> and must free the memory pointed to by <metadata>:
  *
@@ -125,6 +548,334 @@ extern int device_export_allocation(device_t *dev,
                                     void **metadata,
                                     int *fd);
 
+/*!
+ * Export an allocation like device_export_allocation(), but without copying
+ * its metadata.
+ *
+ * The memory pointed to by <metadata> is shared by every export of the
+ * allocation.  It must not be modified or freed by the caller, and remains
+ * valid until the allocation is destroyed.  The caller takes ownership of
+ * the file descriptor returned in <fd>.
+ */
+extern int device_export_allocation_shared(device_t *dev,
+                                           const allocation_t *allocation,
+                                           uint64_t *allocation_size,
+                                           size_t *metadata_size,
+                                           const void **metadata,
+                                           int *fd);
+
+/*!
+ * Export several allocations created from the same capability set, e.g. by
+ * device_create_allocations().
+ *
+ * Returns the size and a file descriptor of each allocation in
+ * <allocation_sizes> and <fds>, which must have room for <count> elements,
+ * and a single metadata blob describing all of them.  Fails if the
+ * allocations were realized with different capability sets.
+ *
+ * On success, the caller takes ownership of the file descriptors returned in
+ * <fds> and must free the memory pointed to by <metadata>:
+ *
+ *     free(*metadata);
+ */
+extern int device_export_allocations(device_t *dev,
+                                     uint32_t count,
+                                     allocation_t *const *allocations,
+                                     uint64_t *allocation_sizes,
+                                     size_t *metadata_size,
+                                     void **metadata,
+                                     int *fds);
+
+/*! Map flags: the CPU will read and/or write the mapped allocation */
+#define ALLOCATION_MAP_READ                                         0x00000001
+#define ALLOCATION_MAP_WRITE                                        0x00000002
+
+/*!
+ * Map an allocation for CPU access.
+ *
+ * The first call maps the allocation's exported file descriptor, and the
+ * mapping is kept until the allocation is destroyed, so later calls return
+ * the same address without mapping it again.  Each call begins CPU access
+ * with DMA_BUF_IOCTL_SYNC if the file descriptor supports it, and must be
+ * matched by a device_unmap_allocation() call with the same <flags> once
+ * the CPU is done with the memory.  Calls may be nested and may overlap
+ * across threads.
+ *
+ * \param[in] flags ALLOCATION_MAP_* flags giving the intended access.
+ *
+ * \param[out] ptr Receives the address of the start of the allocation.
+ *
+ * \return 0 on success, -1 if the allocation can't be mapped with the
+ *         requested access.
+ */
+extern int device_map_allocation(device_t *dev,
+                                 allocation_t *allocation,
+                                 uint32_t flags,
+                                 void **ptr);
+
+/*!
+ * End CPU access begun by device_map_allocation().
+ *
+ * The address returned by device_map_allocation() must not be used once
+ * every call to it has been matched by a call to this function.
+ */
+extern void device_unmap_allocation(device_t *dev,
+                                    allocation_t *allocation,
+                                    uint32_t flags);
+
+/*!
+ * Fill the pixels of a plane of an allocation with one value, e.g. to clear
+ * a new surface to a constant color.
+ *
+ * <pixel> holds one pixel in the plane's format, e.g. 4 bytes for
+ * DRM_FORMAT_ARGB8888, or a Cb, Cr pair for the second plane of NV12.  Only
+ * the surface's width x height pixels are written, not padding.
+ *
+ * The driver does the fill if it can, e.g. with a GPU clear.  Otherwise the
+ * allocation is filled through a CPU mapping, with large fills spread over
+ * worker threads.
+ *
+ * \return 0 on success, -1 if the allocation wasn't created from a plain
+ *         assertion on this device, its layout is unknown, or it can't be
+ *         mapped for writing.
+ */
+extern int device_fill_allocation(device_t *dev,
+                                  allocation_t *allocation,
+                                  uint32_t plane,
+                                  const void *pixel);
+
+/*!
+ * Report ranges of a mapped allocation the CPU has written.
+ *
+ * Ranges reported between device_map_allocation() and
+ * device_unmap_allocation() calls with ALLOCATION_MAP_WRITE are merged, and
+ * only they are made visible to devices when access ends, if the driver
+ * supports syncing ranges.  Otherwise, or if none are reported, the whole
+ * allocation is.
+ *
+ * \return 0 on success, -1 if a range lies outside the allocation, the
+ *         allocation isn't mapped, or memory allocation failed.
+ */
+extern int device_damage_allocation_ranges(device_t *dev,
+                                           allocation_t *allocation,
+                                           uint32_t num_ranges,
+                                           const allocation_range_t *ranges);
+
+/*!
+ * A rectangle of pixels, e.g. a region damaged by rendering.
+ */
+typedef struct allocation_rect {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+} allocation_rect_t;
+
+/*!
+ * Report rectangles of a plane of a mapped pitch linear allocation the CPU
+ * has written, like device_damage_allocation_ranges().
+ *
+ * Coordinates are in the plane's own pixels, which for subsampled planes
+ * are fewer than the surface's.
+ *
+ * \return 0 on success, -1 if a rectangle lies outside the plane, the
+ *         allocation isn't a mapped pitch linear surface created on this
+ *         device, or memory allocation failed.
+ */
+extern int device_damage_allocation_rects(device_t *dev,
+                                          allocation_t *allocation,
+                                          uint32_t plane,
+                                          uint32_t num_rects,
+                                          const allocation_rect_t *rects);
+
+/*!
+ * Hands out small allocations carved from larger backing allocations.
+ */
+typedef struct suballocator suballocator_t;
+
+/*!
+ * A range of a backing allocation returned by suballocator_alloc().
+ */
+typedef struct suballocation {
+    /*! The backing allocation the suballocation is part of */
+    const allocation_t *allocation;
+
+    /*! Offset of the suballocation within <allocation>, in bytes */
+    uint64_t offset;
+
+    /*! Size of the suballocation, in bytes */
+    uint64_t size;
+
+    /*! Distance between the starts of consecutive rows, in bytes */
+    uint32_t pitch;
+
+    /*! Private data used by the allocator library */
+    void *library_private;
+} suballocation_t;
+
+/*!
+ * Create a suballocator for many small allocations sharing a capability set,
+ * such as cursors, icons, or glyph atlases.
+ *
+ * Backing allocations are created on demand from <assertion> and
+ * <capability_set>, which should describe an allocation several times larger
+ * than the suballocations, and are divided with a binary buddy allocator.
+ * Suballocations honor the capability set's CONSTRAINT_ADDRESS_ALIGNMENT,
+ * CONSTRAINT_PITCH_ALIGNMENT, and CONSTRAINT_MAX_PITCH constraints, so it
+ * should be the result of merging the capabilities of every device the
+ * suballocations are used with.
+ *
+ * \return The suballocator, or NULL on failure, including when the address
+ *         alignment isn't a power of two or <assertion> has a non-NULL ext
+ *         pointer.
+ */
+extern suballocator_t *device_create_suballocator(
+    device_t *dev,
+    const assertion_t *assertion,
+    const capability_set_t *capability_set);
+
+/*!
+ * Destroy a suballocator and all of its backing allocations.  Any remaining
+ * suballocations are freed along with them.
+ */
+extern void suballocator_destroy(suballocator_t *suballocator);
+
+/*!
+ * Carve a 2D image out of a backing allocation, creating a new backing
+ * allocation if none has a large enough free range.
+ *
+ * The image's size is rounded up to a power of two of at least 256 bytes
+ * and the address alignment.
+ */
+extern int suballocator_alloc(suballocator_t *suballocator,
+                              uint32_t width,
+                              uint32_t height,
+                              uint32_t bytes_per_pixel,
+                              suballocation_t *suballocation);
+
+/*!
+ * Return a suballocation to its suballocator.  Backing allocations left
+ * empty are destroyed, except for one kept for later requests.
+ */
+extern void suballocator_free(suballocator_t *suballocator,
+                              const suballocation_t *suballocation);
+
+/*!
+ * Export the backing allocation of a suballocation, along with the
+ * suballocation's offset within it.
+ *
+ * Works like device_export_allocation().  The caller takes ownership of the
+ * file descriptor returned in <fd> and must free the memory pointed to by
+ * <metadata>.
+ */
+extern int suballocator_export(suballocator_t *suballocator,
+                               const suballocation_t *suballocation,
+                               uint64_t *allocation_size,
+                               uint64_t *offset,
+                               size_t *metadata_size,
+                               void **metadata,
+                               int *fd);
+
+/*!
+ * A fixed ring of identical allocations passed back and forth between a
+ * producer and a consumer, e.g. a renderer and a compositor.
+ */
+typedef struct swapchain swapchain_t;
+
+/*! Most allocations a swapchain can hold */
+#define SWAPCHAIN_MAX_BUFFERS 64
+
+/*!
+ * Create a swapchain of <num_buffers> allocations conforming to <assertion>
+ * and <capability_set>, which should be the result of merging the
+ * capabilities of the producer's and the consumer's devices.
+ *
+ * The allocations are created together with device_create_allocations(),
+ * and every buffer starts out available to swapchain_acquire_next().
+ *
+ * \return The swapchain, or NULL on failure, including when <num_buffers>
+ *         is 0 or more than SWAPCHAIN_MAX_BUFFERS.
+ */
+extern swapchain_t *device_create_swapchain(
+    device_t *dev,
+    const assertion_t *assertion,
+    const capability_set_t *capability_set,
+    uint32_t num_buffers);
+
+/*!
+ * Destroy a swapchain and all of its allocations, whether or not they were
+ * released.
+ */
+extern void swapchain_destroy(swapchain_t *swapchain);
+
+extern uint32_t swapchain_get_num_buffers(const swapchain_t *swapchain);
+
+/*!
+ * Get the allocation of buffer <index>, e.g. to map it.  The allocation is
+ * owned by the swapchain.
+ *
+ * \return The allocation, or NULL if <index> is out of range.
+ */
+extern allocation_t *swapchain_get_allocation(const swapchain_t *swapchain,
+                                              uint32_t index);
+
+/*!
+ * Take the next available buffer, in ring order, for the producer to draw
+ * into.  The buffer stays taken until swapchain_release() is called on it,
+ * typically once the consumer is done with it.
+ *
+ * Safe to call from any thread, concurrently with swapchain_release(), and
+ * never waits or calls into the driver.
+ *
+ * \return 0 on success, -1 if every buffer is taken.
+ */
+extern int swapchain_acquire_next(swapchain_t *swapchain, uint32_t *index);
+
+/*!
+ * Make a buffer taken by swapchain_acquire_next() available again.
+ *
+ * Safe to call from any thread, and never waits or calls into the driver.
+ *
+ * \return 0 on success, -1 if <index> is out of range or the buffer wasn't
+ *         taken.
+ */
+extern int swapchain_release(swapchain_t *swapchain, uint32_t index);
+
+/*!
+ * Export every buffer of a swapchain at once, e.g. to hand them to the
+ * consumer when the swapchain is created.
+ *
+ * Works like device_export_allocations(), with <allocation_sizes> and <fds>
+ * indexed like the buffers and having room for swapchain_get_num_buffers()
+ * elements.
+ */
+extern int swapchain_export(swapchain_t *swapchain,
+                            uint64_t *allocation_sizes,
+                            size_t *metadata_size,
+                            void **metadata,
+                            int *fds);
+
+/*!
+ * Import an allocation exported with device_export_allocation(), possibly
+ * from another device or process.
+ *
+ * <allocation_size>, <metadata_size>, and <metadata> are the values returned
+ * by the export.  The caller keeps ownership of <fd>.
+ *
+ * Importing the same file, as identified by its st_dev and st_ino, on the
+ * same device again returns the existing allocation without calling into
+ * the driver, so clients may resend their buffers every frame.  Each
+ * successful import must be matched by a call to device_destroy_allocation(),
+ * and the allocation is destroyed by the last one.  Importing the same file
+ * with different metadata fails.
+ */
+extern int device_import_allocation(device_t *dev,
+                                    uint64_t allocation_size,
+                                    size_t metadata_size,
+                                    const void *metadata,
+                                    int fd,
+                                    allocation_t **allocation);
+
 /*!
  * Free an array of capability sets created by the allocator library
  */
@@ -155,6 +906,117 @@ extern int deserialize_capability_set(size_t data_size,
                                       const void *data,
                                       capability_set_t **capability_set);
 
+/*!
+ * Memory held through the allocator library.
+ */
+typedef struct memory_usage {
+    /*! Allocations created and not yet destroyed by the application */
+    uint64_t live_bytes;
+    uint32_t num_live;
+
+    /*!
+     * Released allocations kept in allocation pools.  Purged allocations
+     * are counted in num_pooled but not in pooled_bytes.
+     */
+    uint64_t pooled_bytes;
+    uint32_t num_pooled;
+} memory_usage_t;
+
+/*!
+ * Get the memory held through one device.
+ *
+ * Sizes are the allocation_t::size of each allocation.  Imported allocations
+ * aren't counted, since their memory belongs to the exporter.
+ */
+extern void device_get_memory_usage(device_t *dev, memory_usage_t *usage);
+
+/*!
+ * Get the memory held through all devices of the process.
+ */
+extern void get_memory_usage(memory_usage_t *usage);
+
+/*!
+ * Limit the memory held through one device.
+ *
+ * Whenever the live and pooled memory exceed <soft_budget>, reclaimable
+ * memory such as pooled allocations is released until they don't, or none
+ * is left.  Creating allocations fails if they would take the total over
+ * <hard_budget> even after releasing reclaimable memory.  Under concurrent
+ * use the budgets may be exceeded slightly.  0 means no budget.
+ */
+extern void device_set_memory_budget(device_t *dev,
+                                     uint64_t soft_budget,
+                                     uint64_t hard_budget);
+
+/*!
+ * Limit the memory held through all devices of the process, like
+ * device_set_memory_budget().
+ */
+extern void set_memory_budget(uint64_t soft_budget, uint64_t hard_budget);
+
+/*!
+ * Release all reclaimable memory whenever the system is under memory
+ * pressure.
+ *
+ * Starts a thread monitoring a Linux pressure stall information (PSI)
+ * trigger on /proc/pressure/memory, which fires when tasks were stalled
+ * waiting for memory for <stall_us> microseconds within a <window_us>
+ * microsecond window.  Unprivileged processes need a window that is a
+ * multiple of 2 seconds.  Only the first successful call in a process has
+ * an effect, so a forked child must call this again to start its own
+ * monitor.
+ *
+ * \return 0 on success, -1 if the kernel doesn't support PSI triggers.
+ */
+extern int enable_memory_pressure_trimming(uint32_t stall_us,
+                                           uint32_t window_us);
+
+/*!
+ * A timed phase of driver discovery or device creation.
+ *
+ * Timing records are only collected if the ALLOCATOR_DEBUG environment
+ * variable contains "timing", in which case a summary is also printed to
+ * stderr when the process exits.
+ */
+typedef struct timing_record {
+    /*! One of the TIMING_PHASE_* values */
+    uint32_t phase;
+
+    /*! 0 if the phase succeeded, or matched for TIMING_PHASE_FD_PROBE */
+    int result;
+
+    /*! CLOCK_MONOTONIC time the phase started at, in nanoseconds */
+    uint64_t start_ns;
+
+    /*! Duration of the phase, in nanoseconds */
+    uint64_t duration_ns;
+
+    /*! The directory, config file, or driver library the phase acted on */
+    const char *subject;
+} timing_record_t;
+#define TIMING_PHASE_DIRECTORY_SCAN                                 0x00000000
+#define TIMING_PHASE_MANIFEST_PARSE                                 0x00000001
+#define TIMING_PHASE_DLOPEN                                         0x00000002
+#define TIMING_PHASE_DRIVER_INIT                                    0x00000003
+#define TIMING_PHASE_FD_PROBE                                       0x00000004
+
+/*!
+ * Retrieve the timing records collected so far, oldest first.
+ *
+ * The caller is responsible for freeing the memory pointed to by
+ * <timing_records>:
+ *
+ *     free_timing_records(*num_timing_records, *timing_records);
+ */
+extern int get_timing_records(uint32_t *num_timing_records,
+                              timing_record_t **timing_records);
+
+/*!
+ * Free an array of timing records returned by get_timing_records()
+ */
+extern void free_timing_records(uint32_t num_timing_records,
+                                timing_record_t *timing_records);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
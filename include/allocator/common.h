@@ -107,12 +107,34 @@ typedef struct constraint {
         struct {
             uint32_t value;
         } max_pitch;
+
+        /*!
+         * CONSTRAINT_NUMA_NODE
+         *
+         * Takes the node and flag values of usage_numa_placement_t.
+         */
+        struct {
+            uint32_t node;
+            uint32_t flags;
+        } numa_node;
+
+        /*!
+         * CONSTRAINT_UNINITIALIZED
+         *
+         * Allocations needn't be cleared.  No flags are defined yet, so
+         * flags must be 0.
+         */
+        struct {
+            uint32_t flags;
+        } uninitialized;
     } u;
 } constraint_t;
 #define CONSTRAINT_ADDRESS_ALIGNMENT                                0x00000000
 #define CONSTRAINT_PITCH_ALIGNMENT                                  0x00000001
 #define CONSTRAINT_MAX_PITCH                                        0x00000002
-#define CONSTRAINT_END                                              ((CONSTRAINT_MAX_PITCH) + 1)
+#define CONSTRAINT_NUMA_NODE                                        0x00000003
+#define CONSTRAINT_UNINITIALIZED                                    0x00000004
+#define CONSTRAINT_END                                              ((CONSTRAINT_UNINITIALIZED) + 1)
 
 /*!
  * @}
@@ -166,6 +188,23 @@ typedef struct capability_pitch_linear {
 } capability_pitch_linear_t;
 #define CAP_BASE_PITCH_LINEAR 0x0000
 
+/*!
+ * The ability to represent 2D images as a grid of tile_width x tile_height
+ * pixel blocks, which keeps neighboring pixels close in memory.
+ *
+ * Each tile's rows are stored consecutively, tile_width pixels each, and the
+ * tiles of a row of tiles follow one another.  Rows of tiles start
+ * plane_layout_t::pitch * tile_height bytes apart, so the pitch is that of
+ * the surface padded to whole tiles, as if it were pitch linear.  Planes
+ * are padded to whole tiles in both directions.
+ */
+typedef struct capability_block_tiled {
+    capability_header_t header; // { VENDOR_BASE, CAP_BASE_BLOCK_TILED, 2 }
+    uint32_t tile_width;
+    uint32_t tile_height;
+} capability_block_tiled_t;
+#define CAP_BASE_BLOCK_TILED 0x0001
+
 /*!
  * Capability sets are made up of zero or more constraints and one or more
  * capability descriptors
@@ -228,6 +267,44 @@ typedef struct usage_display {
 /* mirror flag */
 #define USAGE_BASE_DISPLAY_MIRROR               0x00000004
 
+/*!
+ * Request that CPU-accessible memory be placed on a NUMA node, e.g. the node
+ * of the threads that will access it.
+ *
+ * Devices that place memory report the request back as a
+ * CONSTRAINT_NUMA_NODE constraint, so it applies to allocations made from
+ * the capability set.  Capability sets placing memory on different nodes
+ * can't be combined.  Devices that don't place memory ignore this usage.
+ */
+typedef struct usage_numa_placement {
+    usage_header_t header; // { VENDOR_BASE, USAGE_BASE_NUMA_PLACEMENT, 2 }
+
+    /*! Node ID, or USAGE_BASE_NUMA_NODE_LOCAL */
+    uint32_t node;
+
+    /*! USAGE_BASE_NUMA_* flags */
+    uint32_t flags;
+} usage_numa_placement_t;
+#define USAGE_BASE_NUMA_PLACEMENT 0x0002
+/* the node of the thread creating the allocation */
+#define USAGE_BASE_NUMA_NODE_LOCAL              0xFFFFFFFF
+/* populate the memory when the allocation is created */
+#define USAGE_BASE_NUMA_PREFAULT                0x00000001
+
+/*!
+ * Declare that the application writes every byte of its allocations before
+ * reading any, so their memory needn't be cleared when they are created.
+ *
+ * Devices that clear memory may skip it, and report doing so as a
+ * CONSTRAINT_UNINITIALIZED constraint.  Their allocations may then hold
+ * leftover data, though never data of another process.  Other devices
+ * ignore this usage.
+ */
+typedef struct usage_uninitialized {
+    usage_header_t header; // { VENDOR_BASE, USAGE_BASE_UNINITIALIZED, 0 }
+} usage_uninitialized_t;
+#define USAGE_BASE_UNINITIALIZED 0x0003
+
 /*!
  * Structure to specify a single usage atom.
  *
@@ -312,4 +389,54 @@ typedef struct assertion_hint {
  * End of the assertions group
  */
 
+/*!
+ * \defgroup layouts
+ * @{
+ */
+
+/*! Most planes a surface layout can describe */
+#define LAYOUT_MAX_PLANES 4
+
+/*!
+ * Placement of one plane of a surface within its allocation.
+ */
+typedef struct plane_layout {
+    /*! Byte offset of the plane's first row from the start of the allocation */
+    uint64_t offset;
+
+    /*! Bytes spanned by the plane, pitch times its height in rows */
+    uint64_t size;
+
+    /*! Bytes between the starts of consecutive rows */
+    uint32_t pitch;
+} plane_layout_t;
+
+/*!
+ * Memory layout of a surface realized with a given assertion and capability
+ * set.
+ */
+typedef struct layout {
+    uint32_t num_planes;
+    plane_layout_t planes[LAYOUT_MAX_PLANES];
+
+    /*! Bytes the allocation must span to hold every plane */
+    uint64_t size;
+
+    /*! Alignment the allocation's address must have */
+    uint64_t alignment;
+} layout_t;
+
+/*!
+ * A range of bytes within an allocation.
+ */
+typedef struct allocation_range {
+    uint64_t offset;
+    uint64_t size;
+} allocation_range_t;
+
+/*!
+ * @}
+ * End of the layouts group
+ */
+
 #endif /* __ALLOCATOR_COMMON_H__ */
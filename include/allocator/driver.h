@@ -84,8 +84,8 @@ typedef struct driver {
      *
      * \param[in] dev_fd A file descriptor referring to a device node.
      *
-     * \return 0 if the file descriptor represents a device supported by
-     *         this driver.  -1 if it does not.
+     * \return Non-zero if the file descriptor represents a device supported
+     *         by this driver.  0 if it does not.
      */
     int (*is_fd_supported)(struct driver *driver, int dev_fd);
 
@@ -192,8 +192,176 @@ struct device {
     int (*get_allocation_fd)(device_t *dev,
                              const allocation_t *allocation,
                              int *fd);
+
+    /*!
+     * Private data used by the allocator library.
+     *
+     * Populated by the allocator library after the driver returns the
+     * device from device_create_from_fd().  The driver must allocate the
+     * device structure zero-initialized, and should otherwise ignore this
+     * field.
+     */
+    void *library_private;
+
+    /*!
+     * DEVICE_QUERY_CACHE_* flags selecting which query results the allocator
+     * library must pass through without caching.
+     *
+     * Populated by the driver.  By default, the library caches the results of
+     * get_capabilities() and get_assertion_hints() for each distinct set of
+     * parameters, except for assertions with a non-NULL ext pointer.  Drivers
+     * whose results depend on state that changes too often to track with
+     * query_generation should disable caching instead.
+     */
+    uint32_t query_cache_flags;
+
+    /*!
+     * Generation count of the device's query results.
+     *
+     * Initialized to zero along with the rest of the structure.  The driver
+     * must increment this atomically, e.g. with __atomic_fetch_add(), whenever
+     * results previously returned from get_capabilities() or
+     * get_assertion_hints() may no longer be accurate, for example after a
+     * hotplug event or a display mode change.  The allocator library
+     * discards cached results from earlier generations.
+     */
+    uint32_t query_generation;
+
+    /*!
+     * Create several identical allocations given an assertion and capability
+     * set.
+     *
+     * Optionally populated by the driver.
+     *
+     * Equivalent to <count> calls to create_allocation(), but lets drivers
+     * set up the allocations in one round trip to the kernel, for example
+     * the buffers of a swapchain.  Either all of the allocations are created
+     * or, on failure, none of them are.  If NULL, the allocator library calls
+     * create_allocation() once per allocation.
+     */
+    int (*create_allocations)(device_t *dev,
+                              const assertion_t *assertion,
+                              const capability_set_t *capability_set,
+                              uint32_t count,
+                              allocation_t **allocations);
+
+    /*!
+     * Create an allocation referring to memory exported by another device
+     * or process.
+     *
+     * Optionally populated by the driver.  If NULL, the device can't import
+     * allocations.
+     *
+     * <capability_set> describes the memory, as deserialized from the
+     * exporter's metadata, and <size> is the exported allocation size.  The
+     * driver must not keep references to <capability_set> or take ownership
+     * of <fd>.  The allocation is destroyed with destroy_allocation().
+     */
+    int (*import_allocation)(device_t *dev,
+                             const capability_set_t *capability_set,
+                             uint64_t size,
+                             int fd,
+                             allocation_t **allocation);
+
+    /*!
+     * Compute the memory layout create_allocation() would use for an
+     * assertion and capability set, without allocating anything.
+     *
+     * Optionally populated by the driver.  If NULL, the allocator library
+     * computes a pitch linear layout from the capability set's constraints,
+     * and fails for capability sets containing anything but pitch linear.
+     * Drivers which pad surfaces or use their own tiling formats should
+     * populate this.
+     */
+    int (*plan_layout)(device_t *dev,
+                       const assertion_t *assertion,
+                       const capability_set_t *capability_set,
+                       layout_t *layout);
+
+    /*!
+     * Begin or end CPU access to ranges of an allocation, e.g. by
+     * invalidating or writing back CPU caches the device doesn't snoop.
+     *
+     * Optionally populated by the driver.  If NULL, the allocator library
+     * uses DMA_BUF_IOCTL_SYNC on the allocation's fd, which always covers
+     * the whole allocation.
+     *
+     * <flags> is ALLOCATION_SYNC_START or ALLOCATION_SYNC_END combined with
+     * ALLOCATION_SYNC_READ and/or ALLOCATION_SYNC_WRITE.  Access starts on
+     * the whole allocation.  When it ends, <ranges> are the sorted,
+     * non-overlapping ranges the application reported as written, or the
+     * whole allocation if it reported none.
+     */
+    int (*sync_allocation)(device_t *dev,
+                           allocation_t *allocation,
+                           uint32_t flags,
+                           uint32_t num_ranges,
+                           const allocation_range_t *ranges);
+
+    /*!
+     * Fill the width x height pixels of a plane of an allocation with
+     * <pixel>, e.g. with a GPU clear, leaving any padding alone.
+     *
+     * <assertion> is the one the allocation was created with.  The fill
+     * must be complete, or ordered before later device access, when this
+     * returns.
+     *
+     * Optionally populated by the driver.  If NULL or it fails, the
+     * allocator library fills the allocation through a CPU mapping.
+     */
+    int (*fill_allocation)(device_t *dev,
+                           allocation_t *allocation,
+                           const assertion_t *assertion,
+                           uint32_t plane,
+                           const void *pixel);
+
+    /*!
+     * Give the memory backing an allocation back to the system, discarding
+     * its contents, e.g. by punching a hole in the file backing it.  The
+     * allocation remains valid, and is backed by fresh memory reading as
+     * zeroes when next accessed.
+     *
+     * Called on pooled allocations that are neither mapped nor exported,
+     * when the allocator library is asked to release pooled memory.
+     *
+     * Drivers should fail if the memory can't be reliably faulted back in
+     * later, e.g. because it came from a reservation such as huge pages.
+     *
+     * Optionally populated by the driver.  If NULL or it fails, the
+     * allocator library destroys the allocation instead.
+     */
+    int (*purge_allocation)(device_t *dev, allocation_t *allocation);
+
+    /*!
+     * Switch an allocation to a surface of a different width and height and
+     * the same format, reusing its memory.  Afterwards, plan_layout() for
+     * <assertion> and the allocation's capability set must describe the
+     * layout the device uses for the allocation.
+     *
+     * Called when the allocator library creates allocations with headroom,
+     * to switch them from the padded surface to the requested one, and from
+     * device_reassert_allocation().  The allocation isn't mapped meanwhile.
+     *
+     * Optionally populated by the driver.  If NULL, the allocator library
+     * only adds headroom and reasserts allocations on devices without
+     * plan_layout(), whose layouts follow from the assertion and capability
+     * set alone.  Drivers that fix a layout when creating an allocation, e.g.
+     * in the tiling or stride metadata of a kernel buffer object, should
+     * populate this, and fail if they can't change it.
+     */
+    int (*reassert_allocation)(device_t *dev,
+                               allocation_t *allocation,
+                               const assertion_t *assertion);
 };
 
+#define ALLOCATION_SYNC_START                                       0x00000001
+#define ALLOCATION_SYNC_END                                         0x00000002
+#define ALLOCATION_SYNC_READ                                        0x00000004
+#define ALLOCATION_SYNC_WRITE                                       0x00000008
+
+#define DEVICE_QUERY_CACHE_DISABLE_CAPABILITIES                     0x00000001
+#define DEVICE_QUERY_CACHE_DISABLE_ASSERTION_HINTS                  0x00000002
+
 /*!
  * Structure representing a device memory allocation within the allocator
  * library and its driver backends.
@@ -223,6 +391,16 @@ struct allocation {
      * Populated by the allocating driver.
      */
     uint64_t size;
+
+    /*!
+     * Private data used by the allocator library.
+     *
+     * Populated by the allocator library after the driver returns the
+     * allocation from create_allocation().  The driver must allocate the
+     * allocation structure zero-initialized, and should otherwise ignore this
+     * field.
+     */
+    void *library_private;
 };
 
 /*!
@@ -246,8 +424,22 @@ typedef int (*driver_init_func_t)(driver_t *drv);
 
 /*!
  * Current driver interface version
+ *
+ * Version history:
+ *
+ *   1: Initial version
+ *   2: Added device::library_private
+ *   3: Added device::query_cache_flags and device::query_generation
+ *   4: Added allocation::library_private
+ *   5: Added device::create_allocations
+ *   6: Added device::import_allocation
+ *   7: Added device::plan_layout
+ *   8: Added device::sync_allocation
+ *   9: Added device::fill_allocation
+ *  10: Added device::purge_allocation
+ *  11: Added device::reassert_allocation
  */
-#define DRIVER_INTERFACE_VERSION 1
+#define DRIVER_INTERFACE_VERSION 11
 
 /*!
  * Current driver json file major version
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "accounting.h"
+#include "device_state.h"
+#include "driver_manager.h"
+
+/*!
+ * Every device, so pooled memory can be trimmed process-wide.  Trimming
+ * holds devices_lock, which keeps devices from being destroyed meanwhile.
+ */
+static pthread_mutex_t devices_lock = PTHREAD_MUTEX_INITIALIZER;
+static device_state_t *devices = NULL;
+
+/*! Process-wide totals, updated atomically */
+static uint64_t process_live_bytes = 0;
+static uint32_t process_num_live = 0;
+static uint64_t process_pooled_bytes = 0;
+static uint32_t process_num_pooled = 0;
+
+/*! Process-wide budgets set by set_memory_budget(), or 0 */
+static uint64_t process_soft_budget = 0;
+static uint64_t process_hard_budget = 0;
+
+/*!
+ * The memory pressure monitor, started at most once per process, and the
+ * PSI trigger it polls
+ */
+static pthread_mutex_t monitor_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t monitor_fork_once = PTHREAD_ONCE_INIT;
+static int monitor_started = 0;
+static int monitor_fd = -1;
+
+void register_device(device_state_t *state)
+{
+    pthread_mutex_lock(&devices_lock);
+    state->all_next = devices;
+    devices = state;
+    pthread_mutex_unlock(&devices_lock);
+}
+
+void unregister_device(device_state_t *state)
+{
+    device_state_t **s;
+
+    pthread_mutex_lock(&devices_lock);
+
+    for (s = &devices; *s != state; s = &(*s)->all_next);
+
+    *s = state->all_next;
+
+    pthread_mutex_unlock(&devices_lock);
+}
+
+/*!
+ * Count allocations handed to or taken back from the application.
+ */
+void account_live(device_state_t *state, int64_t bytes, int32_t count)
+{
+    __atomic_add_fetch(&state->live_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&state->num_live, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&process_live_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&process_num_live, count, __ATOMIC_RELAXED);
+}
+
+/*!
+ * Count allocations added to or removed from a device's allocation pool.
+ * The per-device counts are kept by the pool itself.
+ */
+void account_pooled(int64_t bytes, int32_t count)
+{
+    __atomic_add_fetch(&process_pooled_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&process_num_pooled, count, __ATOMIC_RELAXED);
+}
+
+static uint64_t device_pooled_bytes(const device_state_t *state)
+{
+    return __atomic_load_n(&state->allocation_pool.num_bytes,
+                           __ATOMIC_RELAXED);
+}
+
+static uint64_t device_total_bytes(const device_state_t *state)
+{
+    return __atomic_load_n(&state->live_bytes, __ATOMIC_RELAXED) +
+        device_pooled_bytes(state);
+}
+
+static uint64_t process_total_bytes(void)
+{
+    return __atomic_load_n(&process_live_bytes, __ATOMIC_RELAXED) +
+        __atomic_load_n(&process_pooled_bytes, __ATOMIC_RELAXED);
+}
+
+/*!
+ * Release up to <bytes> bytes of a device's reclaimable memory.
+ */
+static void trim_device(device_state_t *state, uint64_t bytes)
+{
+    uint64_t pooled = device_pooled_bytes(state);
+
+    trim_allocation_pool(&state->allocation_pool, UINT32_MAX,
+                         (pooled > bytes) ? pooled - bytes : 0);
+}
+
+/*!
+ * Release reclaimable memory of every device until the process-wide total
+ * is at most <target> bytes, or nothing reclaimable is left.
+ */
+static void trim_process(uint64_t target)
+{
+    device_state_t *state;
+
+    pthread_mutex_lock(&devices_lock);
+
+    for (state = devices; state; state = state->all_next) {
+        uint64_t total = process_total_bytes();
+
+        if (total <= target) {
+            break;
+        }
+
+        trim_device(state, total - target);
+    }
+
+    pthread_mutex_unlock(&devices_lock);
+}
+
+/*!
+ * Check whether <bytes> more bytes fit within the device and process hard
+ * budgets, releasing reclaimable memory to make room if needed.
+ *
+ * Budgets are checked before the bytes are counted, so concurrent
+ * allocations may overshoot them slightly.
+ *
+ * \return 0 if the bytes fit, -1 otherwise.
+ */
+int check_hard_budgets(device_state_t *state, uint64_t bytes)
+{
+    uint64_t device_budget = __atomic_load_n(&state->hard_budget,
+                                             __ATOMIC_RELAXED);
+    uint64_t process_budget = __atomic_load_n(&process_hard_budget,
+                                              __ATOMIC_RELAXED);
+
+    if (device_budget) {
+        if (bytes > device_budget) {
+            return -1;
+        }
+
+        if (device_total_bytes(state) > device_budget - bytes) {
+            trim_device(state,
+                        device_total_bytes(state) - (device_budget - bytes));
+
+            if (device_total_bytes(state) > device_budget - bytes) {
+                return -1;
+            }
+        }
+    }
+
+    if (process_budget) {
+        if (bytes > process_budget) {
+            return -1;
+        }
+
+        if (process_total_bytes() > process_budget - bytes) {
+            trim_process(process_budget - bytes);
+
+            if (process_total_bytes() > process_budget - bytes) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * Release reclaimable memory while the device or the process is over its
+ * soft budget.
+ */
+void enforce_soft_budgets(device_state_t *state)
+{
+    uint64_t device_budget = __atomic_load_n(&state->soft_budget,
+                                             __ATOMIC_RELAXED);
+    uint64_t process_budget = __atomic_load_n(&process_soft_budget,
+                                              __ATOMIC_RELAXED);
+    uint64_t total;
+
+    if (device_budget && ((total = device_total_bytes(state)) >
+                          device_budget)) {
+        trim_device(state, total - device_budget);
+    }
+
+    if (process_budget && (process_total_bytes() > process_budget)) {
+        trim_process(process_budget);
+    }
+}
+
+void device_get_memory_usage(device_t *dev, memory_usage_t *usage)
+{
+    device_state_t *state = get_device_state(dev);
+
+    usage->live_bytes = __atomic_load_n(&state->live_bytes,
+                                        __ATOMIC_RELAXED);
+    usage->num_live = __atomic_load_n(&state->num_live, __ATOMIC_RELAXED);
+    usage->pooled_bytes = device_pooled_bytes(state);
+    usage->num_pooled = __atomic_load_n(
+        &state->allocation_pool.num_allocations, __ATOMIC_RELAXED);
+}
+
+void get_memory_usage(memory_usage_t *usage)
+{
+    usage->live_bytes = __atomic_load_n(&process_live_bytes,
+                                        __ATOMIC_RELAXED);
+    usage->num_live = __atomic_load_n(&process_num_live, __ATOMIC_RELAXED);
+    usage->pooled_bytes = __atomic_load_n(&process_pooled_bytes,
+                                          __ATOMIC_RELAXED);
+    usage->num_pooled = __atomic_load_n(&process_num_pooled,
+                                        __ATOMIC_RELAXED);
+}
+
+void device_set_memory_budget(device_t *dev,
+                              uint64_t soft_budget,
+                              uint64_t hard_budget)
+{
+    device_state_t *state = get_device_state(dev);
+
+    __atomic_store_n(&state->soft_budget, soft_budget, __ATOMIC_RELAXED);
+    __atomic_store_n(&state->hard_budget, hard_budget, __ATOMIC_RELAXED);
+
+    enforce_soft_budgets(state);
+}
+
+void set_memory_budget(uint64_t soft_budget, uint64_t hard_budget)
+{
+    __atomic_store_n(&process_soft_budget, soft_budget, __ATOMIC_RELAXED);
+    __atomic_store_n(&process_hard_budget, hard_budget, __ATOMIC_RELAXED);
+
+    if (soft_budget && (process_total_bytes() > soft_budget)) {
+        trim_process(soft_budget);
+    }
+}
+
+/*!
+ * Release all reclaimable memory whenever the PSI trigger fires.
+ */
+static void *monitor_main(void *arg)
+{
+    struct pollfd pfd;
+
+    pfd.fd = (int)(intptr_t)arg;
+    pfd.events = POLLPRI;
+
+    while (1) {
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        if (pfd.revents & POLLERR) {
+            break;
+        }
+
+        if (pfd.revents & POLLPRI) {
+            trim_process(0);
+        }
+    }
+
+    /* Let the monitor be started again, with a new trigger */
+    pthread_mutex_lock(&monitor_lock);
+    monitor_started = 0;
+    monitor_fd = -1;
+    close(pfd.fd);
+    pthread_mutex_unlock(&monitor_lock);
+
+    return NULL;
+}
+
+static void monitor_prepare_fork(void)
+{
+    pthread_mutex_lock(&monitor_lock);
+}
+
+static void monitor_parent_fork(void)
+{
+    pthread_mutex_unlock(&monitor_lock);
+}
+
+/*!
+ * A forked child has no monitor thread, so let it start its own, with its
+ * own trigger.
+ */
+static void monitor_child_fork(void)
+{
+    if (monitor_started) {
+        close(monitor_fd);
+        monitor_fd = -1;
+        monitor_started = 0;
+    }
+
+    pthread_mutex_unlock(&monitor_lock);
+}
+
+static void register_monitor_fork_handlers(void)
+{
+    pthread_atfork(monitor_prepare_fork, monitor_parent_fork,
+                   monitor_child_fork);
+}
+
+int enable_memory_pressure_trimming(uint32_t stall_us, uint32_t window_us)
+{
+    const char *path = get_user_env(PSI_PATH_ENV);
+    sigset_t all_signals, old_signals;
+    pthread_attr_t attr;
+    pthread_t thread;
+    char trigger[64];
+    int ret = -1;
+    int fd;
+
+    pthread_once(&monitor_fork_once, register_monitor_fork_handlers);
+    pthread_mutex_lock(&monitor_lock);
+
+    if (monitor_started) {
+        ret = 0;
+        goto done;
+    }
+
+    fd = open(path ? path : DEFAULT_PSI_PATH,
+              O_RDWR | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0) {
+        goto done;
+    }
+
+    /* The kernel wants the trigger's terminating nul written as well */
+    snprintf(trigger, sizeof(trigger), "some %u %u", stall_us, window_us);
+
+    if ((write(fd, trigger, strlen(trigger) + 1) < 0) ||
+        pthread_attr_init(&attr)) {
+        close(fd);
+        goto done;
+    }
+
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+    if (!pthread_create(&thread, &attr, monitor_main, (void *)(intptr_t)fd)) {
+        monitor_started = 1;
+        monitor_fd = fd;
+        ret = 0;
+    } else {
+        close(fd);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    pthread_attr_destroy(&attr);
+
+done:
+    pthread_mutex_unlock(&monitor_lock);
+
+    return ret;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_ACCOUNTING_H__
+#define __SRC_ACCOUNTING_H__
+
+#include <stdint.h>
+
+struct device_state;
+
+/*!
+ * Environment variable overriding the PSI file monitored by
+ * enable_memory_pressure_trimming().  It is ignored in setuid and setgid
+ * processes.
+ */
+#define PSI_PATH_ENV "ALLOCATOR_PSI_PATH"
+
+#define DEFAULT_PSI_PATH "/proc/pressure/memory"
+
+extern void register_device(struct device_state *state);
+
+extern void unregister_device(struct device_state *state);
+
+extern void account_live(struct device_state *state,
+                         int64_t bytes,
+                         int32_t count);
+
+extern void account_pooled(int64_t bytes, int32_t count);
+
+extern int check_hard_budgets(struct device_state *state, uint64_t bytes);
+
+extern void enforce_soft_budgets(struct device_state *state);
+
+#endif /* __SRC_ACCOUNTING_H__ */
@@ -0,0 +1,670 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "accounting.h"
+#include "allocation_pool.h"
+#include "hash.h"
+
+/*! Number of allocations each thread can keep without taking the pool lock */
+#define POOL_MAGAZINE_SIZE 4
+
+/*!
+ * A thread's private stash of released allocations for one pool.
+ *
+ * Only the owning thread adds and removes allocations, but pool trimming and
+ * destruction empty magazines from other threads, so they have a lock of
+ * their own that is normally uncontended.
+ */
+struct pool_magazine {
+    pthread_mutex_t lock;
+
+    /*!
+     * The pool the magazine belongs to, or NULL once the pool is destroyed.
+     * Only changes with magazines_lock and lock held.
+     */
+    allocation_pool_t *pool;
+
+    /*! Pooled allocations, oldest first */
+    unsigned int count;
+    allocation_state_t *items[POOL_MAGAZINE_SIZE];
+
+    /*! Next magazine of the same pool, protected by magazines_lock */
+    struct pool_magazine *pool_next;
+
+    /*! Next magazine of the same thread */
+    struct pool_magazine *thread_next;
+};
+
+/*! Protects every pool's magazine list and each magazine's pool pointer */
+static pthread_mutex_t magazines_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Thread-specific list of the calling thread's magazines */
+static pthread_once_t magazine_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t magazine_key;
+static int magazine_key_valid = 0;
+
+static int keys_match(const allocation_state_t *a, const allocation_state_t *b)
+{
+    return (a->pool_hash == b->pool_hash) &&
+        (a->width == b->width) &&
+        (a->height == b->height) &&
+        (a->has_format == b->has_format) &&
+        (a->format == b->format) &&
+        (a->pool_key_size == b->pool_key_size) &&
+        !memcmp(a->pool_key, b->pool_key, a->pool_key_size);
+}
+
+/*!
+ * Add an allocation to the shared lists as the most recently released one.
+ *
+ * Must be called with the pool lock held.
+ */
+static void insert_shared(allocation_pool_t *pool, allocation_state_t *state)
+{
+    allocation_state_t **bucket =
+        &pool->buckets[state->pool_hash % ALLOCATION_POOL_BUCKETS];
+
+    state->bucket_next = *bucket;
+    *bucket = state;
+
+    state->lru_prev = NULL;
+    state->lru_next = pool->lru_head;
+
+    if (pool->lru_head) {
+        pool->lru_head->lru_prev = state;
+    } else {
+        pool->lru_tail = state;
+    }
+
+    pool->lru_head = state;
+}
+
+/*!
+ * Remove an allocation from the shared lists.
+ *
+ * Must be called with the pool lock held.
+ */
+static void remove_shared(allocation_pool_t *pool, allocation_state_t *state)
+{
+    allocation_state_t **e =
+        &pool->buckets[state->pool_hash % ALLOCATION_POOL_BUCKETS];
+
+    while (*e != state) {
+        e = &(*e)->bucket_next;
+    }
+
+    *e = state->bucket_next;
+
+    if (state->lru_prev) {
+        state->lru_prev->lru_next = state->lru_next;
+    } else {
+        pool->lru_head = state->lru_next;
+    }
+
+    if (state->lru_next) {
+        state->lru_next->lru_prev = state->lru_prev;
+    } else {
+        pool->lru_tail = state->lru_prev;
+    }
+}
+
+/*!
+ * Count an allocation against the pool's limits.
+ *
+ * \return 0 if it fits within the limits, -1 otherwise, in which case
+ *         nothing is counted.
+ */
+static int reserve(allocation_pool_t *pool, uint64_t size)
+{
+    uint32_t max_allocations =
+        __atomic_load_n(&pool->max_allocations, __ATOMIC_RELAXED);
+    uint64_t max_bytes = __atomic_load_n(&pool->max_bytes, __ATOMIC_RELAXED);
+    uint32_t num_allocations =
+        __atomic_add_fetch(&pool->num_allocations, 1, __ATOMIC_RELAXED);
+    uint64_t num_bytes =
+        __atomic_add_fetch(&pool->num_bytes, size, __ATOMIC_RELAXED);
+
+    if ((num_allocations <= max_allocations) && (num_bytes <= max_bytes)) {
+        account_pooled(size, 1);
+        return 0;
+    }
+
+    __atomic_sub_fetch(&pool->num_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&pool->num_bytes, size, __ATOMIC_RELAXED);
+
+    return -1;
+}
+
+static void unreserve(allocation_pool_t *pool, uint64_t size)
+{
+    __atomic_sub_fetch(&pool->num_allocations, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&pool->num_bytes, size, __ATOMIC_RELAXED);
+    account_pooled(-(int64_t)size, -1);
+}
+
+/*!
+ * The bytes a pooled allocation is counted as, which are none once its
+ * memory was purged.
+ */
+static uint64_t pooled_size(const allocation_state_t *state)
+{
+    return state->purged ? 0 : state->allocation->size;
+}
+
+/*!
+ * Give the memory of a pooled allocation in the shared lists back to the
+ * system, keeping the allocation, if the device supports it.  Allocations
+ * that may be in use, because the application still has them mapped or
+ * another process may have imported them, are left alone.
+ *
+ * Must be called with the pool lock held.
+ *
+ * \return 0 if the allocation was purged, -1 if it must be destroyed to
+ *         release its memory.
+ */
+static int purge(allocation_pool_t *pool, allocation_state_t *state)
+{
+    device_t *dev = pool->dev;
+    uint64_t size = state->allocation->size;
+
+    if (!dev->purge_allocation ||
+        __atomic_load_n(&state->map_count, __ATOMIC_RELAXED) ||
+        __atomic_load_n(&state->exported, __ATOMIC_RELAXED) ||
+        state->imported ||
+        dev->purge_allocation(dev, state->allocation)) {
+        return -1;
+    }
+
+    state->purged = 1;
+    __atomic_sub_fetch(&pool->num_bytes, size, __ATOMIC_RELAXED);
+    account_pooled(-(int64_t)size, 0);
+
+    return 0;
+}
+
+/*!
+ * Destroy a list of allocations linked through lru_next.
+ */
+static void destroy_list(device_t *dev, allocation_state_t *state)
+{
+    while (state) {
+        allocation_state_t *next = state->lru_next;
+
+        dev->destroy_allocation(dev, state->allocation);
+        free_allocation_state(state);
+        state = next;
+    }
+}
+
+/*!
+ * Move every allocation in a magazine to the pool's shared lists.
+ *
+ * Must be called with the pool lock and the magazine lock held.
+ */
+static void empty_magazine(allocation_pool_t *pool, pool_magazine_t *mag)
+{
+    unsigned int i;
+
+    for (i = 0; i < mag->count; i++) {
+        insert_shared(pool, mag->items[i]);
+    }
+
+    mag->count = 0;
+}
+
+/*!
+ * Remove a magazine from its pool's magazine list.
+ *
+ * Must be called with magazines_lock held.
+ */
+static void unlink_magazine(allocation_pool_t *pool, pool_magazine_t *mag)
+{
+    pool_magazine_t **m = &pool->magazines;
+
+    while (*m != mag) {
+        m = &(*m)->pool_next;
+    }
+
+    *m = mag->pool_next;
+}
+
+/*!
+ * Thread exit handler returning a thread's pooled allocations to their pools.
+ */
+static void free_thread_magazines(void *data)
+{
+    pool_magazine_t *mag = data;
+
+    pthread_mutex_lock(&magazines_lock);
+
+    while (mag) {
+        pool_magazine_t *next = mag->thread_next;
+        allocation_pool_t *pool = mag->pool;
+
+        if (pool) {
+            pthread_mutex_lock(&pool->lock);
+            pthread_mutex_lock(&mag->lock);
+            empty_magazine(pool, mag);
+            unlink_magazine(pool, mag);
+            pthread_mutex_unlock(&mag->lock);
+            pthread_mutex_unlock(&pool->lock);
+        }
+
+        pthread_mutex_destroy(&mag->lock);
+        free(mag);
+        mag = next;
+    }
+
+    pthread_mutex_unlock(&magazines_lock);
+}
+
+static void create_magazine_key(void)
+{
+    magazine_key_valid = !pthread_key_create(&magazine_key,
+                                             free_thread_magazines);
+}
+
+/*!
+ * Find the calling thread's magazine for a pool.
+ *
+ * \param[in] create Non-zero to attach a magazine to the pool if the thread
+ *                   doesn't have one yet.
+ *
+ * \return The magazine, or NULL if there is none and one couldn't be or
+ *         wasn't to be created.
+ */
+static pool_magazine_t *get_thread_magazine(allocation_pool_t *pool,
+                                            int create)
+{
+    pool_magazine_t *head;
+    pool_magazine_t *mag;
+    pool_magazine_t *spare = NULL;
+
+    if (pthread_once(&magazine_key_once, create_magazine_key) ||
+        !magazine_key_valid) {
+        return NULL;
+    }
+
+    head = pthread_getspecific(magazine_key);
+
+    /*
+     * A magazine's pool only changes from under its owning thread when the
+     * pool is destroyed, which must not race with the pool's use.
+     */
+    for (mag = head; mag; mag = mag->thread_next) {
+        allocation_pool_t *owner = __atomic_load_n(&mag->pool,
+                                                   __ATOMIC_ACQUIRE);
+
+        if (owner == pool) {
+            return mag;
+        }
+
+        if (!owner) {
+            spare = mag;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    /* Reuse a magazine left behind by a destroyed pool */
+    if (!spare) {
+        spare = calloc(1, sizeof(*spare));
+
+        if (!spare) {
+            return NULL;
+        }
+
+        pthread_mutex_init(&spare->lock, NULL);
+        spare->thread_next = head;
+
+        if (pthread_setspecific(magazine_key, spare)) {
+            pthread_mutex_destroy(&spare->lock);
+            free(spare);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_lock(&magazines_lock);
+    pthread_mutex_lock(&spare->lock);
+    spare->pool_next = pool->magazines;
+    pool->magazines = spare;
+    __atomic_store_n(&spare->pool, pool, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&spare->lock);
+    pthread_mutex_unlock(&magazines_lock);
+
+    return spare;
+}
+
+void init_allocation_pool(allocation_pool_t *pool, device_t *dev)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->dev = dev;
+    pthread_mutex_init(&pool->lock, NULL);
+}
+
+/*!
+ * Destroy every pooled allocation and detach the pool's magazines.
+ *
+ * Must be called before the device is destroyed.
+ */
+void fini_allocation_pool(allocation_pool_t *pool)
+{
+    allocation_state_t *state;
+    pool_magazine_t *mag;
+
+    pthread_mutex_lock(&magazines_lock);
+    pthread_mutex_lock(&pool->lock);
+
+    for (mag = pool->magazines; mag; mag = mag->pool_next) {
+        pthread_mutex_lock(&mag->lock);
+        empty_magazine(pool, mag);
+        __atomic_store_n(&mag->pool, NULL, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&mag->lock);
+    }
+
+    pool->magazines = NULL;
+
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&magazines_lock);
+
+    for (state = pool->lru_head; state; state = state->lru_next) {
+        unreserve(pool, pooled_size(state));
+    }
+
+    destroy_list(pool->dev, pool->lru_head);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+int allocation_pool_enabled(allocation_pool_t *pool)
+{
+    return __atomic_load_n(&pool->max_allocations, __ATOMIC_RELAXED) != 0;
+}
+
+/*!
+ * Record the parts of a request that identify the allocations that can
+ * satisfy it.
+ *
+ * \return 0 on success, -1 if memory allocation failed.
+ */
+int build_allocation_pool_key(const assertion_t *assertion,
+                              const capability_set_t *capability_set,
+                              allocation_state_t *state)
+{
+    if (serialize_capability_set(capability_set, &state->pool_key_size,
+                                 &state->pool_key)) {
+        state->pool_key = NULL;
+        return -1;
+    }
+
+    update_allocation_pool_key(assertion, state);
+
+    return 0;
+}
+
+/*!
+ * Record a new surface description for an allocation, e.g. once it is
+ * reasserted, keeping its pool key, if any, in step with it.
+ *
+ * Must not be called while the allocation is pooled.
+ */
+void update_allocation_pool_key(const assertion_t *assertion,
+                                allocation_state_t *state)
+{
+    uint64_t hash = HASH_INIT;
+
+    state->width = assertion->width;
+    state->height = assertion->height;
+    state->has_format = assertion->format ? 1 : 0;
+    state->format = state->has_format ? *assertion->format : 0;
+
+    if (!state->pool_key) {
+        return;
+    }
+
+    hash = hash_bytes(hash, &state->width, sizeof(state->width));
+    hash = hash_bytes(hash, &state->height, sizeof(state->height));
+    hash = hash_bytes(hash, &state->format, sizeof(state->format));
+    state->pool_hash = hash_bytes(hash, state->pool_key,
+                                  state->pool_key_size);
+}
+
+/*!
+ * Take a pooled allocation matching a request out of the pool.
+ *
+ * The calling thread's magazine is searched first, most recently released
+ * allocation first.
+ *
+ * \param[in] key State whose pool key was set by build_allocation_pool_key().
+ *
+ * \return The allocation, or NULL if none matches.
+ */
+allocation_t *acquire_pooled_allocation(allocation_pool_t *pool,
+                                        const allocation_state_t *key)
+{
+    allocation_state_t *found = NULL;
+    allocation_state_t *state;
+    pool_magazine_t *mag;
+
+    if (!__atomic_load_n(&pool->num_allocations, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+
+    mag = get_thread_magazine(pool, 0);
+
+    if (mag) {
+        unsigned int i;
+
+        pthread_mutex_lock(&mag->lock);
+
+        for (i = mag->count; i-- > 0;) {
+            if (keys_match(mag->items[i], key)) {
+                found = mag->items[i];
+                mag->count--;
+                memmove(&mag->items[i], &mag->items[i + 1],
+                        (mag->count - i) * sizeof(mag->items[0]));
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&mag->lock);
+    }
+
+    if (!found) {
+        pthread_mutex_lock(&pool->lock);
+
+        for (state = pool->buckets[key->pool_hash % ALLOCATION_POOL_BUCKETS];
+             state;
+             state = state->bucket_next) {
+            if (keys_match(state, key)) {
+                remove_shared(pool, state);
+                found = state;
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (!found) {
+        return NULL;
+    }
+
+    /* A purged allocation's memory is faulted back in as it is used */
+    unreserve(pool, pooled_size(found));
+    found->contents_discarded = found->purged;
+    found->purged = 0;
+
+    return found->allocation;
+}
+
+/*!
+ * Keep a released allocation in the pool.
+ *
+ * If the pool is full, the least recently released allocations in the shared
+ * lists are destroyed to make room.  Allocations that were ever exported are
+ * never kept.
+ *
+ * \return 0 if the pool took ownership of the allocation, -1 if the caller
+ *         must destroy it.
+ */
+int release_to_allocation_pool(allocation_pool_t *pool,
+                               allocation_t *allocation)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    allocation_state_t *evicted = NULL;
+    pool_magazine_t *mag;
+
+    /* Another process may still be using an exported allocation's memory */
+    if (!state || !state->pool_key || !allocation_pool_enabled(pool) ||
+        __atomic_load_n(&state->exported, __ATOMIC_RELAXED) ||
+        (allocation->size >
+         __atomic_load_n(&pool->max_bytes, __ATOMIC_RELAXED))) {
+        return -1;
+    }
+
+    if (!reserve(pool, allocation->size)) {
+        mag = get_thread_magazine(pool, 1);
+
+        if (mag) {
+            pthread_mutex_lock(&mag->lock);
+
+            if (mag->count < POOL_MAGAZINE_SIZE) {
+                mag->items[mag->count++] = state;
+                pthread_mutex_unlock(&mag->lock);
+                return 0;
+            }
+
+            pthread_mutex_unlock(&mag->lock);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        insert_shared(pool, state);
+        pthread_mutex_unlock(&pool->lock);
+
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (reserve(pool, allocation->size)) {
+        allocation_state_t *victim = pool->lru_tail;
+
+        /* The rest of the pool is in magazines, which only trimming empties */
+        if (!victim) {
+            pthread_mutex_unlock(&pool->lock);
+            destroy_list(pool->dev, evicted);
+            return -1;
+        }
+
+        remove_shared(pool, victim);
+        unreserve(pool, pooled_size(victim));
+        victim->lru_next = evicted;
+        evicted = victim;
+    }
+
+    insert_shared(pool, state);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    destroy_list(pool->dev, evicted);
+
+    return 0;
+}
+
+/*!
+ * Release the least recently released allocations until the pool is within
+ * the given limits.  Allocations in magazines are returned to the shared
+ * lists first.
+ *
+ * Allocations over <max_allocations> are destroyed.  Those over <max_bytes>
+ * are purged if the device can, so they stay pooled without holding memory,
+ * and destroyed otherwise.
+ */
+void trim_allocation_pool(allocation_pool_t *pool,
+                          uint32_t max_allocations,
+                          uint64_t max_bytes)
+{
+    allocation_state_t *evicted = NULL;
+    allocation_state_t *victim;
+    pool_magazine_t *mag;
+
+    pthread_mutex_lock(&magazines_lock);
+    pthread_mutex_lock(&pool->lock);
+
+    for (mag = pool->magazines; mag; mag = mag->pool_next) {
+        pthread_mutex_lock(&mag->lock);
+        empty_magazine(pool, mag);
+        pthread_mutex_unlock(&mag->lock);
+    }
+
+    pthread_mutex_unlock(&magazines_lock);
+
+    while (pool->lru_tail &&
+           (__atomic_load_n(&pool->num_allocations, __ATOMIC_RELAXED) >
+            max_allocations)) {
+        victim = pool->lru_tail;
+
+        remove_shared(pool, victim);
+        unreserve(pool, pooled_size(victim));
+        victim->lru_next = evicted;
+        evicted = victim;
+    }
+
+    victim = pool->lru_tail;
+
+    while (victim &&
+           (__atomic_load_n(&pool->num_bytes, __ATOMIC_RELAXED) > max_bytes)) {
+        allocation_state_t *prev = victim->lru_prev;
+
+        if (!victim->purged && purge(pool, victim)) {
+            remove_shared(pool, victim);
+            unreserve(pool, pooled_size(victim));
+            victim->lru_next = evicted;
+            evicted = victim;
+        }
+
+        victim = prev;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    destroy_list(pool->dev, evicted);
+}
+
+void set_allocation_pool_limits(allocation_pool_t *pool,
+                                uint32_t max_allocations,
+                                uint64_t max_bytes)
+{
+    __atomic_store_n(&pool->max_allocations, max_allocations,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->max_bytes, max_bytes, __ATOMIC_RELAXED);
+
+    trim_allocation_pool(pool, max_allocations, max_bytes);
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_ALLOCATION_POOL_H__
+#define __SRC_ALLOCATION_POOL_H__
+
+#include <pthread.h>
+#include <allocator/common.h>
+#include "allocation_state.h"
+
+/*! Number of hash buckets in each device's allocation pool */
+#define ALLOCATION_POOL_BUCKETS 64
+
+typedef struct pool_magazine pool_magazine_t;
+
+/*!
+ * Released allocations kept for reuse by later matching requests.
+ *
+ * Pooled allocations live either in the shared hash buckets and LRU list, or
+ * in a small per-thread magazine that a thread can release to and acquire
+ * from without taking the pool lock.  The counts include both.
+ *
+ * Lock order: the global magazine list lock, then pool->lock, then a
+ * magazine's lock.
+ */
+typedef struct allocation_pool {
+    device_t *dev;
+
+    pthread_mutex_t lock;
+
+    /*! Limits set by device_set_allocation_pool_limits().  0 disables */
+    uint32_t max_allocations;
+    uint64_t max_bytes;
+
+    /*! Number and total size of pooled allocations, updated atomically */
+    uint32_t num_allocations;
+    uint64_t num_bytes;
+
+    allocation_state_t *buckets[ALLOCATION_POOL_BUCKETS];
+
+    /*! Shared pooled allocations, most recently released first */
+    allocation_state_t *lru_head;
+    allocation_state_t *lru_tail;
+
+    /*! Magazines attached to this pool, protected by the magazine list lock */
+    pool_magazine_t *magazines;
+} allocation_pool_t;
+
+extern void init_allocation_pool(allocation_pool_t *pool, device_t *dev);
+
+extern void fini_allocation_pool(allocation_pool_t *pool);
+
+extern int allocation_pool_enabled(allocation_pool_t *pool);
+
+extern int build_allocation_pool_key(const assertion_t *assertion,
+                                     const capability_set_t *capability_set,
+                                     allocation_state_t *state);
+
+extern void update_allocation_pool_key(const assertion_t *assertion,
+                                       allocation_state_t *state);
+
+extern allocation_t *acquire_pooled_allocation(allocation_pool_t *pool,
+                                               const allocation_state_t *key);
+
+extern int release_to_allocation_pool(allocation_pool_t *pool,
+                                      allocation_t *allocation);
+
+extern void set_allocation_pool_limits(allocation_pool_t *pool,
+                                       uint32_t max_allocations,
+                                       uint64_t max_bytes);
+
+extern void trim_allocation_pool(allocation_pool_t *pool,
+                                 uint32_t max_allocations,
+                                 uint64_t max_bytes);
+
+#endif /* __SRC_ALLOCATION_POOL_H__ */
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_ALLOCATION_STATE_H__
+#define __SRC_ALLOCATION_STATE_H__
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <allocator/driver.h>
+#include "range_set.h"
+
+/*!
+ * The results of exporting an allocation, reused by later exports.  Never
+ * modified once published.
+ */
+typedef struct export_cache {
+    /*! The fd returned by the driver, duplicated for each export */
+    int fd;
+
+    /*! The serialized capability set */
+    size_t metadata_size;
+    void *metadata;
+} export_cache_t;
+
+/*!
+ * A CPU mapping of an allocation, kept for later device_map_allocation()
+ * calls.  Never modified once published, except for sync_supported and the
+ * dirty ranges.
+ */
+typedef struct allocation_mapping {
+    void *addr;
+    uint64_t size;
+    int writable;
+
+    /*! Cleared atomically once the fd turns out not to be a dma-buf */
+    int sync_supported;
+
+    /*!
+     * Ranges reported by device_damage_allocation_*() since CPU writes were
+     * last synced, protected by dirty_lock.
+     */
+    pthread_mutex_t dirty_lock;
+    range_set_t dirty;
+} allocation_mapping_t;
+
+/*!
+ * Allocator library state attached to each allocation through
+ * allocation_t::library_private.
+ */
+typedef struct allocation_state {
+    /*! The allocation this state belongs to */
+    allocation_t *allocation;
+
+    /*!
+     * The assertion and capability set the allocation was requested with,
+     * which identify the requests it may be recycled for by the device's
+     * allocation pool.  pool_key is NULL if the allocation can't be pooled,
+     * and width is 0 if it wasn't created with a plain assertion.
+     */
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    int has_format;
+    uint64_t pool_hash;
+    size_t pool_key_size;
+    void *pool_key;
+
+    /*! Set atomically on the first export, or NULL */
+    export_cache_t *export_cache;
+
+    /*!
+     * Set atomically once an fd of the allocation was handed out, after
+     * which other processes may be using it.  Mapping the allocation sets
+     * export_cache, but not this.
+     */
+    int exported;
+
+    /*!
+     * Set atomically on the first device_map_allocation() call, or NULL,
+     * and the number of calls not yet matched by device_unmap_allocation().
+     */
+    allocation_mapping_t *mapping;
+    unsigned int map_count;
+
+    /*!
+     * For imported allocations, the st_dev and st_ino of the imported file,
+     * and the number of device_import_allocation() calls that returned the
+     * allocation and have not been matched by device_destroy_allocation().
+     * Protected by the device's import table lock.
+     */
+    int imported;
+    dev_t import_dev;
+    ino_t import_ino;
+    unsigned int import_refcount;
+    struct allocation_state *import_next;
+
+    /*!
+     * Set while the allocation is pooled and its memory was given back with
+     * device::purge_allocation, so it isn't counted in the pool's bytes.
+     * Protected by the pool lock.
+     */
+    int purged;
+
+    /*!
+     * Set when the allocation was last recycled from the pool after being
+     * purged, so its contents were discarded.
+     */
+    int contents_discarded;
+
+    /*! Links in the pool's hash bucket and LRU lists while pooled */
+    struct allocation_state *bucket_next;
+    struct allocation_state *lru_prev;
+    struct allocation_state *lru_next;
+} allocation_state_t;
+
+static inline allocation_state_t *get_allocation_state(const allocation_t *a)
+{
+    return (allocation_state_t *)a->library_private;
+}
+
+static inline void free_export_cache(export_cache_t *cache)
+{
+    if (cache) {
+        close(cache->fd);
+        free(cache->metadata);
+        free(cache);
+    }
+}
+
+static inline void free_allocation_mapping(allocation_mapping_t *mapping)
+{
+    if (mapping) {
+        munmap(mapping->addr, mapping->size);
+        pthread_mutex_destroy(&mapping->dirty_lock);
+        free(mapping->dirty.ranges);
+        free(mapping);
+    }
+}
+
+static inline void free_allocation_state(allocation_state_t *state)
+{
+    if (state) {
+        free_allocation_mapping(state->mapping);
+        free_export_cache(state->export_cache);
+        free(state->pool_key);
+        free(state);
+    }
+}
+
+#endif /* __SRC_ALLOCATION_STATE_H__ */
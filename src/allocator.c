@@ -20,31 +20,217 @@
  * SOFTWARE.
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include <allocator/allocator.h>
 #include <allocator/driver.h>
+#include "accounting.h"
 #include "driver_manager.h"
+#include "allocation_state.h"
+#include "device_state.h"
+#include "query_cache.h"
+#include "work_queue.h"
 #include "constraint_funcs.h"
+#include "formats.h"
+#include "layout.h"
 
-device_t *device_create(int dev_fd)
+/*!
+ * Non-zero if device_create() should return an existing device context for
+ * device nodes that already have one.
+ */
+static int device_sharing_enabled = 0;
+
+/*!
+ * List of shared devices, keyed by the identity of their device node.
+ */
+static device_state_t *shared_devices = NULL;
+
+/*! Protects device_sharing_enabled and shared_devices */
+static pthread_mutex_t shared_devices_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void set_device_sharing(int enable)
+{
+    pthread_mutex_lock(&shared_devices_lock);
+    device_sharing_enabled = enable;
+    pthread_mutex_unlock(&shared_devices_lock);
+}
+
+/*!
+ * Create a device context and attach the library's state to it.
+ *
+ * \param[in] dev_fd The device file descriptor to create the context on.
+ *
+ * \return The new device, or NULL on failure.
+ */
+static device_t *create_device(int dev_fd)
 {
     driver_t *driver = find_driver_for_fd(dev_fd);
+    device_state_t *state;
+    device_t *dev;
 
     if (!driver) {
         return NULL;
     }
 
-    return driver->device_create_from_fd(driver, dev_fd);
+    state = calloc(1, sizeof(*state));
+
+    if (!state) {
+        release_driver(driver);
+        return NULL;
+    }
+
+    dev = driver->device_create_from_fd(driver, dev_fd);
+
+    if (!dev) {
+        free(state);
+        release_driver(driver);
+        return NULL;
+    }
+
+    state->dev = dev;
+    state->driver = driver;
+    state->refcount = 1;
+    state->fd = -1;
+    init_query_cache(&state->query_cache);
+    init_allocation_pool(&state->allocation_pool, dev);
+    init_import_table(&state->import_table);
+    dev->library_private = state;
+    register_device(state);
+
+    return dev;
+}
+
+/*!
+ * Destroy a device context and the library's state attached to it.
+ */
+static void destroy_device(device_t *dev)
+{
+    device_state_t *state = get_device_state(dev);
+
+    unregister_device(state);
+    fini_allocation_pool(&state->allocation_pool);
+    fini_import_table(&state->import_table, dev);
+
+    dev->destroy(dev);
+
+    release_driver(state->driver);
+
+    if (state->fd >= 0) {
+        close(state->fd);
+    }
+
+    fini_query_cache(&state->query_cache);
+    free(state);
+}
+
+/*!
+ * Find or create the shared device for the node a file descriptor refers to.
+ *
+ * New shared devices are created on a duplicate of <dev_fd> owned by the
+ * library, so the caller may close <dev_fd> at any time.
+ *
+ * Must be called with shared_devices_lock held.
+ */
+static device_t *get_shared_device(int dev_fd)
+{
+    device_state_t *state;
+    struct stat stats;
+    device_t *dev;
+    int fd;
+
+    if (fstat(dev_fd, &stats)) {
+        return NULL;
+    }
+
+    for (state = shared_devices; state; state = state->next) {
+        if ((state->node_dev == stats.st_dev) &&
+            (state->node_rdev == stats.st_rdev)) {
+            state->refcount++;
+            return state->dev;
+        }
+    }
+
+    fd = fcntl(dev_fd, F_DUPFD_CLOEXEC, 0);
+
+    if (fd < 0) {
+        return NULL;
+    }
+
+    dev = create_device(fd);
+
+    if (!dev) {
+        close(fd);
+        return NULL;
+    }
+
+    state = get_device_state(dev);
+    state->shared = 1;
+    state->node_dev = stats.st_dev;
+    state->node_rdev = stats.st_rdev;
+    state->fd = fd;
+    state->next = shared_devices;
+    shared_devices = state;
+
+    return dev;
+}
+
+device_t *device_create(int dev_fd)
+{
+    device_t *dev;
+
+    pthread_mutex_lock(&shared_devices_lock);
+
+    if (device_sharing_enabled) {
+        dev = get_shared_device(dev_fd);
+        pthread_mutex_unlock(&shared_devices_lock);
+    } else {
+        pthread_mutex_unlock(&shared_devices_lock);
+        dev = create_device(dev_fd);
+    }
+
+    return dev;
 }
 
 void device_destroy(device_t *dev)
 {
-    if (dev) {
-        dev->destroy(dev);
+    device_state_t *state;
+
+    if (!dev) {
+        return;
+    }
+
+    state = get_device_state(dev);
+
+    if (state->shared) {
+        pthread_mutex_lock(&shared_devices_lock);
+
+        if (--state->refcount > 0) {
+            pthread_mutex_unlock(&shared_devices_lock);
+            return;
+        }
+
+        for (device_state_t **s = &shared_devices; *s; s = &(*s)->next) {
+            if (*s == state) {
+                *s = state->next;
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&shared_devices_lock);
     }
+
+    destroy_device(dev);
 }
 
 int device_get_capabilities(device_t *dev,
@@ -54,12 +240,97 @@ int device_get_capabilities(device_t *dev,
                             uint32_t *num_capability_sets,
                             capability_set_t **capability_sets)
 {
-    return dev->get_capabilities(dev,
-                                 assert,
-                                 num_uses,
-                                 uses,
-                                 num_capability_sets,
-                                 capability_sets);
+    return get_cached_capabilities(dev,
+                                   assert,
+                                   num_uses,
+                                   uses,
+                                   num_capability_sets,
+                                   capability_sets);
+}
+
+/*!
+ * A query of a device_get_capabilities_multi() call, as run by a worker.
+ */
+typedef struct query_task {
+    capability_query_t *query;
+    work_batch_t *batch;
+} query_task_t;
+
+static void run_query_task(void *arg)
+{
+    query_task_t *task = arg;
+    capability_query_t *query = task->query;
+
+    query->status = device_get_capabilities(query->dev,
+                                            query->assertion,
+                                            query->num_uses,
+                                            query->uses,
+                                            &query->num_capability_sets,
+                                            &query->capability_sets);
+
+    if (query->status) {
+        query->status = -1;
+        query->num_capability_sets = 0;
+        query->capability_sets = NULL;
+    }
+
+    if (task->batch) {
+        complete_work_batch(task->batch);
+    }
+}
+
+int device_get_capabilities_multi(uint32_t num_queries,
+                                  capability_query_t *queries,
+                                  const executor_t *executor)
+{
+    query_task_t *tasks = NULL;
+    work_batch_t batch;
+    uint32_t i;
+
+    if (num_queries > 1) {
+        tasks = calloc(num_queries, sizeof(*tasks));
+    }
+
+    if (!tasks) {
+        /* Nothing to run concurrently, or no memory to do it with */
+        for (i = 0; i < num_queries; i++) {
+            query_task_t task = { &queries[i], NULL };
+
+            run_query_task(&task);
+        }
+    } else {
+        init_work_batch(&batch, num_queries);
+
+        for (i = 0; i < num_queries; i++) {
+            tasks[i].query = &queries[i];
+            tasks[i].batch = &batch;
+        }
+
+        /* Hand off all but the first query, which this thread runs */
+        for (i = 1; i < num_queries; i++) {
+            int ret = executor ?
+                executor->submit(executor->data, run_query_task, &tasks[i]) :
+                queue_work(&batch, run_query_task, &tasks[i]);
+
+            if (ret) {
+                run_query_task(&tasks[i]);
+            }
+        }
+
+        run_query_task(&tasks[0]);
+
+        wait_work_batch(&batch);
+        fini_work_batch(&batch);
+        free(tasks);
+    }
+
+    for (i = 0; i < num_queries; i++) {
+        if (queries[i].status) {
+            return -1;
+        }
+    }
+
+    return 0;
 }
 
 #define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
@@ -437,11 +708,11 @@ int device_get_assertion_hints(device_t *dev,
                                uint32_t *num_hints,
                                assertion_hint_t **hints)
 {
-    return dev->get_assertion_hints(dev,
-                                    num_uses,
-                                    uses,
-                                    num_hints,
-                                    hints);
+    return get_cached_assertion_hints(dev,
+                                      num_uses,
+                                      uses,
+                                      num_hints,
+                                      hints);
 }
 
 void free_assertion_hints(uint32_t num_hints, assertion_hint_t *hints)
@@ -455,17 +726,408 @@ void free_assertion_hints(uint32_t num_hints, assertion_hint_t *hints)
     free(hints);
 }
 
+/*!
+ * Allocate the library state of a new allocation, with the surface
+ * description and pool key of <key>, if any.
+ *
+ * \param[in] take_key Non-zero to move the key out of <key> instead of
+ *                     copying it.
+ */
+static allocation_state_t *create_allocation_state(allocation_state_t *key,
+                                                   int take_key)
+{
+    allocation_state_t *state = calloc(1, sizeof(*state));
+
+    if (!state) {
+        return NULL;
+    }
+
+    *state = *key;
+
+    if (!key->pool_key) {
+        return state;
+    }
+
+    if (take_key) {
+        key->pool_key = NULL;
+    } else {
+        state->pool_key = malloc(key->pool_key_size);
+
+        if (!state->pool_key) {
+            /* The allocation just won't be pooled */
+            return state;
+        }
+
+        memcpy(state->pool_key, key->pool_key, key->pool_key_size);
+    }
+
+    return state;
+}
+
+/*!
+ * Whether allocations of a device can be switched to another surface.
+ *
+ * Without a driver hook, that only holds if the device lays allocations out
+ * the way the library's generic planner does, purely from the assertion and
+ * capability set.
+ */
+static int can_reassert(const device_t *dev)
+{
+    return dev->reassert_allocation || !dev->plan_layout;
+}
+
+/*!
+ * Enlarge an assertion by the device's allocation headroom.
+ *
+ * \return 0 if <padded> is larger than <assertion>, -1 if no headroom is
+ *         added.
+ */
+static int add_headroom(device_t *dev,
+                        const assertion_t *assertion,
+                        assertion_t *padded)
+{
+    device_state_t *dev_state = get_device_state(dev);
+    uint32_t granularity = __atomic_load_n(&dev_state->headroom_granularity,
+                                           __ATOMIC_RELAXED);
+    uint32_t percent = __atomic_load_n(&dev_state->headroom_percent,
+                                       __ATOMIC_RELAXED);
+    uint64_t width, height;
+
+    if (assertion->ext || (!granularity && !percent) || !can_reassert(dev)) {
+        return -1;
+    }
+
+    width = assertion->width + (uint64_t)assertion->width * percent / 100;
+    height = assertion->height + (uint64_t)assertion->height * percent / 100;
+
+    if (granularity > 1) {
+        width = (width + granularity - 1) / granularity * granularity;
+        height = (height + granularity - 1) / granularity * granularity;
+    }
+
+    if ((width > UINT32_MAX) || (height > UINT32_MAX) ||
+        ((width == assertion->width) && (height == assertion->height))) {
+        return -1;
+    }
+
+    *padded = *assertion;
+    padded->width = (uint32_t)width;
+    padded->height = (uint32_t)height;
+
+    return 0;
+}
+
+/*!
+ * Have the driver destroy <count> allocations.
+ */
+static void destroy_driver_allocations(device_t *dev,
+                                       uint32_t count,
+                                       allocation_t **allocations)
+{
+    while (count > 0) {
+        count--;
+        dev->destroy_allocation(dev, allocations[count]);
+    }
+}
+
+/*!
+ * Have the driver create <count> allocations, all or none.
+ */
+static int create_driver_allocations(device_t *dev,
+                                     const assertion_t *assertion,
+                                     const capability_set_t *capability_set,
+                                     uint32_t count,
+                                     allocation_t **allocations)
+{
+    uint32_t num_created = 0;
+    int status = 0;
+
+    if (dev->create_allocations) {
+        return dev->create_allocations(dev, assertion, capability_set,
+                                       count, allocations);
+    }
+
+    while (!status && (num_created < count)) {
+        status = dev->create_allocation(dev, assertion, capability_set,
+                                        &allocations[num_created]);
+        num_created += status ? 0 : 1;
+    }
+
+    if (status) {
+        destroy_driver_allocations(dev, num_created, allocations);
+    }
+
+    return status;
+}
+
+/*!
+ * Have the driver create <count> allocations of the surface <padded>, then
+ * switch them to <assertion>, all or none.
+ */
+static int create_padded_allocations(device_t *dev,
+                                     const assertion_t *assertion,
+                                     const assertion_t *padded,
+                                     const capability_set_t *capability_set,
+                                     uint32_t count,
+                                     allocation_t **allocations)
+{
+    uint32_t i;
+
+    if (create_driver_allocations(dev, padded, capability_set, count,
+                                  allocations)) {
+        return -1;
+    }
+
+    if (dev->reassert_allocation) {
+        for (i = 0; i < count; i++) {
+            if (dev->reassert_allocation(dev, allocations[i], assertion)) {
+                destroy_driver_allocations(dev, count, allocations);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * Sum the sizes of <count> allocations.
+ */
+static uint64_t total_size(uint32_t count, allocation_t *const *allocations)
+{
+    uint64_t size = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        size += allocations[i]->size;
+    }
+
+    return size;
+}
+
 int device_create_allocation(device_t *dev,
                              const assertion_t *assertion,
                              const capability_set_t *capability_set,
                              allocation_t **allocation)
 {
-    return dev->create_allocation(dev, assertion, capability_set, allocation);
+    return device_create_allocations(dev, assertion, capability_set, 1,
+                                     allocation);
+}
+
+int device_create_allocations(device_t *dev,
+                              const assertion_t *assertion,
+                              const capability_set_t *capability_set,
+                              uint32_t count,
+                              allocation_t **allocations)
+{
+    device_state_t *dev_state = get_device_state(dev);
+    allocation_pool_t *pool = &dev_state->allocation_pool;
+    allocation_state_t **states = NULL;
+    allocation_state_t key;
+    assertion_t padded;
+    uint64_t new_bytes = 0;
+    uint32_t num_pooled = 0;
+    uint32_t num_created = 0;
+    uint32_t num_new;
+    uint32_t i;
+    int status = -1;
+
+    memset(&key, 0, sizeof(key));
+
+    /* Describe the surface even if it isn't pooled, to locate damage */
+    if (!assertion->ext) {
+        key.width = assertion->width;
+        key.height = assertion->height;
+        key.has_format = assertion->format ? 1 : 0;
+        key.format = key.has_format ? *assertion->format : 0;
+    }
+
+    /* A failure to build the key only means the allocations aren't pooled */
+    if (allocation_pool_enabled(pool) && !assertion->ext &&
+        !build_allocation_pool_key(assertion, capability_set, &key)) {
+        while ((num_pooled < count) &&
+               (allocations[num_pooled] =
+                acquire_pooled_allocation(pool, &key))) {
+            account_live(dev_state, allocations[num_pooled]->size, 1);
+            num_pooled++;
+        }
+    }
+
+    num_new = count - num_pooled;
+
+    if (!num_new) {
+        status = 0;
+        goto done;
+    }
+
+    /* Set up the library state first, so it can't fail after the driver's */
+    states = calloc(num_new, sizeof(*states));
+
+    if (!states) {
+        goto done;
+    }
+
+    for (i = 0; i < num_new; i++) {
+        states[i] = create_allocation_state(&key, i == num_new - 1);
+
+        if (!states[i]) {
+            goto done;
+        }
+    }
+
+    /*
+     * Allocations with headroom still describe the requested surface, and
+     * are created without it if the driver can't fit the larger ones or
+     * they would exceed a budget.  Sizes are only known once the driver has
+     * created the allocations.
+     */
+    if (!add_headroom(dev, assertion, &padded) &&
+        !create_padded_allocations(dev, assertion, &padded, capability_set,
+                                   num_new, allocations + num_pooled)) {
+        new_bytes = total_size(num_new, allocations + num_pooled);
+
+        if (check_hard_budgets(dev_state, new_bytes)) {
+            destroy_driver_allocations(dev, num_new,
+                                       allocations + num_pooled);
+        } else {
+            status = 0;
+        }
+    }
+
+    if (status) {
+        if (create_driver_allocations(dev, assertion, capability_set,
+                                      num_new, allocations + num_pooled)) {
+            goto done;
+        }
+
+        num_created = num_new;
+        new_bytes = total_size(num_new, allocations + num_pooled);
+
+        if (check_hard_budgets(dev_state, new_bytes)) {
+            goto done;
+        }
+
+        status = 0;
+    }
+
+    account_live(dev_state, new_bytes, num_new);
+
+    for (i = 0; i < num_new; i++) {
+        states[i]->allocation = allocations[num_pooled + i];
+        allocations[num_pooled + i]->library_private = states[i];
+        states[i] = NULL;
+    }
+
+    enforce_soft_budgets(dev_state);
+
+done:
+    if (status) {
+        destroy_driver_allocations(dev, num_created,
+                                   allocations + num_pooled);
+
+        /* Put the pooled allocations back */
+        for (i = 0; i < num_pooled; i++) {
+            device_destroy_allocation(dev, allocations[i]);
+        }
+    }
+
+    if (states) {
+        for (i = 0; i < num_new; i++) {
+            free_allocation_state(states[i]);
+        }
+
+        free(states);
+    }
+
+    free(key.pool_key);
+
+    return status;
 }
 
 void device_destroy_allocation(device_t *dev, allocation_t *allocation)
 {
-    dev->destroy_allocation(dev, allocation);
+    allocation_state_t *state = get_allocation_state(allocation);
+    device_state_t *dev_state = get_device_state(dev);
+
+    if (!release_imported_allocation(dev, allocation)) {
+        return;
+    }
+
+    if (!state->imported) {
+        account_live(dev_state, -(int64_t)allocation->size, -1);
+    }
+
+    if (release_to_allocation_pool(&dev_state->allocation_pool,
+                                   allocation)) {
+        dev->destroy_allocation(dev, allocation);
+        free_allocation_state(state);
+    } else {
+        enforce_soft_budgets(dev_state);
+    }
+}
+
+int device_reassert_allocation(device_t *dev,
+                               allocation_t *allocation,
+                               const assertion_t *assertion)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    layout_t layout;
+
+    if (assertion->ext || !state->width || !can_reassert(dev) ||
+        (state->has_format != (assertion->format ? 1 : 0)) ||
+        (state->has_format && (state->format != *assertion->format)) ||
+        __atomic_load_n(&state->map_count, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+
+    if (device_plan_layout(dev, assertion, allocation->capability_set,
+                           &layout) ||
+        (layout.size > allocation->size)) {
+        return -1;
+    }
+
+    if (dev->reassert_allocation &&
+        dev->reassert_allocation(dev, allocation, assertion)) {
+        return -1;
+    }
+
+    update_allocation_pool_key(assertion, state);
+
+    return 0;
+}
+
+void device_set_allocation_headroom(device_t *dev,
+                                    uint32_t granularity,
+                                    uint32_t percent)
+{
+    device_state_t *dev_state = get_device_state(dev);
+
+    __atomic_store_n(&dev_state->headroom_granularity, granularity,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&dev_state->headroom_percent, percent,
+                     __ATOMIC_RELAXED);
+}
+
+void device_set_allocation_pool_limits(device_t *dev,
+                                       uint32_t max_allocations,
+                                       uint64_t max_bytes)
+{
+    set_allocation_pool_limits(&get_device_state(dev)->allocation_pool,
+                               max_allocations, max_bytes);
+}
+
+void device_trim_allocation_pool(device_t *dev, uint64_t max_bytes)
+{
+    trim_allocation_pool(&get_device_state(dev)->allocation_pool,
+                         UINT32_MAX, max_bytes);
+}
+
+int device_allocation_contents_discarded(device_t *dev,
+                                         const allocation_t *allocation)
+{
+    const allocation_state_t *state = get_allocation_state(allocation);
+
+    return (state && state->contents_discarded) ? 1 : 0;
 }
 
 void free_capability_sets(uint32_t num_capability_sets,
@@ -615,6 +1277,83 @@ fail:
     return -1;
 }
 
+/*!
+ * Get the cached results of exporting an allocation, exporting it first if
+ * needed.
+ *
+ * Concurrent first exports may both call into the driver, in which case
+ * only one result is kept.
+ *
+ * \return The cache, or NULL on failure.
+ */
+static const export_cache_t *get_export_cache(device_t *dev,
+                                              const allocation_t *allocation)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    export_cache_t *cache = __atomic_load_n(&state->export_cache,
+                                            __ATOMIC_ACQUIRE);
+    export_cache_t *expected = NULL;
+
+    if (cache) {
+        return cache;
+    }
+
+    cache = calloc(1, sizeof(*cache));
+
+    if (!cache) {
+        return NULL;
+    }
+
+    if (serialize_capability_set(allocation->capability_set,
+                                 &cache->metadata_size, &cache->metadata)) {
+        free(cache);
+        return NULL;
+    }
+
+    if (dev->get_allocation_fd(dev, allocation, &cache->fd)) {
+        free(cache->metadata);
+        free(cache);
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(&state->export_cache, &expected, cache,
+                                     0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free_export_cache(cache);
+        cache = expected;
+    }
+
+    return cache;
+}
+
+int device_export_allocation_shared(device_t *dev,
+                                    const allocation_t *allocation,
+                                    uint64_t *allocation_size,
+                                    size_t *metadata_size,
+                                    const void **metadata,
+                                    int *fd)
+{
+    const export_cache_t *cache = get_export_cache(dev, allocation);
+
+    if (!cache) {
+        return -1;
+    }
+
+    *fd = fcntl(cache->fd, F_DUPFD_CLOEXEC, 0);
+
+    if (*fd < 0) {
+        return -1;
+    }
+
+    __atomic_store_n(&get_allocation_state(allocation)->exported, 1,
+                     __ATOMIC_RELAXED);
+
+    *allocation_size = allocation->size;
+    *metadata_size = cache->metadata_size;
+    *metadata = cache->metadata;
+
+    return 0;
+}
+
 int device_export_allocation(device_t *dev,
                              const allocation_t *allocation,
                              uint64_t *allocation_size,
@@ -622,15 +1361,413 @@ int device_export_allocation(device_t *dev,
                              void **metadata,
                              int *fd)
 {
-    int status = serialize_capability_set(allocation->capability_set,
-                                          metadata_size,
-                                          metadata);
+    const void *shared;
+    void *copy;
 
-    if (status) {
-        return status;
+    if (device_export_allocation_shared(dev, allocation, allocation_size,
+                                        metadata_size, &shared, fd)) {
+        return -1;
     }
 
-    *allocation_size = allocation->size;
+    copy = malloc(*metadata_size);
+
+    if (!copy) {
+        close(*fd);
+        return -1;
+    }
+
+    memcpy(copy, shared, *metadata_size);
+    *metadata = copy;
+
+    return 0;
+}
+
+int device_export_allocations(device_t *dev,
+                              uint32_t count,
+                              allocation_t *const *allocations,
+                              uint64_t *allocation_sizes,
+                              size_t *metadata_size,
+                              void **metadata,
+                              int *fds)
+{
+    const export_cache_t *first;
+    uint32_t num_fds = 0;
+    uint32_t i;
+
+    if (!count || !(first = get_export_cache(dev, allocations[0]))) {
+        return -1;
+    }
+
+    /* The metadata is only shared if it describes every allocation */
+    for (num_fds = 0; num_fds < count; num_fds++) {
+        const export_cache_t *cache = get_export_cache(dev,
+                                                       allocations[num_fds]);
+
+        if (!cache ||
+            (cache->metadata_size != first->metadata_size) ||
+            memcmp(cache->metadata, first->metadata, first->metadata_size)) {
+            goto fail;
+        }
+
+        fds[num_fds] = fcntl(cache->fd, F_DUPFD_CLOEXEC, 0);
+
+        if (fds[num_fds] < 0) {
+            goto fail;
+        }
+
+        __atomic_store_n(&get_allocation_state(allocations[num_fds])->exported,
+                         1, __ATOMIC_RELAXED);
+        allocation_sizes[num_fds] = allocations[num_fds]->size;
+    }
+
+    *metadata = malloc(first->metadata_size);
+
+    if (!*metadata) {
+        goto fail;
+    }
+
+    memcpy(*metadata, first->metadata, first->metadata_size);
+    *metadata_size = first->metadata_size;
+
+    return 0;
+
+fail:
+    for (i = 0; i < num_fds; i++) {
+        close(fds[i]);
+    }
+
+    return -1;
+}
+
+/*!
+ * Get the cached CPU mapping of an allocation, mapping it first if needed.
+ *
+ * \return The mapping, or NULL on failure.
+ */
+static allocation_mapping_t *get_mapping(device_t *dev,
+                                         const allocation_t *allocation)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    allocation_mapping_t *mapping = __atomic_load_n(&state->mapping,
+                                                    __ATOMIC_ACQUIRE);
+    allocation_mapping_t *expected = NULL;
+    const export_cache_t *cache;
+
+    if (mapping) {
+        return mapping;
+    }
+
+    cache = get_export_cache(dev, allocation);
+
+    if (!cache || !allocation->size) {
+        return NULL;
+    }
+
+    mapping = calloc(1, sizeof(*mapping));
+
+    if (!mapping) {
+        return NULL;
+    }
+
+    mapping->size = allocation->size;
+    mapping->writable = 1;
+    mapping->sync_supported = 1;
+    pthread_mutex_init(&mapping->dirty_lock, NULL);
+    mapping->addr = mmap(NULL, mapping->size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, cache->fd, 0);
+
+    /* Exporters may hand out read-only file descriptors */
+    if ((mapping->addr == MAP_FAILED) && (errno == EACCES)) {
+        mapping->writable = 0;
+        mapping->addr = mmap(NULL, mapping->size, PROT_READ, MAP_SHARED,
+                             cache->fd, 0);
+    }
+
+    if (mapping->addr == MAP_FAILED) {
+        pthread_mutex_destroy(&mapping->dirty_lock);
+        free(mapping);
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(&state->mapping, &expected, mapping,
+                                     0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free_allocation_mapping(mapping);
+        mapping = expected;
+    }
+
+    return mapping;
+}
+
+/*!
+ * Begin or end CPU access to a mapped allocation through its dma-buf, if
+ * its fd is one.  Always covers the whole allocation.
+ */
+static int sync_dma_buf(const allocation_t *allocation,
+                        allocation_mapping_t *mapping,
+                        uint32_t sync_flags)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    struct dma_buf_sync sync;
+    int ret;
+
+    if (!__atomic_load_n(&mapping->sync_supported, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
+    sync.flags = (sync_flags & ALLOCATION_SYNC_START) ? DMA_BUF_SYNC_START :
+                                                        DMA_BUF_SYNC_END;
+
+    if (sync_flags & ALLOCATION_SYNC_READ) {
+        sync.flags |= DMA_BUF_SYNC_READ;
+    }
+
+    if (sync_flags & ALLOCATION_SYNC_WRITE) {
+        sync.flags |= DMA_BUF_SYNC_WRITE;
+    }
+
+    do {
+        ret = ioctl(state->export_cache->fd, DMA_BUF_IOCTL_SYNC, &sync);
+    } while (ret && ((errno == EINTR) || (errno == EAGAIN)));
+
+    /* Other files, such as memfds, need no synchronization */
+    if (ret && (errno == ENOTTY)) {
+        __atomic_store_n(&mapping->sync_supported, 0, __ATOMIC_RELAXED);
+        ret = 0;
+    }
+
+    return ret ? -1 : 0;
+}
+
+/*!
+ * Begin or end CPU access to a mapped allocation.
+ *
+ * Ending write access syncs only the ranges reported dirty since the last
+ * time it ended, if any were and the driver can sync ranges.
+ *
+ * \param[in] sync_flags ALLOCATION_SYNC_START or ALLOCATION_SYNC_END.
+ */
+static int sync_mapping(device_t *dev,
+                        allocation_t *allocation,
+                        allocation_mapping_t *mapping,
+                        uint32_t flags,
+                        uint32_t sync_flags)
+{
+    allocation_range_t whole = { 0, allocation->size };
+    range_set_t dirty;
+    int status;
+
+    if (flags & ALLOCATION_MAP_READ) {
+        sync_flags |= ALLOCATION_SYNC_READ;
+    }
+
+    if (flags & ALLOCATION_MAP_WRITE) {
+        sync_flags |= ALLOCATION_SYNC_WRITE;
+    }
+
+    memset(&dirty, 0, sizeof(dirty));
+
+    /* Take the dirty ranges, so reports made meanwhile go to the next sync */
+    if ((sync_flags & ALLOCATION_SYNC_END) &&
+        (sync_flags & ALLOCATION_SYNC_WRITE)) {
+        pthread_mutex_lock(&mapping->dirty_lock);
+        dirty = mapping->dirty;
+        memset(&mapping->dirty, 0, sizeof(mapping->dirty));
+        pthread_mutex_unlock(&mapping->dirty_lock);
+    }
+
+    if (!dev->sync_allocation) {
+        status = sync_dma_buf(allocation, mapping, sync_flags);
+    } else if (dirty.num_ranges && !dirty.overflowed) {
+        status = dev->sync_allocation(dev, allocation, sync_flags,
+                                      dirty.num_ranges, dirty.ranges);
+    } else {
+        status = dev->sync_allocation(dev, allocation, sync_flags, 1, &whole);
+    }
+
+    /* Hand the storage back for reuse unless new ranges needed their own */
+    if (dirty.ranges) {
+        range_set_clear(&dirty);
+
+        pthread_mutex_lock(&mapping->dirty_lock);
+
+        if (!mapping->dirty.ranges && !mapping->dirty.overflowed) {
+            mapping->dirty = dirty;
+            dirty.ranges = NULL;
+        }
+
+        pthread_mutex_unlock(&mapping->dirty_lock);
+
+        free(dirty.ranges);
+    }
+
+    return status;
+}
+
+int device_map_allocation(device_t *dev,
+                          allocation_t *allocation,
+                          uint32_t flags,
+                          void **ptr)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    allocation_mapping_t *mapping;
+
+    if (!(flags & (ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE)) ||
+        (flags & ~(ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE))) {
+        return -1;
+    }
+
+    mapping = get_mapping(dev, allocation);
+
+    if (!mapping ||
+        ((flags & ALLOCATION_MAP_WRITE) && !mapping->writable)) {
+        return -1;
+    }
+
+    if (sync_mapping(dev, allocation, mapping, flags,
+                     ALLOCATION_SYNC_START)) {
+        return -1;
+    }
+
+    __atomic_fetch_add(&state->map_count, 1, __ATOMIC_RELAXED);
+
+    *ptr = mapping->addr;
+
+    return 0;
+}
+
+void device_unmap_allocation(device_t *dev,
+                             allocation_t *allocation,
+                             uint32_t flags)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    allocation_mapping_t *mapping = __atomic_load_n(&state->mapping,
+                                                    __ATOMIC_ACQUIRE);
+
+    if (!mapping) {
+        return;
+    }
+
+    sync_mapping(dev, allocation, mapping, flags, ALLOCATION_SYNC_END);
+    __atomic_fetch_sub(&state->map_count, 1, __ATOMIC_RELAXED);
+}
+
+int device_damage_allocation_ranges(device_t *dev,
+                                    allocation_t *allocation,
+                                    uint32_t num_ranges,
+                                    const allocation_range_t *ranges)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    allocation_mapping_t *mapping = __atomic_load_n(&state->mapping,
+                                                    __ATOMIC_ACQUIRE);
+    int status = 0;
+    uint32_t i;
+
+    (void)dev;
+
+    if (!mapping) {
+        return -1;
+    }
+
+    for (i = 0; i < num_ranges; i++) {
+        if ((ranges[i].offset > allocation->size) ||
+            (ranges[i].size > allocation->size - ranges[i].offset)) {
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&mapping->dirty_lock);
+
+    for (i = 0; !status && (i < num_ranges); i++) {
+        status = range_set_add(&mapping->dirty, ranges[i].offset,
+                               ranges[i].size);
+    }
+
+    pthread_mutex_unlock(&mapping->dirty_lock);
+
+    return status;
+}
+
+int device_damage_allocation_rects(device_t *dev,
+                                   allocation_t *allocation,
+                                   uint32_t plane,
+                                   uint32_t num_rects,
+                                   const allocation_rect_t *rects)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    allocation_mapping_t *mapping = __atomic_load_n(&state->mapping,
+                                                    __ATOMIC_ACQUIRE);
+    const format_info_t *info;
+    const plane_layout_t *pl;
+    assertion_t assertion;
+    layout_t layout;
+    uint64_t width, height, bpp;
+    int status = 0;
+    uint32_t i;
+
+    if (!mapping || !state->width ||
+        !is_pitch_linear(allocation->capability_set)) {
+        return -1;
+    }
+
+    memset(&assertion, 0, sizeof(assertion));
+    assertion.width = state->width;
+    assertion.height = state->height;
+    assertion.format = state->has_format ? &state->format : NULL;
+
+    info = get_format_info(state->has_format ? state->format :
+                           DEFAULT_FORMAT);
+
+    if (!info ||
+        device_plan_layout(dev, &assertion, allocation->capability_set,
+                           &layout) ||
+        (plane >= layout.num_planes) ||
+        (layout.size > allocation->size)) {
+        return -1;
+    }
+
+    pl = &layout.planes[plane];
+    bpp = info->bytes_per_pixel[plane];
+    width = (state->width + (plane ? info->hsub : 1) - 1) /
+            (plane ? info->hsub : 1);
+    height = (state->height + (plane ? info->vsub : 1) - 1) /
+             (plane ? info->vsub : 1);
+
+    for (i = 0; i < num_rects; i++) {
+        if (((uint64_t)rects[i].x + rects[i].width > width) ||
+            ((uint64_t)rects[i].y + rects[i].height > height)) {
+            return -1;
+        }
+    }
+
+    pthread_mutex_lock(&mapping->dirty_lock);
+
+    for (i = 0; !status && (i < num_rects); i++) {
+        const allocation_rect_t *r = &rects[i];
+        uint64_t offset = pl->offset + r->y * (uint64_t)pl->pitch +
+                          r->x * bpp;
+        uint64_t row_size = r->width * bpp;
+        uint32_t y;
+
+        if (!r->width || !r->height) {
+            continue;
+        }
+
+        /* Rows that nearly fill the pitch would be merged anyway */
+        if (pl->pitch - row_size <= RANGE_SET_MERGE_GAP) {
+            status = range_set_add(&mapping->dirty, offset,
+                                   (r->height - 1) * (uint64_t)pl->pitch +
+                                   row_size);
+            continue;
+        }
+
+        for (y = 0; !status && (y < r->height); y++) {
+            status = range_set_add(&mapping->dirty,
+                                   offset + y * (uint64_t)pl->pitch,
+                                   row_size);
+        }
+    }
+
+    pthread_mutex_unlock(&mapping->dirty_lock);
 
-    return dev->get_allocation_fd(dev, allocation, fd);
+    return status;
 }
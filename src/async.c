@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "work_queue.h"
+
+typedef enum request_state {
+    REQUEST_QUEUED,
+    REQUEST_RUNNING,
+    REQUEST_DONE,
+    REQUEST_CANCELLED,
+} request_state_t;
+
+struct allocation_request {
+    device_t *dev;
+
+    /*! Copies of the caller's parameters, which needn't outlive the call */
+    assertion_t assertion;
+    uint32_t format;
+    capability_set_t *capability_set;
+
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+
+    request_state_t state;
+
+    /*!
+     * One reference for the application, until allocation_request_destroy(),
+     * and one for the queued task, until it has run or been cancelled.
+     */
+    unsigned int refcount;
+
+    /*! The result, once state is REQUEST_DONE */
+    int status;
+    allocation_t *allocation;
+
+    /*! Signaled when state becomes REQUEST_DONE or REQUEST_CANCELLED */
+    int event_fd;
+};
+
+static void signal_request(allocation_request_t *req)
+{
+    const uint64_t one = 1;
+
+    while ((write(req->event_fd, &one, sizeof(one)) < 0) && (errno == EINTR));
+}
+
+/*!
+ * Drop a reference to a request, freeing it along with any allocation the
+ * application never collected once no references remain.
+ */
+static void release_request(allocation_request_t *req)
+{
+    unsigned int refcount;
+
+    pthread_mutex_lock(&req->lock);
+    refcount = --req->refcount;
+    pthread_mutex_unlock(&req->lock);
+
+    if (refcount) {
+        return;
+    }
+
+    if (req->allocation) {
+        device_destroy_allocation(req->dev, req->allocation);
+    }
+
+    close(req->event_fd);
+    free_capability_sets(1, req->capability_set);
+    pthread_cond_destroy(&req->done);
+    pthread_mutex_destroy(&req->lock);
+    free(req);
+}
+
+static void run_request(void *arg)
+{
+    allocation_request_t *req = arg;
+    allocation_t *allocation = NULL;
+    int status;
+
+    pthread_mutex_lock(&req->lock);
+    req->state = REQUEST_RUNNING;
+    pthread_mutex_unlock(&req->lock);
+
+    status = device_create_allocation(req->dev, &req->assertion,
+                                      req->capability_set, &allocation);
+
+    pthread_mutex_lock(&req->lock);
+    req->status = status;
+    req->allocation = status ? NULL : allocation;
+    req->state = REQUEST_DONE;
+    pthread_cond_broadcast(&req->done);
+    signal_request(req);
+    pthread_mutex_unlock(&req->lock);
+
+    release_request(req);
+}
+
+allocation_request_t *
+device_create_allocation_async(device_t *dev,
+                               const assertion_t *assertion,
+                               const capability_set_t *capability_set)
+{
+    allocation_request_t *req = calloc(1, sizeof(*req));
+    size_t data_size;
+    void *data;
+    int status;
+
+    if (!req) {
+        return NULL;
+    }
+
+    req->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (req->event_fd < 0) {
+        free(req);
+        return NULL;
+    }
+
+    if (serialize_capability_set(capability_set, &data_size, &data)) {
+        goto fail;
+    }
+
+    status = deserialize_capability_set(data_size, data,
+                                        &req->capability_set);
+    free(data);
+
+    if (status) {
+        goto fail;
+    }
+
+    req->dev = dev;
+    req->assertion = *assertion;
+
+    if (assertion->format) {
+        req->format = *assertion->format;
+        req->assertion.format = &req->format;
+    }
+
+    pthread_mutex_init(&req->lock, NULL);
+    pthread_cond_init(&req->done, NULL);
+    req->state = REQUEST_QUEUED;
+    req->refcount = 2;
+
+    if (queue_work(NULL, run_request, req)) {
+        run_request(req);
+    }
+
+    return req;
+
+fail:
+    close(req->event_fd);
+    free(req);
+
+    return NULL;
+}
+
+int allocation_request_get_fd(const allocation_request_t *req)
+{
+    return req->event_fd;
+}
+
+int allocation_request_cancel(allocation_request_t *req)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&req->lock);
+
+    if ((req->state == REQUEST_QUEUED) && !cancel_work(run_request, req)) {
+        req->state = REQUEST_CANCELLED;
+        req->refcount--;
+        pthread_cond_broadcast(&req->done);
+        signal_request(req);
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&req->lock);
+
+    return ret;
+}
+
+int allocation_request_wait(allocation_request_t *req,
+                            allocation_t **allocation)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&req->lock);
+
+    /* Rather than wait for a worker, run the request if it hasn't started */
+    if ((req->state == REQUEST_QUEUED) && !cancel_work(run_request, req)) {
+        pthread_mutex_unlock(&req->lock);
+        run_request(req);
+        pthread_mutex_lock(&req->lock);
+    }
+
+    while ((req->state == REQUEST_QUEUED) ||
+           (req->state == REQUEST_RUNNING)) {
+        pthread_cond_wait(&req->done, &req->lock);
+    }
+
+    if ((req->state == REQUEST_DONE) && req->allocation) {
+        *allocation = req->allocation;
+        req->allocation = NULL;
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&req->lock);
+
+    return ret;
+}
+
+void allocation_request_destroy(allocation_request_t *req)
+{
+    allocation_request_cancel(req);
+    release_request(req);
+}
@@ -27,4 +27,6 @@ constraint_merge_func_t constraint_merge_func_table[] = {
     &merge_address_alignment,       /* CONSTRAINT_ADDRESS_ALIGNMENT */
     &merge_pitch_alignment,         /* CONSTRAINT_PITCH_ALIGNMENT */
     &merge_max_pitch,               /* CONSTRAINT_MAX_PITCH */
+    &merge_numa_node,               /* CONSTRAINT_NUMA_NODE */
+    &merge_uninitialized,           /* CONSTRAINT_UNINITIALIZED */
 };
@@ -45,4 +45,12 @@ extern int merge_max_pitch(const constraint_t *a,
                            const constraint_t *b,
                            constraint_t *merged);
 
+extern int merge_numa_node(const constraint_t *a,
+                           const constraint_t *b,
+                           constraint_t *merged);
+
+extern int merge_uninitialized(const constraint_t *a,
+                               const constraint_t *b,
+                               constraint_t *merged);
+
 #endif /* __SRC_CONSTRAINT_FUNCS_H__ */
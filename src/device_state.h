@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_DEVICE_STATE_H__
+#define __SRC_DEVICE_STATE_H__
+
+#include <sys/types.h>
+#include <allocator/driver.h>
+#include "allocation_pool.h"
+#include "import.h"
+#include "query_cache.h"
+
+/*!
+ * Allocator library state attached to each device through
+ * device_t::library_private.
+ */
+typedef struct device_state {
+    /*! The device this state belongs to */
+    device_t *dev;
+
+    /*! The driver reference taken by device_create() */
+    driver_t *driver;
+
+    /*!
+     * Number of device_create() calls that returned this device and have not
+     * been matched by a device_destroy() call.  Always 1 for devices that
+     * aren't shared.
+     */
+    unsigned int refcount;
+
+    /*! Non-zero if the device is in the shared device list */
+    int shared;
+
+    /*! The device node's st_dev and st_rdev, for shared devices */
+    dev_t node_dev;
+    dev_t node_rdev;
+
+    /*!
+     * A duplicate of the device file descriptor owned by the library, for
+     * shared devices, or -1.  The device must outlive any one caller's
+     * descriptor, since callers may close theirs as soon as they destroy
+     * their reference.
+     */
+    int fd;
+
+    /*! Cached results of the device's capability and assertion hint queries */
+    query_cache_t query_cache;
+
+    /*! Released allocations kept for reuse */
+    allocation_pool_t allocation_pool;
+
+    /*! Allocations imported on the device, for deduplicating imports */
+    import_table_t import_table;
+
+    /*!
+     * Number and total size of the allocations created on the device and
+     * held by the application, updated atomically.  Imported allocations
+     * aren't counted.
+     */
+    uint64_t live_bytes;
+    uint32_t num_live;
+
+    /*! Budgets set by device_set_memory_budget(), or 0 */
+    uint64_t soft_budget;
+    uint64_t hard_budget;
+
+    /*! Headroom set by device_set_allocation_headroom(), or 0 */
+    uint32_t headroom_granularity;
+    uint32_t headroom_percent;
+
+    /*! Next device in the shared device list */
+    struct device_state *next;
+
+    /*! Next device in the list of all devices */
+    struct device_state *all_next;
+} device_state_t;
+
+static inline device_state_t *get_device_state(const device_t *dev)
+{
+    return (device_state_t *)dev->library_private;
+}
+
+#endif /* __SRC_DEVICE_STATE_H__ */
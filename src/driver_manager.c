@@ -22,31 +22,120 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
 #include <dlfcn.h>
 #include <dirent.h>
 #include <fnmatch.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include <allocator/allocator.h>
 #include <allocator/driver.h>
 #include "driver_manager.h"
-#include "cJSON/cJSON.h"
+#include "manifest.h"
+#include "sysfs.h"
+#include "timing.h"
+
+/*!
+ * Environment variable holding a colon-separated list of directories to
+ * search for driver JSON config files.  When set, it replaces the default
+ * search path.  It is ignored in setuid and setgid processes.
+ */
+#define DRIVER_DIRS_ENV "ALLOCATOR_DRIVER_DIRS"
+
+/*! Sub-directory of the XDG base directories holding driver config files */
+#define DRIVER_CONFIG_SUBDIR "allocator"
 
 /*!
  * A linked list of all the available driver instances.
  *
- * TODO Make access to this thread_safe
  * TODO Use an existing linked-list implementation instead of open-coding
  */
 driver_t *driver_list = NULL;
 
+/*!
+ * Bookkeeping for one driver JSON config file.
+ *
+ * There is at most one live entry per config file name.  When the same file
+ * name exists in several search directories, only the first one is loaded,
+ * which lets users override system-wide config files.  Entries whose driver
+ * failed to load are kept so the file still shadows later directories.
+ */
+typedef struct driver_entry {
+    /*! The loaded driver, or NULL if the config file could not be loaded */
+    driver_t *driver;
+
+    /*! The config file name, without its directory */
+    char *name;
+
+    /*! Index of the config file's directory in search_dirs */
+    unsigned int dir_index;
+
+    /*! Number of devices created from this driver and not yet destroyed */
+    unsigned int device_count;
+
+    /*!
+     * Non-zero if the config file changed or was removed.  A retired entry's
+     * driver is no longer in driver_list, and is unloaded once device_count
+     * drops to zero.
+     */
+    int retired;
+
+    /*! The device nodes the driver can possibly support */
+    manifest_match_t match;
+
+    struct driver_entry *next;
+} driver_entry_t;
+
+static driver_entry_t *driver_entries = NULL;
+
+/*! Directories searched for driver config files, in priority order */
+static char **search_dirs = NULL;
+static unsigned int num_search_dirs = 0;
+
 /*! Non-zero if driver enumeration & initialization has been run */
 int drivers_initialized = 0;
 
+/*! Protects all of the driver manager state */
+static pthread_mutex_t driver_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * An inotify watch on a search directory.
+ *
+ * Search directories that don't exist when watching starts are handled by
+ * watching their parent directory until they are created.
+ */
+typedef struct dir_watch {
+    int wd;
+    unsigned int dir_index;
+    int is_parent;
+} dir_watch_t;
+
+/*! The inotify descriptor, or -1 if driver_watch_start() wasn't called */
+static int watch_fd = -1;
+static dir_watch_t *watches = NULL;
+static unsigned int num_watches = 0;
+
+/*!
+ * Remove a driver from the list of available drivers, if present.
+ */
+static void unlink_driver(driver_t *driver)
+{
+    for (driver_t **d = &driver_list; *d; d = &(*d)->next) {
+        if (*d == driver) {
+            *d = driver->next;
+            break;
+        }
+    }
+
+    driver->next = NULL;
+}
+
 /*!
  * Run a driver's destructor and unload its library.
  *
@@ -55,12 +144,7 @@ int drivers_initialized = 0;
 static void remove_one_driver(driver_t *driver)
 {
     if (driver) {
-        for (driver_t **d = &driver_list; *d; d = &(*d)->next) {
-            if (*d == driver) {
-                *d = driver->next;
-                break;
-            }
-        }
+        unlink_driver(driver);
 
         if (driver->destroy) {
             driver->destroy(driver);
@@ -79,16 +163,17 @@ static void remove_one_driver(driver_t *driver)
  *
  * \param[in] driver_file The driver library file name.
  *
- * \return 0 on success, -1 on failure.
+ * \return The initialized driver on success, NULL on failure.  The driver is
+ *         not added to the list of available drivers.
  *
  * TODO Need to define error propagation policy.  Should this and other
  *      functions return a more detailed error code and/or set errno?
  */
-static int add_one_driver(const char *driver_file)
+static driver_t *add_one_driver(const char *driver_file)
 {
     driver_init_func_t driver_init_func;
     driver_t *driver = calloc(1, sizeof(driver_t));
-    driver_t **d;
+    uint64_t start;
     int ret = 0;
 
     if (!driver) {
@@ -98,7 +183,10 @@ static int add_one_driver(const char *driver_file)
 
     driver->driver_interface_version = DRIVER_INTERFACE_VERSION;
 
+    start = TIMING_BEGIN();
     driver->lib_handle = dlopen(driver_file, RTLD_LAZY);
+    TIMING_END(TIMING_PHASE_DLOPEN, start, driver_file,
+               driver->lib_handle ? 0 : -1);
 
     if (!driver->lib_handle) {
         ret = -1;
@@ -113,8 +201,11 @@ static int add_one_driver(const char *driver_file)
         goto done;
     }
 
-    if (driver_init_func(driver) < 0) {
-        ret = -1;
+    start = TIMING_BEGIN();
+    ret = driver_init_func(driver) < 0 ? -1 : 0;
+    TIMING_END(TIMING_PHASE_DRIVER_INIT, start, driver_file, ret);
+
+    if (ret < 0) {
         goto done;
     }
 
@@ -136,20 +227,13 @@ static int add_one_driver(const char *driver_file)
         goto done;
     }
 
-    /*
-     * Because the ordering of drivers affects system behavior, the driver needs
-     * to be appended rather than prepended to the list to preserve the
-     * configuration directory sort order.
-     */
-    for (d = &driver_list; *d; d = &(*d)->next);
-    *d = driver;
-
 done:
     if (ret < 0) {
         remove_one_driver(driver);
+        driver = NULL;
     }
 
-    return ret;
+    return driver;
 }
 
 static int check_json_format_version(const char *version_string)
@@ -187,88 +271,395 @@ static int check_json_format_version(const char *version_string)
 }
 
 /*!
- * Load and initialize the driver defined by a single JSON driver config file.
+ * Non-zero if the process runs with privileges its user doesn't have, in
+ * which case configuration under the user's control must be ignored.
+ */
+static int is_privileged(void)
+{
+    return (getuid() != geteuid()) || (getgid() != getegid());
+}
+
+/*!
+ * Read an environment variable that could point the library at files not
+ * controlled by the system administrator.
  *
- * \param[in] driver_json_file A driver JSON config file.
+ * \return The variable's value, or NULL if it is unset, empty, or the
+ *         process is privileged.
+ */
+const char *get_user_env(const char *name)
+{
+    const char *value;
+
+    if (is_privileged()) {
+        return NULL;
+    }
+
+    value = getenv(name);
+
+    return (value && value[0]) ? value : NULL;
+}
+
+/*!
+ * Join a directory and a file name or sub-directory into a new path string.
  *
- * \return 0 on success, -1 on failure.
+ * \return A malloc'ed path the caller must free, or NULL on failure.
  */
-static int add_one_driver_from_config(const char *driver_json_file)
+static char *make_path(const char *dir_name, size_t dir_name_len,
+                       const char *name)
 {
-    int ret = 0;
-    char *file_buf = NULL;
-    cJSON *json_root = NULL;
-    cJSON *format_node;
-    cJSON *driver_node;
-    cJSON *driver_path_node;
-    struct stat stats;
-    FILE *fp = fopen(driver_json_file, "r");
-
-    if (!fp) {
-        ret = -1;
-        goto done;
+    const char *path_separator;
+    static const char *PATH_FMT = "%.*s%s%s";
+    char *path;
+    int path_len;
+
+    if ((dir_name_len > 0) && (dir_name[dir_name_len - 1] != '/')) {
+        path_separator = "/";
+    } else {
+        path_separator = "";
     }
 
-    if (fstat(fileno(fp), &stats)) {
-        ret = -1;
-        goto done;
+    path_len = snprintf(NULL, 0, PATH_FMT,
+                        (int)dir_name_len, dir_name, path_separator, name);
+
+    if (path_len <= 0) {
+        return NULL;
     }
 
-    file_buf = malloc(stats.st_size + 1);
+    path = malloc(path_len + 1);
 
-    if (!file_buf) {
-        ret = -1;
-        goto done;
+    if (!path) {
+        return NULL;
     }
 
-    if (fread(file_buf, stats.st_size, 1, fp) != 1) {
-        ret = -1;
-        goto done;
+    snprintf(path, path_len + 1, PATH_FMT,
+             (int)dir_name_len, dir_name, path_separator, name);
+
+    return path;
+}
+
+/*!
+ * Append one directory to the driver search path.
+ *
+ * \param[in] dir_name The directory, which need not be nul-terminated.
+ *
+ * \param[in] dir_name_len Length of <dir_name>.
+ *
+ * \param[in] subdir A sub-directory of <dir_name> to search instead of
+ *                   <dir_name> itself, or NULL.
+ *
+ * \return 0 on success, -1 on failure.  Empty and duplicate directories are
+ *         silently skipped.
+ */
+static int append_search_dir(const char *dir_name, size_t dir_name_len,
+                             const char *subdir)
+{
+    char **tmp_dirs;
+    char *dir;
+    size_t len;
+    unsigned int i;
+
+    if (dir_name_len == 0) {
+        return 0;
+    }
+
+    if (subdir) {
+        dir = make_path(dir_name, dir_name_len, subdir);
+    } else {
+        dir = strndup(dir_name, dir_name_len);
     }
 
-    json_root = cJSON_Parse(file_buf);
+    if (!dir) {
+        return -1;
+    }
 
-    if (!json_root) {
-        ret = -1;
-        goto done;
+    /* Strip trailing slashes so the directory's own name is easy to find */
+    for (len = strlen(dir); (len > 1) && (dir[len - 1] == '/'); len--) {
+        dir[len - 1] = '\0';
     }
 
-    format_node = cJSON_GetObjectItem(json_root, "file_format_version");
-    if (!format_node ||
-        (format_node->type != cJSON_String) ||
-        check_json_format_version(format_node->valuestring)) {
-        ret = -1;
-        goto done;
+    for (i = 0; i < num_search_dirs; i++) {
+        if (!strcmp(search_dirs[i], dir)) {
+            free(dir);
+            return 0;
+        }
     }
 
-    driver_node = cJSON_GetObjectItem(json_root, "allocator_driver");
-    if (!driver_node ||
-        (driver_node->type != cJSON_Object)) {
-        ret = -1;
-        goto done;
+    tmp_dirs = realloc(search_dirs, sizeof(search_dirs[0]) *
+                       (num_search_dirs + 1));
+
+    if (!tmp_dirs) {
+        free(dir);
+        return -1;
     }
 
-    driver_path_node = cJSON_GetObjectItem(driver_node, "library_path");
-    if (!driver_path_node ||
-        (driver_path_node->type != cJSON_String)) {
-        ret = -1;
-        goto done;
+    search_dirs = tmp_dirs;
+    search_dirs[num_search_dirs++] = dir;
+
+    return 0;
+}
+
+/*!
+ * Append each entry of a colon-separated directory list to the search path.
+ */
+static int append_search_dir_list(const char *dir_list, const char *subdir)
+{
+    while (*dir_list) {
+        size_t len = strcspn(dir_list, ":");
+
+        /*
+         * The XDG base directory specification requires relative paths in
+         * its lists to be ignored.
+         */
+        if (!subdir || (dir_list[0] == '/')) {
+            if (append_search_dir(dir_list, len, subdir)) {
+                return -1;
+            }
+        }
+
+        dir_list += len;
+
+        if (*dir_list == ':') {
+            dir_list++;
+        }
     }
 
-    ret = add_one_driver(driver_path_node->valuestring);
+    return 0;
+}
 
-done:
-    cJSON_Delete(json_root);
+/*!
+ * Append the allocator sub-directory of a per-user XDG base directory.
+ *
+ * \param[in] env_name The XDG environment variable naming the directory.
+ *
+ * \param[in] home_default The directory relative to $HOME to use when the
+ *                         environment variable is not set.
+ */
+static int append_user_search_dir(const char *env_name,
+                                  const char *home_default)
+{
+    const char *dir_name = get_user_env(env_name);
+    char *default_dir;
+    int ret;
 
-    free(file_buf);
+    if (dir_name) {
+        if (dir_name[0] != '/') {
+            return 0;
+        }
 
-    if (fp) {
-        fclose(fp);
+        return append_search_dir(dir_name, strlen(dir_name),
+                                 DRIVER_CONFIG_SUBDIR);
     }
 
+    dir_name = get_user_env("HOME");
+
+    if (!dir_name) {
+        return 0;
+    }
+
+    default_dir = make_path(dir_name, strlen(dir_name), home_default);
+
+    if (!default_dir) {
+        return -1;
+    }
+
+    ret = append_search_dir(default_dir, strlen(default_dir),
+                            DRIVER_CONFIG_SUBDIR);
+
+    free(default_dir);
+
     return ret;
 }
 
+/*!
+ * Append the allocator sub-directory of each system-wide XDG base directory.
+ *
+ * \param[in] env_name The XDG environment variable listing the directories.
+ *
+ * \param[in] default_list The directories to use when the environment
+ *                         variable is not set or must be ignored.
+ */
+static int append_system_search_dirs(const char *env_name,
+                                     const char *default_list)
+{
+    const char *dir_list = get_user_env(env_name);
+
+    return append_search_dir_list(dir_list ? dir_list : default_list,
+                                  DRIVER_CONFIG_SUBDIR);
+}
+
+/*!
+ * Build the list of directories searched for driver config files.
+ *
+ * If $ALLOCATOR_DRIVER_DIRS is set, only the directories it lists are
+ * searched.  Otherwise, the search path is, in priority order:
+ *
+ *   $XDG_CONFIG_HOME/allocator   (~/.config/allocator)
+ *   $XDG_CONFIG_DIRS/allocator   (/etc/xdg/allocator)
+ *   /etc/allocator
+ *   $XDG_DATA_HOME/allocator     (~/.local/share/allocator)
+ *   $XDG_DATA_DIRS/allocator     (/usr/local/share/allocator,
+ *                                 /usr/share/allocator)
+ *
+ * In setuid and setgid processes, the environment is ignored and per-user
+ * directories are skipped.
+ */
+static int init_search_dirs(void)
+{
+    const char *dir_list = get_user_env(DRIVER_DIRS_ENV);
+
+    if (dir_list) {
+        return append_search_dir_list(dir_list, NULL);
+    }
+
+    if (append_user_search_dir("XDG_CONFIG_HOME", ".config") ||
+        append_system_search_dirs("XDG_CONFIG_DIRS", "/etc/xdg") ||
+        append_search_dir_list("/etc/allocator", NULL) ||
+        append_user_search_dir("XDG_DATA_HOME", ".local/share") ||
+        append_system_search_dirs("XDG_DATA_DIRS",
+                                  "/usr/local/share:/usr/share")) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*!
+ * Find the live entry for the config file with the given name.
+ */
+static driver_entry_t *find_entry(const char *name)
+{
+    for (driver_entry_t *entry = driver_entries; entry; entry = entry->next) {
+        if (!entry->retired && !strcmp(entry->name, name)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * Find the entry, live or retired, that loaded the given driver.
+ */
+static driver_entry_t *find_entry_for_driver(const driver_t *driver)
+{
+    for (driver_entry_t *entry = driver_entries; entry; entry = entry->next) {
+        if (entry->driver == driver) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * Add an entry's driver to the list of available drivers.
+ *
+ * Because the ordering of drivers affects system behavior, drivers are kept
+ * in search path order, and sorted by config file name within a directory.
+ */
+static void link_driver(driver_entry_t *entry)
+{
+    driver_t **d;
+
+    for (d = &driver_list; *d; d = &(*d)->next) {
+        const driver_entry_t *other = find_entry_for_driver(*d);
+
+        if (other &&
+            ((other->dir_index > entry->dir_index) ||
+             ((other->dir_index == entry->dir_index) &&
+              (strcmp(other->name, entry->name) > 0)))) {
+            break;
+        }
+    }
+
+    entry->driver->next = *d;
+    *d = entry->driver;
+}
+
+/*!
+ * Free an entry and unload its driver.
+ */
+static void remove_entry(driver_entry_t *entry)
+{
+    for (driver_entry_t **e = &driver_entries; *e; e = &(*e)->next) {
+        if (*e == entry) {
+            *e = entry->next;
+            break;
+        }
+    }
+
+    remove_one_driver(entry->driver);
+    free(entry->name);
+    free(entry);
+}
+
+/*!
+ * Stop using an entry's driver for new devices, and unload it as soon as no
+ * devices created from it remain.
+ */
+static void retire_entry(driver_entry_t *entry)
+{
+    entry->retired = 1;
+
+    if (entry->driver) {
+        unlink_driver(entry->driver);
+    }
+
+    if (entry->device_count == 0) {
+        remove_entry(entry);
+    }
+}
+
+/*!
+ * Load and initialize the driver defined by a single JSON driver config file.
+ *
+ * \param[in] dir_index Index of the config file's directory in search_dirs.
+ *
+ * \param[in] name The config file name.
+ *
+ * \return 0 on success, -1 on failure.
+ */
+static int add_one_driver_from_config(unsigned int dir_index, const char *name)
+{
+    manifest_t manifest;
+    const char *dir_name = search_dirs[dir_index];
+    char *path = make_path(dir_name, strlen(dir_name), name);
+    driver_entry_t *entry = calloc(1, sizeof(*entry));
+    uint64_t start;
+    int ret;
+
+    if (!path || !entry || !(entry->name = strdup(name))) {
+        free(path);
+        free(entry);
+        return -1;
+    }
+
+    entry->dir_index = dir_index;
+
+    start = TIMING_BEGIN();
+    ret = (read_manifest(path, &manifest) ||
+           check_json_format_version(manifest.file_format_version)) ? -1 : 0;
+    TIMING_END(TIMING_PHASE_MANIFEST_PARSE, start, path, ret);
+
+    if (ret == 0) {
+        entry->match = manifest.match;
+        entry->driver = add_one_driver(manifest.library_path);
+    }
+
+    free(path);
+
+    entry->next = driver_entries;
+    driver_entries = entry;
+
+    if (!entry->driver) {
+        return -1;
+    }
+
+    link_driver(entry);
+
+    return 0;
+}
+
 static int scandir_filter(const struct dirent *ent)
 {
     /* Ignore the entry if we know that it's not a regular file or symlink */
@@ -300,123 +691,540 @@ static int compare_filenames(const struct dirent **ent1,
 }
 
 /*!
- * Enumerate driver JSON config files in the specified directory, and load the
- * drivers they refer to.
+ * Enumerate driver JSON config files in one search directory.
  *
- * \param[in] dir_name A directory path.
+ * \param[in] dir_index Index of the directory in search_dirs.
  *
- * \return 0 on success, -1 on failure.  Note success does not mean any drivers
- *         were found.
+ * \param[in] func Called with each config file name, in sorted order.
+ *
+ * \return 0 on success, including when the directory doesn't exist.  -1 on
+ *         failure.
  */
-static int add_drivers_in_dir(const char *dir_name)
+static int for_each_config_in_dir(unsigned int dir_index,
+                                  void (*func)(unsigned int dir_index,
+                                               const char *name))
 {
     struct dirent **entries = NULL;
-    int ret = 0;
-    const char *path_separator;
-    static const char *PATH_FMT = "%s%s%s";
+    uint64_t start = TIMING_BEGIN();
+    int count = scandir(search_dirs[dir_index], &entries,
+                        scandir_filter, compare_filenames);
     int i;
-    int count = scandir(dir_name, &entries, scandir_filter, compare_filenames);
-    size_t dir_name_len;
 
-    if (count < 0 ) {
-        ret = -1;
-        goto done;
-    } else if (count == 0) {
-        ret = 0;
-        goto done;
+    TIMING_END(TIMING_PHASE_DIRECTORY_SCAN, start, search_dirs[dir_index],
+               count < 0 ? -1 : 0);
+
+    if (count < 0) {
+        return ((errno == ENOENT) || (errno == ENOTDIR)) ? 0 : -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        func(dir_index, entries[i]->d_name);
+        free(entries[i]);
     }
 
-    dir_name_len = strlen(dir_name);
+    free(entries);
 
-    if ((dir_name_len > 0) && (dir_name[dir_name_len - 1] != '/')) {
-        path_separator = "/";
-    } else {
-        path_separator = "";
+    return 0;
+}
+
+/*!
+ * Load the driver for a config file unless a file with the same name in a
+ * higher priority directory has already been found.
+ *
+ * A config file that fails to load does not prevent other drivers from
+ * loading.
+ */
+static void add_driver_if_not_shadowed(unsigned int dir_index,
+                                       const char *name)
+{
+    if (!find_entry(name)) {
+        add_one_driver_from_config(dir_index, name);
     }
+}
 
-    for (i = 0; i < count; i++) {
-        char *path;
-        int load_result;
-        int path_len = snprintf(NULL, 0, PATH_FMT,
-                                dir_name, path_separator, entries[i]->d_name);
-
-        if (path_len < 0 ) {
-            ret = -1;
-            goto done;
-        }
+/*!
+ * Enumerate, load, and initialize all available driver libraries on the system
+ *
+ * Must be called with driver_lock held.
+ *
+ * \return 0 on success, -1 on failure.  Note success does not indicate any
+ *         drivers were found.
+ */
+static int init_drivers(void)
+{
+    unsigned int i;
 
-        /* Since only files ending in json were found, path_len should be > 0 */
-        assert(path_len > 0);
+    if (!drivers_initialized) {
+        drivers_initialized = 1;
 
-        path = malloc(path_len + 1);
+        init_timing();
 
-        if (!path) {
-            ret = -1;
-            goto done;
+        if (init_search_dirs()) {
+            return -1;
+        }
+
+        for (i = 0; i < num_search_dirs; i++) {
+            if (for_each_config_in_dir(i, add_driver_if_not_shadowed)) {
+                return -1;
+            }
         }
+    }
 
-        snprintf(path, path_len + 1, PATH_FMT,
-                 dir_name, path_separator, entries[i]->d_name);
+    return 0;
+}
 
-        load_result = add_one_driver_from_config(path);
+/*!
+ * Check whether a driver's match data admits a device node.
+ *
+ * \param[in] kernel_driver The kernel driver bound to the node's device, or
+ *                          NULL if there is none.
+ */
+static int entry_may_support(const driver_entry_t *entry,
+                             const char *subsystem,
+                             const char *kernel_driver)
+{
+    return manifest_match_list_contains(&entry->match.subsystems,
+                                        subsystem) &&
+        manifest_match_list_contains(&entry->match.kernel_drivers,
+                                     kernel_driver);
+}
 
-        free(path);
+/*!
+ * Check whether any available driver has match data.
+ */
+static int have_match_data(void)
+{
+    for (driver_t *driver = driver_list; driver; driver = driver->next) {
+        const driver_entry_t *entry = find_entry_for_driver(driver);
 
-        if (load_result < 0) {
-            ret = load_result;
-            goto done;
+        if (entry->match.subsystems.present ||
+            entry->match.kernel_drivers.present) {
+            return 1;
         }
     }
 
-done:
-    free(entries);
-
-    return ret;
+    return 0;
 }
 
 /*!
- * Enumerate, load, and initialize all available driver libraries on the system
+ * Check whether any available driver may support a device node, according
+ * to the match data in the drivers' config files.
  *
- * TODO expand this function to scan home directories and other default config
- * file locations and locations specified by environment variables.  Be sure
- * to check for suid when checking non-secure locations.
+ * \param[in] subsystem The kernel subsystem of the node.
  *
- * \return 0 on success, -1 on failure.  Not success does not indicate any
- *         drivers were found.
+ * \param[in] kernel_driver The kernel driver bound to the node's device, or
+ *                          NULL if there is none.
+ *
+ * \return Non-zero if probing the node may succeed.
  */
-static int init_drivers(void)
+int driver_may_support_node(const char *subsystem, const char *kernel_driver)
 {
-    if (!drivers_initialized) {
-        drivers_initialized = 1;
+    driver_t *driver;
+    int ret = 0;
 
-        /* TODO Don't use a single hard-coded path. */
-        return add_drivers_in_dir("/etc/allocator");
+    pthread_mutex_lock(&driver_lock);
+
+    if (init_drivers() < 0) {
+        goto done;
     }
 
-    return 0;
+    for (driver = driver_list; driver; driver = driver->next) {
+        if (entry_may_support(find_entry_for_driver(driver),
+                              subsystem, kernel_driver)) {
+            ret = 1;
+            break;
+        }
+    }
+
+done:
+    pthread_mutex_unlock(&driver_lock);
+
+    return ret;
 }
 
 /*!
  * Given a file descriptor, attempt to find a driver that supports it.
  *
  * Initializes any available drivers and then scans through them in the
- * order they were enumerated.
+ * order they were enumerated.  Drivers whose match data rules out the device
+ * node behind <fd> are skipped without being probed.
  *
  * \param[in] fd The file descriptor for which a driver is requested.
  *
- * \return An initialized driver instance on success, NULL on failure.
+ * \return An initialized driver instance on success, NULL on failure.  On
+ *         success, the caller must call release_driver() once the device it
+ *         creates from the driver is destroyed, or if creating it fails.
  */
 driver_t *find_driver_for_fd(int fd)
 {
+    char subsystem[SYSFS_MAX_NAME_LEN];
+    char kernel_driver[SYSFS_MAX_NAME_LEN];
+    driver_t *driver = NULL;
+    int have_node_info = 0;
+
+    pthread_mutex_lock(&driver_lock);
+
     if (init_drivers() < 0) {
-        return NULL;
+        goto done;
     }
 
-    for (driver_t *driver = driver_list; driver; driver = driver->next) {
-        if (driver->is_fd_supported(driver, fd)) {
-            return driver;
+    if (have_match_data()) {
+        have_node_info = !get_fd_sysfs_info(fd, subsystem, kernel_driver);
+    }
+
+    for (driver = driver_list; driver; driver = driver->next) {
+        driver_entry_t *entry = find_entry_for_driver(driver);
+        uint64_t start;
+        int supported;
+
+        if (have_node_info &&
+            !entry_may_support(entry, subsystem,
+                               kernel_driver[0] ? kernel_driver : NULL)) {
+            continue;
+        }
+
+        start = TIMING_BEGIN();
+        supported = driver->is_fd_supported(driver, fd);
+        TIMING_END(TIMING_PHASE_FD_PROBE, start, entry->name,
+                   supported ? 0 : -1);
+
+        if (supported) {
+            entry->device_count++;
+            break;
         }
     }
 
-    return NULL;
+done:
+    pthread_mutex_unlock(&driver_lock);
+
+    return driver;
+}
+
+/*!
+ * Release the reference on a driver returned by find_driver_for_fd().
+ *
+ * If the driver's config file changed or was removed while the reference
+ * was held, the driver is unloaded when its last reference is released.
+ */
+void release_driver(driver_t *driver)
+{
+    driver_entry_t *entry;
+
+    if (!driver) {
+        return;
+    }
+
+    pthread_mutex_lock(&driver_lock);
+
+    entry = find_entry_for_driver(driver);
+
+    if (entry && (entry->device_count > 0)) {
+        entry->device_count--;
+
+        if (entry->retired && (entry->device_count == 0)) {
+            remove_entry(entry);
+        }
+    }
+
+    pthread_mutex_unlock(&driver_lock);
+}
+
+/*!
+ * Return the index of the first search directory containing a config file
+ * with the given name, or -1 if there is none.
+ */
+static int find_config_dir(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_search_dirs; i++) {
+        char *path = make_path(search_dirs[i], strlen(search_dirs[i]), name);
+        struct stat stats;
+        int found;
+
+        if (!path) {
+            continue;
+        }
+
+        found = !stat(path, &stats) && S_ISREG(stats.st_mode);
+
+        free(path);
+
+        if (found) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*!
+ * Reload the driver for a config file after it was added, changed, or
+ * removed in the given search directory.
+ */
+static void rescan_config(unsigned int dir_index, const char *name)
+{
+    driver_entry_t *entry = find_entry(name);
+    int new_dir_index;
+
+    /* Changes to a file shadowed by a higher priority directory don't matter */
+    if (entry && (entry->dir_index < dir_index)) {
+        return;
+    }
+
+    new_dir_index = find_config_dir(name);
+
+    if (entry) {
+        retire_entry(entry);
+    }
+
+    if (new_dir_index >= 0) {
+        add_one_driver_from_config(new_dir_index, name);
+    }
+}
+
+/*!
+ * Retire all drivers and enumerate the search path again.  Used when change
+ * events were lost.
+ */
+static void reload_all_drivers(void)
+{
+    driver_entry_t *entry = driver_entries;
+    unsigned int i;
+
+    while (entry) {
+        driver_entry_t *next = entry->next;
+
+        if (!entry->retired) {
+            retire_entry(entry);
+        }
+
+        entry = next;
+    }
+
+    for (i = 0; i < num_search_dirs; i++) {
+        for_each_config_in_dir(i, add_driver_if_not_shadowed);
+    }
+}
+
+/*!
+ * Start watching a search directory, or its parent if it doesn't exist yet.
+ */
+static void add_dir_watch(unsigned int dir_index)
+{
+    static const uint32_t DIR_EVENTS = IN_CLOSE_WRITE | IN_CREATE |
+        IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_MASK_ADD;
+    const char *dir_name = search_dirs[dir_index];
+    const char *last_slash;
+    dir_watch_t *tmp_watches;
+    int is_parent = 0;
+    int wd = inotify_add_watch(watch_fd, dir_name, DIR_EVENTS);
+
+    if ((wd < 0) && (errno == ENOENT) &&
+        (last_slash = strrchr(dir_name, '/')) &&
+        (last_slash != dir_name)) {
+        char *parent = strndup(dir_name, last_slash - dir_name);
+
+        if (parent) {
+            wd = inotify_add_watch(watch_fd, parent,
+                                   IN_CREATE | IN_MOVED_TO | IN_ONLYDIR |
+                                   IN_MASK_ADD);
+            is_parent = 1;
+            free(parent);
+        }
+    }
+
+    if (wd < 0) {
+        return;
+    }
+
+    tmp_watches = realloc(watches, sizeof(watches[0]) * (num_watches + 1));
+
+    if (!tmp_watches) {
+        return;
+    }
+
+    watches = tmp_watches;
+    watches[num_watches].wd = wd;
+    watches[num_watches].dir_index = dir_index;
+    watches[num_watches].is_parent = is_parent;
+    num_watches++;
+}
+
+/*!
+ * Forget a watch entry, and remove its inotify watch if <rm_watch> is set
+ * and no other entry shares it.
+ *
+ * \return The entry's search directory index.
+ */
+static unsigned int remove_dir_watch(unsigned int i, int rm_watch)
+{
+    unsigned int dir_index = watches[i].dir_index;
+    int wd = watches[i].wd;
+    unsigned int j;
+
+    num_watches--;
+    memmove(&watches[i], &watches[i + 1],
+            sizeof(watches[0]) * (num_watches - i));
+
+    for (j = 0; j < num_watches; j++) {
+        if (watches[j].wd == wd) {
+            return dir_index;
+        }
+    }
+
+    if (rm_watch) {
+        inotify_rm_watch(watch_fd, wd);
+    }
+
+    return dir_index;
+}
+
+/*!
+ * Watch a search directory again after its watch went away, e.g. because
+ * it was created or removed, and pick up any config files it now has.
+ *
+ * Files may have been added to a new directory before the watch on it was,
+ * so it is enumerated after adding the watch.
+ */
+static void rewatch_dir(unsigned int dir_index)
+{
+    add_dir_watch(dir_index);
+    for_each_config_in_dir(dir_index, rescan_config);
+}
+
+int driver_watch_start(void)
+{
+    unsigned int i;
+    int ret = -1;
+
+    pthread_mutex_lock(&driver_lock);
+
+    if (watch_fd >= 0) {
+        ret = watch_fd;
+        goto done;
+    }
+
+    if (init_drivers() < 0) {
+        goto done;
+    }
+
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (watch_fd < 0) {
+        goto done;
+    }
+
+    for (i = 0; i < num_search_dirs; i++) {
+        add_dir_watch(i);
+    }
+
+    ret = watch_fd;
+
+done:
+    pthread_mutex_unlock(&driver_lock);
+
+    return ret;
+}
+
+/*!
+ * Handle a single inotify event.
+ *
+ * Watches added while handling it are appended to the watch list, and never
+ * share the event's watch descriptor, so they are skipped.
+ */
+static void handle_watch_event(const struct inotify_event *event)
+{
+    unsigned int i;
+
+    if (event->mask & IN_Q_OVERFLOW) {
+        reload_all_drivers();
+        return;
+    }
+
+    /*
+     * The watched directory was removed, or its filesystem unmounted.  Fall
+     * back to watching for it to be created again.
+     */
+    if (event->mask & IN_IGNORED) {
+        for (i = 0; i < num_watches; i++) {
+            if (watches[i].wd == event->wd) {
+                rewatch_dir(remove_dir_watch(i--, 0));
+            }
+        }
+
+        return;
+    }
+
+    if (event->len == 0) {
+        return;
+    }
+
+    for (i = 0; i < num_watches; i++) {
+        const char *dir_name = search_dirs[watches[i].dir_index];
+
+        if (watches[i].wd != event->wd) {
+            continue;
+        }
+
+        if (watches[i].is_parent) {
+            if ((event->mask & IN_ISDIR) &&
+                !strcmp(strrchr(dir_name, '/') + 1, event->name)) {
+                rewatch_dir(remove_dir_watch(i--, 1));
+            }
+        } else if (fnmatch("*.json", event->name, 0) == 0) {
+            rescan_config(watches[i].dir_index, event->name);
+        }
+    }
+}
+
+int driver_watch_dispatch(void)
+{
+    char buf[4096]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    int ret = 0;
+
+    pthread_mutex_lock(&driver_lock);
+
+    if (watch_fd < 0) {
+        ret = -1;
+        goto done;
+    }
+
+    while ((len = read(watch_fd, buf, sizeof(buf))) > 0) {
+        const struct inotify_event *event;
+        const char *p;
+
+        for (p = buf; p < buf + len;
+             p += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event *)p;
+            handle_watch_event(event);
+        }
+    }
+
+    if ((len < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+        ret = -1;
+    }
+
+done:
+    pthread_mutex_unlock(&driver_lock);
+
+    return ret;
+}
+
+void driver_watch_stop(void)
+{
+    pthread_mutex_lock(&driver_lock);
+
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+
+    free(watches);
+    watches = NULL;
+    num_watches = 0;
+
+    pthread_mutex_unlock(&driver_lock);
 }
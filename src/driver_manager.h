@@ -25,4 +25,11 @@
 
 extern driver_t *find_driver_for_fd(int fd);
 
+extern void release_driver(driver_t *driver);
+
+extern int driver_may_support_node(const char *subsystem,
+                                   const char *kernel_driver);
+
+extern const char *get_user_env(const char *name);
+
 #endif /* __SRC_DRIVER_MANAGER_H__ */
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sysmacros.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "driver_manager.h"
+#include "sysfs.h"
+
+/*! Netlink multicast group the kernel broadcasts uevents on */
+#define UEVENT_KERNEL_GROUP 1
+
+/*! Protects all of the enumeration state */
+static pthread_mutex_t enumerate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*!
+ * The result of the last sysfs scan, before filtering by driver match data,
+ * and the roots it was made with.
+ */
+static sysfs_node_t *cached_nodes = NULL;
+static uint32_t num_cached_nodes = 0;
+static int cache_valid = 0;
+static char *cached_sysfs_root = NULL;
+static char *cached_dev_root = NULL;
+static sysfs_stamp_t cached_stamp;
+
+/*!
+ * Socket receiving kernel uevents, or -1.  Only used when scanning the real
+ * sysfs, whose directory timestamps don't change when devices come and go.
+ */
+static int uevent_fd = -1;
+static int uevent_opened = 0;
+
+static void open_uevent_socket(void)
+{
+    struct sockaddr_nl addr;
+
+    uevent_opened = 1;
+
+    uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                       NETLINK_KOBJECT_UEVENT);
+
+    if (uevent_fd < 0) {
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = UEVENT_KERNEL_GROUP;
+
+    if (bind(uevent_fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(uevent_fd);
+        uevent_fd = -1;
+    }
+}
+
+/*!
+ * Check whether a uevent adds, removes, or moves a device of a scanned class.
+ *
+ * Kernel uevents are an "action@devpath" line followed by nul-separated
+ * KEY=value pairs.
+ */
+static int is_relevant_uevent(const char *msg, size_t len)
+{
+    const char *end = msg + len;
+    const char *action = NULL;
+    const char *subsystem = NULL;
+    const char *p;
+    unsigned int i;
+
+    for (p = msg; p < end; p += strnlen(p, end - p) + 1) {
+        if (!strncmp(p, "ACTION=", 7)) {
+            action = p + 7;
+        } else if (!strncmp(p, "SUBSYSTEM=", 10)) {
+            subsystem = p + 10;
+        }
+    }
+
+    if (!action || !subsystem ||
+        (strcmp(action, "add") && strcmp(action, "remove") &&
+         strcmp(action, "move"))) {
+        return 0;
+    }
+
+    for (i = 0; i < SYSFS_NUM_SUBSYSTEMS; i++) {
+        if (!strcmp(subsystem, sysfs_subsystems[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * Read all pending uevents.
+ *
+ * \return Non-zero if any of them may have changed the set of device nodes,
+ *         or if some were lost.
+ */
+static int drain_uevents(void)
+{
+    char buf[8192];
+    int changed = 0;
+
+    while (1) {
+        ssize_t len = recv(uevent_fd, buf, sizeof(buf) - 1, 0);
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* ENOBUFS means the socket overflowed and events were lost */
+            return changed || (errno != EAGAIN);
+        }
+
+        buf[len] = '\0';
+
+        if (is_relevant_uevent(buf, len)) {
+            changed = 1;
+        }
+    }
+}
+
+/*!
+ * Check whether the cached scan still describes the system.
+ *
+ * Must be called with enumerate_lock held.
+ */
+static int cache_is_current(const char *sysfs_root, const char *dev_root)
+{
+    int real_sysfs = !strcmp(sysfs_root, DEFAULT_SYSFS_ROOT);
+    int changed = 0;
+    sysfs_stamp_t stamp;
+
+    if (real_sysfs) {
+        if (!uevent_opened) {
+            open_uevent_socket();
+        }
+
+        /* Without uevents there is no way to notice changes in sysfs */
+        if (uevent_fd < 0) {
+            return 0;
+        }
+
+        /* Always drain, so stale events don't invalidate the next scan */
+        changed = drain_uevents();
+    }
+
+    if (!cache_valid ||
+        strcmp(cached_sysfs_root, sysfs_root) ||
+        strcmp(cached_dev_root, dev_root)) {
+        return 0;
+    }
+
+    if (real_sysfs) {
+        return !changed;
+    }
+
+    get_sysfs_stamp(sysfs_root, &stamp);
+
+    return !memcmp(&stamp, &cached_stamp, sizeof(stamp));
+}
+
+/*!
+ * Rescan sysfs, replacing the cached scan.
+ *
+ * Must be called with enumerate_lock held.
+ */
+static int update_cache(const char *sysfs_root, const char *dev_root)
+{
+    char *new_sysfs_root = strdup(sysfs_root);
+    char *new_dev_root = strdup(dev_root);
+    sysfs_node_t *nodes;
+    uint32_t num_nodes;
+    sysfs_stamp_t stamp;
+
+    if (!new_sysfs_root || !new_dev_root) {
+        goto fail;
+    }
+
+    /* Stamp first, so changes made during the scan are caught next time */
+    get_sysfs_stamp(sysfs_root, &stamp);
+
+    if (scan_sysfs_nodes(sysfs_root, dev_root, &num_nodes, &nodes)) {
+        goto fail;
+    }
+
+    free_sysfs_nodes(num_cached_nodes, cached_nodes);
+    free(cached_sysfs_root);
+    free(cached_dev_root);
+
+    cached_nodes = nodes;
+    num_cached_nodes = num_nodes;
+    cached_sysfs_root = new_sysfs_root;
+    cached_dev_root = new_dev_root;
+    memcpy(&cached_stamp, &stamp, sizeof(stamp));
+    cache_valid = 1;
+
+    return 0;
+
+fail:
+    free(new_sysfs_root);
+    free(new_dev_root);
+
+    return -1;
+}
+
+int device_enumerate(uint32_t *num_device_nodes, device_node_t **device_nodes)
+{
+    const char *sysfs_root = get_sysfs_root();
+    const char *dev_root = get_dev_root();
+    device_node_t *nodes = NULL;
+    uint32_t count = 0;
+    uint32_t i;
+    int ret = -1;
+
+    pthread_mutex_lock(&enumerate_lock);
+
+    if (!cache_is_current(sysfs_root, dev_root) &&
+        update_cache(sysfs_root, dev_root)) {
+        goto done;
+    }
+
+    if (num_cached_nodes) {
+        nodes = calloc(num_cached_nodes, sizeof(*nodes));
+
+        if (!nodes) {
+            goto done;
+        }
+    }
+
+    for (i = 0; i < num_cached_nodes; i++) {
+        const sysfs_node_t *node = &cached_nodes[i];
+        device_node_t *out = &nodes[count];
+
+        if (!driver_may_support_node(node->subsystem, node->kernel_driver)) {
+            continue;
+        }
+
+        out->major = major(node->rdev);
+        out->minor = minor(node->rdev);
+        out->path = strdup(node->path);
+        out->subsystem = strdup(node->subsystem);
+        count++;
+
+        if (!out->path || !out->subsystem ||
+            (node->kernel_driver &&
+             !(out->kernel_driver = strdup(node->kernel_driver)))) {
+            free_device_nodes(count, nodes);
+            nodes = NULL;
+            goto done;
+        }
+    }
+
+    if (!count) {
+        free(nodes);
+        nodes = NULL;
+    }
+
+    *num_device_nodes = count;
+    *device_nodes = nodes;
+    ret = 0;
+
+done:
+    pthread_mutex_unlock(&enumerate_lock);
+
+    return ret;
+}
+
+void free_device_nodes(uint32_t num_device_nodes, device_node_t *device_nodes)
+{
+    uint32_t i;
+
+    if (device_nodes) {
+        for (i = 0; i < num_device_nodes; i++) {
+            free((void *)device_nodes[i].path);
+            free((void *)device_nodes[i].subsystem);
+            free((void *)device_nodes[i].kernel_driver);
+        }
+
+        free(device_nodes);
+    }
+}
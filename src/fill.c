@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Filling allocations with a constant pixel value.
+ *
+ * Drivers may fill allocations themselves.  Otherwise they are mapped and
+ * filled on the CPU, one span of whole pixels at a time: a row of a pitch
+ * linear plane, or for block tiled planes, a row of whole tiles, which are
+ * contiguous.  Spans are written with a repeating 64-byte pattern of whole
+ * pixels, using AVX2, SSE2 or NEON stores where available.  Large planes
+ * are split by rows between worker threads.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "allocation_state.h"
+#include "cpu.h"
+#include "formats.h"
+#include "layout.h"
+#include "work_queue.h"
+
+/*! Bytes in a fill pattern, a multiple of every vector size used */
+#define FILL_PATTERN_SIZE 64
+
+/*! Fewest bytes worth handing to another thread */
+#define FILL_TASK_MIN_BYTES (2 * 1024 * 1024)
+
+/*!
+ * A pixel value repeated to fill FILL_PATTERN_SIZE bytes, or as many whole
+ * pixels as fit if the pixel size doesn't divide it.
+ */
+typedef struct fill_pattern {
+    uint8_t bytes[FILL_PATTERN_SIZE];
+    uint32_t size;
+} fill_pattern_t;
+
+typedef void (*fill_span_func)(uint8_t *dst,
+                               size_t size,
+                               const fill_pattern_t *pattern);
+
+static void fill_span_memset(uint8_t *dst,
+                             size_t size,
+                             const fill_pattern_t *pattern)
+{
+    memset(dst, pattern->bytes[0], size);
+}
+
+static void fill_span_scalar(uint8_t *dst,
+                             size_t size,
+                             const fill_pattern_t *pattern)
+{
+    while (size >= pattern->size) {
+        memcpy(dst, pattern->bytes, pattern->size);
+        dst += pattern->size;
+        size -= pattern->size;
+    }
+
+    memcpy(dst, pattern->bytes, size);
+}
+
+#if defined(__SSE2__)
+static void fill_span_vector(uint8_t *dst,
+                             size_t size,
+                             const fill_pattern_t *pattern)
+{
+    const __m128i *p = (const __m128i *)pattern->bytes;
+    __m128i v0 = _mm_loadu_si128(p);
+    __m128i v1 = _mm_loadu_si128(p + 1);
+    __m128i v2 = _mm_loadu_si128(p + 2);
+    __m128i v3 = _mm_loadu_si128(p + 3);
+
+    for (; size >= FILL_PATTERN_SIZE; size -= FILL_PATTERN_SIZE) {
+        __m128i *d = (__m128i *)dst;
+
+        _mm_storeu_si128(d, v0);
+        _mm_storeu_si128(d + 1, v1);
+        _mm_storeu_si128(d + 2, v2);
+        _mm_storeu_si128(d + 3, v3);
+        dst += FILL_PATTERN_SIZE;
+    }
+
+    memcpy(dst, pattern->bytes, size);
+}
+#elif defined(__ARM_NEON)
+static void fill_span_vector(uint8_t *dst,
+                             size_t size,
+                             const fill_pattern_t *pattern)
+{
+    uint8x16_t v0 = vld1q_u8(pattern->bytes);
+    uint8x16_t v1 = vld1q_u8(pattern->bytes + 16);
+    uint8x16_t v2 = vld1q_u8(pattern->bytes + 32);
+    uint8x16_t v3 = vld1q_u8(pattern->bytes + 48);
+
+    for (; size >= FILL_PATTERN_SIZE; size -= FILL_PATTERN_SIZE) {
+        vst1q_u8(dst, v0);
+        vst1q_u8(dst + 16, v1);
+        vst1q_u8(dst + 32, v2);
+        vst1q_u8(dst + 48, v3);
+        dst += FILL_PATTERN_SIZE;
+    }
+
+    memcpy(dst, pattern->bytes, size);
+}
+#else
+#define fill_span_vector fill_span_scalar
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2_FILL 1
+
+__attribute__((target("avx2")))
+static void fill_span_avx2(uint8_t *dst,
+                           size_t size,
+                           const fill_pattern_t *pattern)
+{
+    const __m256i *p = (const __m256i *)pattern->bytes;
+    __m256i v0 = _mm256_loadu_si256(p);
+    __m256i v1 = _mm256_loadu_si256(p + 1);
+
+    for (; size >= FILL_PATTERN_SIZE; size -= FILL_PATTERN_SIZE) {
+        __m256i *d = (__m256i *)dst;
+
+        _mm256_storeu_si256(d, v0);
+        _mm256_storeu_si256(d + 1, v1);
+        dst += FILL_PATTERN_SIZE;
+    }
+
+    memcpy(dst, pattern->bytes, size);
+}
+
+#endif
+
+/*!
+ * Build the pattern for a pixel value, and pick the fastest way to write
+ * it.
+ */
+static fill_span_func init_fill_pattern(fill_pattern_t *pattern,
+                                        const uint8_t *pixel,
+                                        uint32_t pixel_size)
+{
+    uint32_t i;
+    int uniform = 1;
+
+    pattern->size = FILL_PATTERN_SIZE / pixel_size * pixel_size;
+
+    for (i = 0; i < pattern->size; i++) {
+        pattern->bytes[i] = pixel[i % pixel_size];
+        uniform = uniform && (pattern->bytes[i] == pixel[0]);
+    }
+
+    /* Clearing to black or white needs no pattern at all */
+    if (uniform) {
+        return fill_span_memset;
+    }
+
+    if (pattern->size != FILL_PATTERN_SIZE) {
+        return fill_span_scalar;
+    }
+
+#ifdef HAVE_AVX2_FILL
+    if (cpu_has_avx2()) {
+        return fill_span_avx2;
+    }
+#endif
+
+    return fill_span_vector;
+}
+
+/*!
+ * A band of rows of tiles of a plane to fill.  Pitch linear planes have
+ * 1x1 tiles.
+ */
+typedef struct fill_task {
+    uint8_t *base;
+    uint32_t pitch;
+    uint32_t tile_width;
+    uint32_t tile_height;
+    uint32_t pixel_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t first_tile_row;
+    uint32_t end_tile_row;
+    const fill_pattern_t *pattern;
+    fill_span_func fill_span;
+    work_batch_t *batch;
+} fill_task_t;
+
+static void run_fill_task(void *arg)
+{
+    const fill_task_t *task = arg;
+    size_t tile_row_size = (size_t)task->tile_width * task->pixel_size;
+    size_t tile_size = tile_row_size * task->tile_height;
+    uint32_t full_tiles = task->width / task->tile_width;
+    size_t partial_size = (size_t)(task->width % task->tile_width) *
+        task->pixel_size;
+    uint32_t ty, tx, y;
+
+    for (ty = task->first_tile_row; ty < task->end_tile_row; ty++) {
+        uint8_t *row = task->base +
+            (size_t)ty * task->tile_height * task->pitch;
+        uint32_t rows = task->tile_height;
+
+        if ((uint64_t)(ty + 1) * task->tile_height > task->height) {
+            rows = task->height - ty * task->tile_height;
+        }
+
+        /* The first <rows> rows of each tile are contiguous */
+        if (rows == task->tile_height) {
+            task->fill_span(row, full_tiles * tile_size, task->pattern);
+        } else {
+            for (tx = 0; tx < full_tiles; tx++) {
+                task->fill_span(row + tx * tile_size, rows * tile_row_size,
+                                task->pattern);
+            }
+        }
+
+        if (partial_size) {
+            for (y = 0; y < rows; y++) {
+                task->fill_span(row + full_tiles * tile_size +
+                                y * tile_row_size, partial_size,
+                                task->pattern);
+            }
+        }
+    }
+
+    if (task->batch) {
+        complete_work_batch(task->batch);
+    }
+}
+
+/*!
+ * Fill a plane, splitting it between worker threads if it's large.
+ */
+static void fill_plane(fill_task_t *plane_task, uint64_t plane_size)
+{
+    uint32_t tile_rows = (plane_task->height + plane_task->tile_height - 1) /
+        plane_task->tile_height;
+    uint64_t num_tasks = plane_size / FILL_TASK_MIN_BYTES;
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    fill_task_t *tasks = NULL;
+    work_batch_t batch;
+    uint32_t i;
+
+    if ((num_cpus > 0) && (num_tasks > (uint64_t)num_cpus)) {
+        num_tasks = num_cpus;
+    }
+
+    if (num_tasks > WORK_QUEUE_MAX_THREADS) {
+        num_tasks = WORK_QUEUE_MAX_THREADS;
+    }
+
+    if (num_tasks > tile_rows) {
+        num_tasks = tile_rows;
+    }
+
+    if (num_tasks > 1) {
+        tasks = calloc(num_tasks, sizeof(*tasks));
+    }
+
+    if (!tasks) {
+        plane_task->first_tile_row = 0;
+        plane_task->end_tile_row = tile_rows;
+        plane_task->batch = NULL;
+        run_fill_task(plane_task);
+        return;
+    }
+
+    init_work_batch(&batch, num_tasks);
+
+    for (i = 0; i < num_tasks; i++) {
+        tasks[i] = *plane_task;
+        tasks[i].first_tile_row = (uint64_t)tile_rows * i / num_tasks;
+        tasks[i].end_tile_row = (uint64_t)tile_rows * (i + 1) / num_tasks;
+        tasks[i].batch = &batch;
+    }
+
+    /* Hand off all but the first band, which this thread fills */
+    for (i = 1; i < num_tasks; i++) {
+        if (queue_work(&batch, run_fill_task, &tasks[i])) {
+            run_fill_task(&tasks[i]);
+        }
+    }
+
+    run_fill_task(&tasks[0]);
+
+    wait_work_batch(&batch);
+    fini_work_batch(&batch);
+    free(tasks);
+}
+
+int device_fill_allocation(device_t *dev,
+                           allocation_t *allocation,
+                           uint32_t plane,
+                           const void *pixel)
+{
+    allocation_state_t *state = get_allocation_state(allocation);
+    const format_info_t *info;
+    fill_pattern_t pattern;
+    assertion_t assertion;
+    fill_task_t task;
+    layout_t layout;
+    uint32_t hsub, vsub;
+    void *ptr;
+
+    if (!state->width) {
+        return -1;
+    }
+
+    memset(&assertion, 0, sizeof(assertion));
+    assertion.width = state->width;
+    assertion.height = state->height;
+    assertion.format = state->has_format ? &state->format : NULL;
+
+    if (dev->fill_allocation &&
+        !dev->fill_allocation(dev, allocation, &assertion, plane, pixel)) {
+        return 0;
+    }
+
+    info = get_format_info(state->has_format ? state->format :
+                           DEFAULT_FORMAT);
+
+    memset(&task, 0, sizeof(task));
+
+    if (!info || (plane >= info->num_planes) ||
+        get_block_tiling(allocation->capability_set, &task.tile_width,
+                         &task.tile_height) ||
+        device_plan_layout(dev, &assertion, allocation->capability_set,
+                           &layout) ||
+        (layout.size > allocation->size)) {
+        return -1;
+    }
+
+    if (device_map_allocation(dev, allocation, ALLOCATION_MAP_WRITE, &ptr)) {
+        return -1;
+    }
+
+    hsub = plane ? info->hsub : 1;
+    vsub = plane ? info->vsub : 1;
+
+    task.base = (uint8_t *)ptr + layout.planes[plane].offset;
+    task.pitch = layout.planes[plane].pitch;
+    task.pixel_size = info->bytes_per_pixel[plane];
+    task.width = (state->width + hsub - 1) / hsub;
+    task.height = (state->height + vsub - 1) / vsub;
+    task.pattern = &pattern;
+    task.fill_span = init_fill_pattern(&pattern, pixel, task.pixel_size);
+
+    fill_plane(&task, layout.planes[plane].size);
+
+    device_unmap_allocation(dev, allocation, ALLOCATION_MAP_WRITE);
+
+    return 0;
+}
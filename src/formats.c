@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <allocator/common.h>
+#include "formats.h"
+
+static const format_info_t formats[] = {
+    /* 8 bits per pixel */
+    { FOURCC('C', '8', ' ', ' '), 1, { 1 }, 1, 1 },
+    { FOURCC('R', '8', ' ', ' '), 1, { 1 }, 1, 1 },
+
+    /* 16 bits per pixel */
+    { FOURCC('R', 'G', '1', '6'), 1, { 2 }, 1, 1 },
+    { FOURCC('B', 'G', '1', '6'), 1, { 2 }, 1, 1 },
+    { FOURCC('G', 'R', '8', '8'), 1, { 2 }, 1, 1 },
+    { FOURCC('R', '1', '6', ' '), 1, { 2 }, 1, 1 },
+    { FOURCC('A', 'R', '1', '5'), 1, { 2 }, 1, 1 },
+    { FOURCC('X', 'R', '1', '5'), 1, { 2 }, 1, 1 },
+    { FOURCC('Y', 'U', 'Y', 'V'), 1, { 2 }, 1, 1 },
+    { FOURCC('U', 'Y', 'V', 'Y'), 1, { 2 }, 1, 1 },
+
+    /* 24 bits per pixel */
+    { FOURCC('R', 'G', '2', '4'), 1, { 3 }, 1, 1 },
+    { FOURCC('B', 'G', '2', '4'), 1, { 3 }, 1, 1 },
+
+    /* 32 bits per pixel */
+    { FOURCC('A', 'R', '2', '4'), 1, { 4 }, 1, 1 },
+    { FOURCC('X', 'R', '2', '4'), 1, { 4 }, 1, 1 },
+    { FOURCC('A', 'B', '2', '4'), 1, { 4 }, 1, 1 },
+    { FOURCC('X', 'B', '2', '4'), 1, { 4 }, 1, 1 },
+    { FOURCC('R', 'A', '2', '4'), 1, { 4 }, 1, 1 },
+    { FOURCC('B', 'A', '2', '4'), 1, { 4 }, 1, 1 },
+    { FOURCC('A', 'R', '3', '0'), 1, { 4 }, 1, 1 },
+    { FOURCC('X', 'R', '3', '0'), 1, { 4 }, 1, 1 },
+    { FOURCC('A', 'B', '3', '0'), 1, { 4 }, 1, 1 },
+    { FOURCC('X', 'B', '3', '0'), 1, { 4 }, 1, 1 },
+
+    /* 64 bits per pixel */
+    { FOURCC('A', 'B', '4', 'H'), 1, { 8 }, 1, 1 },
+    { FOURCC('X', 'B', '4', 'H'), 1, { 8 }, 1, 1 },
+    { FOURCC('A', 'R', '4', 'H'), 1, { 8 }, 1, 1 },
+    { FOURCC('X', 'R', '4', 'H'), 1, { 8 }, 1, 1 },
+
+    /* Semi-planar YCbCr */
+    { FOURCC('N', 'V', '1', '2'), 2, { 1, 2 }, 2, 2 },
+    { FOURCC('N', 'V', '2', '1'), 2, { 1, 2 }, 2, 2 },
+    { FOURCC('N', 'V', '1', '6'), 2, { 1, 2 }, 2, 1 },
+    { FOURCC('N', 'V', '6', '1'), 2, { 1, 2 }, 2, 1 },
+    { FOURCC('N', 'V', '2', '4'), 2, { 1, 2 }, 1, 1 },
+    { FOURCC('N', 'V', '4', '2'), 2, { 1, 2 }, 1, 1 },
+    { FOURCC('P', '0', '1', '0'), 2, { 2, 4 }, 2, 2 },
+    { FOURCC('P', '0', '1', '2'), 2, { 2, 4 }, 2, 2 },
+    { FOURCC('P', '0', '1', '6'), 2, { 2, 4 }, 2, 2 },
+
+    /* Planar YCbCr */
+    { FOURCC('Y', 'U', '1', '2'), 3, { 1, 1, 1 }, 2, 2 },
+    { FOURCC('Y', 'V', '1', '2'), 3, { 1, 1, 1 }, 2, 2 },
+    { FOURCC('Y', 'U', '1', '6'), 3, { 1, 1, 1 }, 2, 1 },
+    { FOURCC('Y', 'V', '1', '6'), 3, { 1, 1, 1 }, 2, 1 },
+    { FOURCC('Y', 'U', '2', '4'), 3, { 1, 1, 1 }, 1, 1 },
+    { FOURCC('Y', 'V', '2', '4'), 3, { 1, 1, 1 }, 1, 1 },
+};
+
+/*!
+ * Look up a pixel format.
+ *
+ * \return The format's description, or NULL if the format isn't known.
+ */
+const format_info_t *get_format_info(uint32_t format)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (formats[i].format == format) {
+            return &formats[i];
+        }
+    }
+
+    return NULL;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_FORMATS_H__
+#define __SRC_FORMATS_H__
+
+#include <stdint.h>
+#include <allocator/common.h>
+
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+     ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/*!
+ * Format assumed when an assertion doesn't specify one: DRM_FORMAT_ARGB8888
+ */
+#define DEFAULT_FORMAT FOURCC('A', 'R', '2', '4')
+
+/*!
+ * Memory layout of a linear pixel format, identified by its DRM fourcc code.
+ */
+typedef struct format_info {
+    uint32_t format;
+    uint32_t num_planes;
+
+    /*! Bytes per pixel of each plane, counting a CbCr pair as one pixel */
+    uint32_t bytes_per_pixel[LAYOUT_MAX_PLANES];
+
+    /*! Horizontal and vertical subsampling of the planes after the first */
+    uint32_t hsub;
+    uint32_t vsub;
+} format_info_t;
+
+extern const format_info_t *get_format_info(uint32_t format);
+
+#endif /* __SRC_FORMATS_H__ */
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "allocation_state.h"
+#include "device_state.h"
+#include "import.h"
+
+void init_import_table(import_table_t *table)
+{
+    memset(table, 0, sizeof(*table));
+    pthread_mutex_init(&table->lock, NULL);
+}
+
+static allocation_state_t **get_bucket(import_table_t *table, ino_t ino)
+{
+    return &table->buckets[ino % IMPORT_TABLE_BUCKETS];
+}
+
+/*!
+ * Destroy the imported allocations the application never destroyed.
+ *
+ * Must be called before the device is destroyed.
+ */
+void fini_import_table(import_table_t *table, device_t *dev)
+{
+    uint32_t i;
+
+    for (i = 0; i < IMPORT_TABLE_BUCKETS; i++) {
+        allocation_state_t *state = table->buckets[i];
+
+        while (state) {
+            allocation_state_t *next = state->import_next;
+
+            dev->destroy_allocation(dev, state->allocation);
+            free_allocation_state(state);
+            state = next;
+        }
+    }
+
+    pthread_mutex_destroy(&table->lock);
+}
+
+/*!
+ * Find an earlier import of the same file with the same metadata, and take
+ * a reference to it.
+ *
+ * \return 0 if one was found, 1 if not, -1 if one was found with different
+ *         metadata.
+ */
+static int find_import(import_table_t *table,
+                       const struct stat *stats,
+                       size_t metadata_size,
+                       const void *metadata,
+                       allocation_t **allocation)
+{
+    allocation_state_t *state;
+    int ret = 1;
+
+    pthread_mutex_lock(&table->lock);
+
+    for (state = *get_bucket(table, stats->st_ino); state;
+         state = state->import_next) {
+        const export_cache_t *cache = state->export_cache;
+
+        if ((state->import_dev != stats->st_dev) ||
+            (state->import_ino != stats->st_ino)) {
+            continue;
+        }
+
+        if ((cache->metadata_size != metadata_size) ||
+            memcmp(cache->metadata, metadata, metadata_size)) {
+            ret = -1;
+        } else {
+            state->import_refcount++;
+            *allocation = state->allocation;
+            ret = 0;
+        }
+
+        break;
+    }
+
+    pthread_mutex_unlock(&table->lock);
+
+    return ret;
+}
+
+int device_import_allocation(device_t *dev,
+                             uint64_t allocation_size,
+                             size_t metadata_size,
+                             const void *metadata,
+                             int fd,
+                             allocation_t **allocation)
+{
+    import_table_t *table = &get_device_state(dev)->import_table;
+    capability_set_t *capability_set = NULL;
+    allocation_state_t *state = NULL;
+    allocation_state_t *other;
+    export_cache_t *cache = NULL;
+    allocation_t *imported = NULL;
+    struct stat stats;
+    int ret;
+
+    if (!dev->import_allocation || fstat(fd, &stats)) {
+        return -1;
+    }
+
+    ret = find_import(table, &stats, metadata_size, metadata, allocation);
+
+    if (ret <= 0) {
+        return ret;
+    }
+
+    state = calloc(1, sizeof(*state));
+    cache = calloc(1, sizeof(*cache));
+
+    if (!state || !cache) {
+        goto fail;
+    }
+
+    cache->fd = -1;
+
+    /*
+     * Keep the file open while the allocation exists, so its inode number
+     * can't be reused by another buffer.  This also serves later exports.
+     */
+    cache->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    cache->metadata = malloc(metadata_size);
+
+    if ((cache->fd < 0) || !cache->metadata) {
+        goto fail;
+    }
+
+    memcpy(cache->metadata, metadata, metadata_size);
+    cache->metadata_size = metadata_size;
+
+    if (deserialize_capability_set(metadata_size, metadata,
+                                   &capability_set)) {
+        goto fail;
+    }
+
+    ret = dev->import_allocation(dev, capability_set, allocation_size, fd,
+                                 &imported);
+    free_capability_sets(1, capability_set);
+
+    if (ret) {
+        goto fail;
+    }
+
+    state->allocation = imported;
+    state->export_cache = cache;
+    state->imported = 1;
+    state->import_dev = stats.st_dev;
+    state->import_ino = stats.st_ino;
+    state->import_refcount = 1;
+    imported->library_private = state;
+
+    pthread_mutex_lock(&table->lock);
+
+    /* Another thread may have imported the same file meanwhile */
+    for (other = *get_bucket(table, stats.st_ino); other;
+         other = other->import_next) {
+        if ((other->import_dev == stats.st_dev) &&
+            (other->import_ino == stats.st_ino)) {
+            break;
+        }
+    }
+
+    if (other) {
+        const export_cache_t *c = other->export_cache;
+
+        ret = -1;
+
+        if ((c->metadata_size == metadata_size) &&
+            !memcmp(c->metadata, metadata, metadata_size)) {
+            other->import_refcount++;
+            *allocation = other->allocation;
+            ret = 0;
+        }
+    } else {
+        state->import_next = *get_bucket(table, stats.st_ino);
+        *get_bucket(table, stats.st_ino) = state;
+        *allocation = imported;
+    }
+
+    pthread_mutex_unlock(&table->lock);
+
+    if (other) {
+        dev->destroy_allocation(dev, imported);
+        free_allocation_state(state);
+    }
+
+    return ret;
+
+fail:
+    if (cache) {
+        if (cache->fd >= 0) {
+            close(cache->fd);
+        }
+
+        free(cache->metadata);
+        free(cache);
+    }
+
+    free(state);
+
+    return -1;
+}
+
+/*!
+ * Drop a reference to an allocation, if it was imported.
+ *
+ * \return 0 if other references to the imported allocation remain.  1 if the
+ *         caller must go on to destroy the allocation, in which case it has
+ *         been removed from the import table.
+ */
+int release_imported_allocation(device_t *dev, allocation_t *allocation)
+{
+    import_table_t *table = &get_device_state(dev)->import_table;
+    allocation_state_t *state = get_allocation_state(allocation);
+    allocation_state_t **e;
+    int ret = 0;
+
+    if (!state || !state->imported) {
+        return 1;
+    }
+
+    pthread_mutex_lock(&table->lock);
+
+    if (!--state->import_refcount) {
+        for (e = get_bucket(table, state->import_ino); *e != state;
+             e = &(*e)->import_next);
+
+        *e = state->import_next;
+        ret = 1;
+    }
+
+    pthread_mutex_unlock(&table->lock);
+
+    return ret;
+}
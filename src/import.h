@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_IMPORT_H__
+#define __SRC_IMPORT_H__
+
+#include <pthread.h>
+#include <allocator/common.h>
+#include "allocation_state.h"
+
+/*! Number of hash buckets in each device's import table */
+#define IMPORT_TABLE_BUCKETS 32
+
+/*!
+ * A device's imported allocations, indexed by the identity of the imported
+ * file, so repeated imports of the same buffer share one allocation.
+ */
+typedef struct import_table {
+    pthread_mutex_t lock;
+    allocation_state_t *buckets[IMPORT_TABLE_BUCKETS];
+} import_table_t;
+
+extern void init_import_table(import_table_t *table);
+
+extern void fini_import_table(import_table_t *table, device_t *dev);
+
+extern int release_imported_allocation(device_t *dev,
+                                       allocation_t *allocation);
+
+#endif /* __SRC_IMPORT_H__ */
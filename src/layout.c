@@ -0,0 +1,201 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "formats.h"
+#include "layout.h"
+
+static uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/*!
+ * Check whether a capability set describes a plain pitch linear surface,
+ * i.e. has no capabilities other than CAP_BASE_PITCH_LINEAR.
+ */
+int is_pitch_linear(const capability_set_t *capability_set)
+{
+    uint32_t i;
+
+    for (i = 0; i < capability_set->num_capabilities; i++) {
+        const header_t *header = &capability_set->capabilities[i]->common;
+
+        if ((header->vendor != VENDOR_BASE) ||
+            (header->name != CAP_BASE_PITCH_LINEAR)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*!
+ * Get the tile size of a capability set describing a pitch linear or block
+ * tiled surface.  Pitch linear surfaces have 1x1 tiles.
+ *
+ * \return 0 on success, -1 if the set has other capabilities, or an invalid
+ *         tile size.
+ */
+int get_block_tiling(const capability_set_t *capability_set,
+                     uint32_t *tile_width,
+                     uint32_t *tile_height)
+{
+    const capability_block_tiled_t *tiled = NULL;
+    uint32_t i;
+
+    for (i = 0; i < capability_set->num_capabilities; i++) {
+        const capability_header_t *cap = capability_set->capabilities[i];
+
+        if ((cap->common.vendor != VENDOR_BASE) ||
+            ((cap->common.name != CAP_BASE_PITCH_LINEAR) &&
+             (cap->common.name != CAP_BASE_BLOCK_TILED))) {
+            return -1;
+        }
+
+        if (cap->common.name != CAP_BASE_BLOCK_TILED) {
+            continue;
+        }
+
+        /* A surface can only be tiled one way */
+        if (tiled || (cap->common.length_in_words <
+                      CAPABILITY_LENGTH_IN_WORDS(capability_block_tiled_t))) {
+            return -1;
+        }
+
+        tiled = (const capability_block_tiled_t *)cap;
+    }
+
+    *tile_width = tiled ? tiled->tile_width : 1;
+    *tile_height = tiled ? tiled->tile_height : 1;
+
+    return (*tile_width && *tile_height) ? 0 : -1;
+}
+
+/*!
+ * Lay out a pitch linear or block tiled surface, honoring the capability
+ * set's constraints.
+ *
+ * Each plane is padded to whole tiles, its pitch is its padded row size
+ * rounded up to the pitch alignment, and it starts at a multiple of the
+ * address alignment.
+ */
+static int plan_generic_layout(const assertion_t *assertion,
+                               const capability_set_t *capability_set,
+                               layout_t *layout)
+{
+    uint32_t tile_width, tile_height;
+    const format_info_t *info;
+    uint64_t address_alignment = 1;
+    uint64_t pitch_alignment = 1;
+    uint64_t max_pitch = UINT32_MAX;
+    uint64_t offset = 0;
+    uint32_t i;
+
+    if (assertion->ext || !assertion->width || !assertion->height) {
+        return -1;
+    }
+
+    info = get_format_info(assertion->format ? *assertion->format :
+                           DEFAULT_FORMAT);
+
+    if (!info) {
+        return -1;
+    }
+
+    if (get_block_tiling(capability_set, &tile_width, &tile_height)) {
+        return -1;
+    }
+
+    for (i = 0; i < capability_set->num_constraints; i++) {
+        const constraint_t *c = &capability_set->constraints[i];
+
+        switch (c->name) {
+        case CONSTRAINT_ADDRESS_ALIGNMENT:
+            address_alignment = c->u.address_alignment.value;
+            break;
+        case CONSTRAINT_PITCH_ALIGNMENT:
+            pitch_alignment = c->u.pitch_alignment.value;
+            break;
+        case CONSTRAINT_MAX_PITCH:
+            max_pitch = c->u.max_pitch.value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!address_alignment || !pitch_alignment) {
+        return -1;
+    }
+
+    memset(layout, 0, sizeof(*layout));
+
+    for (i = 0; i < info->num_planes; i++) {
+        plane_layout_t *plane = &layout->planes[i];
+        uint32_t hsub = i ? info->hsub : 1;
+        uint32_t vsub = i ? info->vsub : 1;
+        uint64_t width = align_up((assertion->width + hsub - 1) / hsub,
+                                  tile_width);
+        uint64_t height = align_up((assertion->height + vsub - 1) / vsub,
+                                   tile_height);
+        uint64_t pitch = align_up(width * info->bytes_per_pixel[i],
+                                  pitch_alignment);
+
+        if (pitch > max_pitch) {
+            return -1;
+        }
+
+        offset = align_up(offset, address_alignment);
+
+        if (pitch * height > UINT64_MAX - offset) {
+            return -1;
+        }
+
+        plane->offset = offset;
+        plane->size = pitch * height;
+        plane->pitch = (uint32_t)pitch;
+
+        offset += plane->size;
+    }
+
+    layout->num_planes = info->num_planes;
+    layout->size = offset;
+    layout->alignment = address_alignment;
+
+    return 0;
+}
+
+int device_plan_layout(device_t *dev,
+                       const assertion_t *assertion,
+                       const capability_set_t *capability_set,
+                       layout_t *layout)
+{
+    if (dev && dev->plan_layout) {
+        return dev->plan_layout(dev, assertion, capability_set, layout);
+    }
+
+    return plan_generic_layout(assertion, capability_set, layout);
+}
@@ -0,0 +1,677 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include "manifest.h"
+
+/*!
+ * Maximum depth of nested arrays and objects.  This matches the limit the
+ * cJSON parser previously used to read manifests.
+ */
+#define MANIFEST_NESTING_LIMIT 1000
+
+/*!
+ * Longest object key worth decoding.  Keys longer than this can't match any
+ * key the driver manager looks for, so they are only validated.
+ */
+#define MANIFEST_MAX_KEY_LEN 32
+
+/*! The objects within a manifest whose members are of interest */
+typedef enum object_kind {
+    OBJECT_OTHER,
+    OBJECT_ROOT,
+    OBJECT_DRIVER,
+    OBJECT_MATCH
+} object_kind_t;
+
+/*! JSON value types, as far as the manifest reader needs to know them */
+typedef enum value_type {
+    VALUE_MISSING = 0,
+    VALUE_STRING,
+    VALUE_OBJECT,
+    VALUE_ARRAY,
+    VALUE_OTHER
+} value_type_t;
+
+/*!
+ * State of a single pass over a manifest file.
+ *
+ * The *_type fields record the type of the first occurrence of each key of
+ * interest.  Like the cJSON object lookup this replaces, later duplicates of
+ * a key are ignored and keys are compared without regard to case.
+ *
+ * <list> is the match list the next value should be decoded into, if it is an
+ * array.
+ */
+typedef struct scanner {
+    const char *p;
+    const char *end;
+    unsigned int depth;
+    manifest_t *manifest;
+    value_type_t version_type;
+    value_type_t driver_type;
+    value_type_t library_path_type;
+    value_type_t match_type;
+    value_type_t subsystems_type;
+    value_type_t kernel_drivers_type;
+    manifest_match_list_t *list;
+} scanner_t;
+
+static int scan_value(scanner_t *s,
+                      object_kind_t kind,
+                      char *str,
+                      size_t str_size,
+                      value_type_t *type);
+
+static void skip_whitespace(scanner_t *s)
+{
+    while ((s->p < s->end) &&
+           ((*s->p == ' ') || (*s->p == '\t') ||
+            (*s->p == '\n') || (*s->p == '\r'))) {
+        s->p++;
+    }
+}
+
+static int read_hex4(scanner_t *s, uint32_t *value)
+{
+    int i;
+
+    if ((s->end - s->p) < 4) {
+        return -1;
+    }
+
+    *value = 0;
+
+    for (i = 0; i < 4; i++) {
+        char c = *s->p++;
+
+        *value <<= 4;
+
+        if ((c >= '0') && (c <= '9')) {
+            *value |= c - '0';
+        } else if ((c >= 'a') && (c <= 'f')) {
+            *value |= c - 'a' + 10;
+        } else if ((c >= 'A') && (c <= 'F')) {
+            *value |= c - 'A' + 10;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*!
+ * Append one byte to a decoded string, tracking whether it overflowed.
+ */
+static void put_byte(char *str, size_t str_size, size_t *len, char c)
+{
+    if (str && (*len + 1 < str_size)) {
+        str[*len] = c;
+    }
+
+    (*len)++;
+}
+
+/*!
+ * Validate a JSON string, optionally decoding it into a buffer.
+ *
+ * \param[in,out] s The scanner, positioned on the opening quote.
+ *
+ * \param[out] str Buffer to receive the decoded, nul-terminated string, or
+ *                 NULL to only validate the string.
+ *
+ * \param[in] str_size Size of <str> in bytes.
+ *
+ * \param[out] overflow Set to non-zero if the decoded string did not fit in
+ *                      <str>.  The buffer contents are then truncated.
+ *
+ * \return 0 if the string is well formed, -1 otherwise.
+ */
+static int scan_string(scanner_t *s, char *str, size_t str_size, int *overflow)
+{
+    size_t len = 0;
+
+    s->p++;
+
+    while (s->p < s->end) {
+        unsigned char c = *s->p++;
+
+        if (c == '"') {
+            if (str && str_size) {
+                str[len < str_size ? len : str_size - 1] = '\0';
+            }
+
+            *overflow = str && (len >= str_size);
+
+            return 0;
+        } else if (c < 0x20) {
+            return -1;
+        } else if (c != '\\') {
+            put_byte(str, str_size, &len, c);
+            continue;
+        }
+
+        if (s->p >= s->end) {
+            return -1;
+        }
+
+        switch (*s->p++) {
+        case '"':  put_byte(str, str_size, &len, '"');  break;
+        case '\\': put_byte(str, str_size, &len, '\\'); break;
+        case '/':  put_byte(str, str_size, &len, '/');  break;
+        case 'b':  put_byte(str, str_size, &len, '\b'); break;
+        case 'f':  put_byte(str, str_size, &len, '\f'); break;
+        case 'n':  put_byte(str, str_size, &len, '\n'); break;
+        case 'r':  put_byte(str, str_size, &len, '\r'); break;
+        case 't':  put_byte(str, str_size, &len, '\t'); break;
+        case 'u':
+        {
+            uint32_t code;
+
+            if (read_hex4(s, &code)) {
+                return -1;
+            }
+
+            if ((code >= 0xDC00) && (code <= 0xDFFF)) {
+                /* A low surrogate must follow a high surrogate */
+                return -1;
+            }
+
+            if ((code >= 0xD800) && (code <= 0xDBFF)) {
+                uint32_t low;
+
+                if (((s->end - s->p) < 2) ||
+                    (s->p[0] != '\\') || (s->p[1] != 'u')) {
+                    return -1;
+                }
+
+                s->p += 2;
+
+                if (read_hex4(s, &low) || (low < 0xDC00) || (low > 0xDFFF)) {
+                    return -1;
+                }
+
+                code = 0x10000 + (((code & 0x3FF) << 10) | (low & 0x3FF));
+            }
+
+            if (code < 0x80) {
+                put_byte(str, str_size, &len, code);
+            } else if (code < 0x800) {
+                put_byte(str, str_size, &len, 0xC0 | (code >> 6));
+                put_byte(str, str_size, &len, 0x80 | (code & 0x3F));
+            } else if (code < 0x10000) {
+                put_byte(str, str_size, &len, 0xE0 | (code >> 12));
+                put_byte(str, str_size, &len, 0x80 | ((code >> 6) & 0x3F));
+                put_byte(str, str_size, &len, 0x80 | (code & 0x3F));
+            } else {
+                put_byte(str, str_size, &len, 0xF0 | (code >> 18));
+                put_byte(str, str_size, &len, 0x80 | ((code >> 12) & 0x3F));
+                put_byte(str, str_size, &len, 0x80 | ((code >> 6) & 0x3F));
+                put_byte(str, str_size, &len, 0x80 | (code & 0x3F));
+            }
+            break;
+        }
+        default:
+            return -1;
+        }
+    }
+
+    /* Unterminated string */
+    return -1;
+}
+
+static int scan_digits(scanner_t *s)
+{
+    const char *start = s->p;
+
+    while ((s->p < s->end) && (*s->p >= '0') && (*s->p <= '9')) {
+        s->p++;
+    }
+
+    return (s->p == start) ? -1 : 0;
+}
+
+static int scan_number(scanner_t *s)
+{
+    if (*s->p == '-') {
+        s->p++;
+    }
+
+    if ((s->p < s->end) && (*s->p == '0')) {
+        s->p++;
+    } else if (scan_digits(s)) {
+        return -1;
+    }
+
+    if ((s->p < s->end) && (*s->p == '.')) {
+        s->p++;
+
+        if (scan_digits(s)) {
+            return -1;
+        }
+    }
+
+    if ((s->p < s->end) && ((*s->p == 'e') || (*s->p == 'E'))) {
+        s->p++;
+
+        if ((s->p < s->end) && ((*s->p == '+') || (*s->p == '-'))) {
+            s->p++;
+        }
+
+        if (scan_digits(s)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int scan_literal(scanner_t *s, const char *literal)
+{
+    size_t len = strlen(literal);
+
+    if (((size_t)(s->end - s->p) < len) || memcmp(s->p, literal, len)) {
+        return -1;
+    }
+
+    s->p += len;
+
+    return 0;
+}
+
+/*!
+ * Decode one element of a match list.  Elements must be strings.
+ */
+static int scan_match_name(scanner_t *s, manifest_match_list_t *list,
+                           int *overflow)
+{
+    char name[MANIFEST_MAX_MATCH_NAME_LEN];
+    int name_overflow;
+
+    if ((s->p >= s->end) || (*s->p != '"') ||
+        scan_string(s, name, sizeof(name), &name_overflow)) {
+        return -1;
+    }
+
+    if (name_overflow || (list->num_names >= MANIFEST_MAX_MATCH_NAMES)) {
+        *overflow = 1;
+    } else {
+        strcpy(list->names[list->num_names++], name);
+    }
+
+    return 0;
+}
+
+/*!
+ * Validate an array, decoding its elements into <list> if it's non-NULL.
+ */
+static int scan_array(scanner_t *s, manifest_match_list_t *list)
+{
+    value_type_t type;
+    int overflow = 0;
+
+    if (++s->depth > MANIFEST_NESTING_LIMIT) {
+        return -1;
+    }
+
+    if (list) {
+        list->present = 1;
+        list->num_names = 0;
+    }
+
+    s->p++;
+    skip_whitespace(s);
+
+    if ((s->p < s->end) && (*s->p == ']')) {
+        s->p++;
+        s->depth--;
+        return 0;
+    }
+
+    while (1) {
+        if (list ? scan_match_name(s, list, &overflow) :
+            scan_value(s, OBJECT_OTHER, NULL, 0, &type)) {
+            return -1;
+        }
+
+        skip_whitespace(s);
+
+        if (s->p >= s->end) {
+            return -1;
+        } else if (*s->p == ',') {
+            s->p++;
+            skip_whitespace(s);
+        } else if (*s->p == ']') {
+            s->p++;
+            break;
+        } else {
+            return -1;
+        }
+    }
+
+    if (list && overflow) {
+        list->present = 0;
+        list->num_names = 0;
+    }
+
+    s->depth--;
+
+    return 0;
+}
+
+/*!
+ * Validate an object and pick out the members of interest for its kind.
+ */
+static int scan_object(scanner_t *s, object_kind_t kind)
+{
+    if (++s->depth > MANIFEST_NESTING_LIMIT) {
+        return -1;
+    }
+
+    s->p++;
+    skip_whitespace(s);
+
+    if ((s->p < s->end) && (*s->p == '}')) {
+        s->p++;
+        s->depth--;
+        return 0;
+    }
+
+    while (1) {
+        char key[MANIFEST_MAX_KEY_LEN];
+        int key_overflow;
+        value_type_t *type = NULL;
+        value_type_t ignored_type;
+        object_kind_t value_kind = OBJECT_OTHER;
+        char *str = NULL;
+        size_t str_size = 0;
+
+        if ((s->p >= s->end) || (*s->p != '"') ||
+            scan_string(s, key, sizeof(key), &key_overflow)) {
+            return -1;
+        }
+
+        skip_whitespace(s);
+
+        if ((s->p >= s->end) || (*s->p != ':')) {
+            return -1;
+        }
+
+        s->p++;
+        skip_whitespace(s);
+
+        if (key_overflow) {
+            /* Too long to be interesting */
+        } else if ((kind == OBJECT_ROOT) &&
+                   (s->version_type == VALUE_MISSING) &&
+                   !strcasecmp(key, "file_format_version")) {
+            type = &s->version_type;
+            str = s->manifest->file_format_version;
+            str_size = sizeof(s->manifest->file_format_version);
+        } else if ((kind == OBJECT_ROOT) &&
+                   (s->driver_type == VALUE_MISSING) &&
+                   !strcasecmp(key, "allocator_driver")) {
+            type = &s->driver_type;
+            value_kind = OBJECT_DRIVER;
+        } else if ((kind == OBJECT_DRIVER) &&
+                   (s->library_path_type == VALUE_MISSING) &&
+                   !strcasecmp(key, "library_path")) {
+            type = &s->library_path_type;
+            str = s->manifest->library_path;
+            str_size = sizeof(s->manifest->library_path);
+        } else if ((kind == OBJECT_DRIVER) &&
+                   (s->match_type == VALUE_MISSING) &&
+                   !strcasecmp(key, "match")) {
+            type = &s->match_type;
+            value_kind = OBJECT_MATCH;
+        } else if ((kind == OBJECT_MATCH) &&
+                   (s->subsystems_type == VALUE_MISSING) &&
+                   !strcasecmp(key, "subsystems")) {
+            type = &s->subsystems_type;
+            s->list = &s->manifest->match.subsystems;
+        } else if ((kind == OBJECT_MATCH) &&
+                   (s->kernel_drivers_type == VALUE_MISSING) &&
+                   !strcasecmp(key, "kernel_drivers")) {
+            type = &s->kernel_drivers_type;
+            s->list = &s->manifest->match.kernel_drivers;
+        }
+
+        if (scan_value(s, value_kind, str, str_size,
+                       type ? type : &ignored_type)) {
+            return -1;
+        }
+
+        skip_whitespace(s);
+
+        if (s->p >= s->end) {
+            return -1;
+        } else if (*s->p == ',') {
+            s->p++;
+            skip_whitespace(s);
+        } else if (*s->p == '}') {
+            s->p++;
+            break;
+        } else {
+            return -1;
+        }
+    }
+
+    s->depth--;
+
+    return 0;
+}
+
+/*!
+ * Validate any JSON value.
+ *
+ * \param[in,out] s The scanner, positioned on the first byte of the value.
+ *
+ * \param[in] kind If the value is an object, which manifest object it is.
+ *
+ * \param[out] str If the value is a string, a buffer to decode it into, or
+ *                 NULL.  A string too long for the buffer is an error.
+ *
+ * \param[in] str_size Size of <str> in bytes.
+ *
+ * \param[out] type The type of the value.
+ *
+ * \return 0 if the value is well formed, -1 otherwise.
+ */
+static int scan_value(scanner_t *s,
+                      object_kind_t kind,
+                      char *str,
+                      size_t str_size,
+                      value_type_t *type)
+{
+    manifest_match_list_t *list = s->list;
+    int overflow;
+
+    /* Only the value the list was set up for is decoded into it */
+    s->list = NULL;
+
+    if (s->p >= s->end) {
+        return -1;
+    }
+
+    *type = VALUE_OTHER;
+
+    switch (*s->p) {
+    case '{':
+        *type = VALUE_OBJECT;
+        return scan_object(s, kind);
+
+    case '[':
+        *type = VALUE_ARRAY;
+        return scan_array(s, list);
+
+    case '"':
+        *type = VALUE_STRING;
+        if (scan_string(s, str, str_size, &overflow) || overflow) {
+            return -1;
+        }
+        return 0;
+
+    case 't':
+        return scan_literal(s, "true");
+
+    case 'f':
+        return scan_literal(s, "false");
+
+    case 'n':
+        return scan_literal(s, "null");
+
+    default:
+        if ((*s->p == '-') || ((*s->p >= '0') && (*s->p <= '9'))) {
+            return scan_number(s);
+        }
+
+        return -1;
+    }
+}
+
+/*!
+ * Read the fields the driver manager needs from a driver JSON config file.
+ *
+ * The file is mapped and scanned in place.  No memory is allocated, but the
+ * whole file is still validated as JSON, so a malformed file is rejected
+ * even if the values of interest precede the error.
+ *
+ * \param[in] manifest_file Path of the JSON config file.
+ *
+ * \param[out] manifest The values read from the file.
+ *
+ * \return 0 if the file is valid JSON and contains a string
+ *         "file_format_version" and an "allocator_driver" object with a
+ *         string "library_path", and the optional "match" object holds
+ *         only arrays of strings where expected.  -1 otherwise.
+ */
+int read_manifest(const char *manifest_file, manifest_t *manifest)
+{
+    int ret = -1;
+    struct stat stats;
+    void *map = MAP_FAILED;
+    scanner_t s;
+    value_type_t type;
+    int fd = open(manifest_file, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &stats) || (stats.st_size <= 0)) {
+        goto done;
+    }
+
+    map = mmap(NULL, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (map == MAP_FAILED) {
+        goto done;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.p = map;
+    s.end = s.p + stats.st_size;
+    s.manifest = manifest;
+
+    manifest->file_format_version[0] = '\0';
+    manifest->library_path[0] = '\0';
+    memset(&manifest->match, 0, sizeof(manifest->match));
+
+    skip_whitespace(&s);
+
+    if (scan_value(&s, OBJECT_ROOT, NULL, 0, &type) ||
+        (type != VALUE_OBJECT)) {
+        goto done;
+    }
+
+    /* Nothing but whitespace may follow the root object */
+    skip_whitespace(&s);
+
+    if (s.p != s.end) {
+        goto done;
+    }
+
+    if ((s.version_type != VALUE_STRING) ||
+        (s.driver_type != VALUE_OBJECT) ||
+        (s.library_path_type != VALUE_STRING)) {
+        goto done;
+    }
+
+    if (((s.match_type != VALUE_MISSING) &&
+         (s.match_type != VALUE_OBJECT)) ||
+        ((s.subsystems_type != VALUE_MISSING) &&
+         (s.subsystems_type != VALUE_ARRAY)) ||
+        ((s.kernel_drivers_type != VALUE_MISSING) &&
+         (s.kernel_drivers_type != VALUE_ARRAY))) {
+        goto done;
+    }
+
+    ret = 0;
+
+done:
+    if (map != MAP_FAILED) {
+        munmap(map, stats.st_size);
+    }
+
+    close(fd);
+
+    return ret;
+}
+
+/*!
+ * Check whether a device with the given name may match a match list.
+ *
+ * \param[in] name The subsystem or kernel driver name, or NULL if the device
+ *                 has none.
+ *
+ * \return Non-zero if the list is absent or contains <name>.
+ */
+int manifest_match_list_contains(const manifest_match_list_t *list,
+                                 const char *name)
+{
+    unsigned int i;
+
+    if (!list->present) {
+        return 1;
+    }
+
+    if (!name) {
+        return 0;
+    }
+
+    for (i = 0; i < list->num_names; i++) {
+        if (!strcmp(list->names[i], name)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_MANIFEST_H__
+#define __SRC_MANIFEST_H__
+
+#include <limits.h>
+
+/*! Longest file_format_version string accepted, including the terminator */
+#define MANIFEST_MAX_VERSION_LEN 32
+
+/*! Most names accepted in one list of a manifest's "match" object */
+#define MANIFEST_MAX_MATCH_NAMES 16
+
+/*! Longest name accepted in a "match" list, including the terminator */
+#define MANIFEST_MAX_MATCH_NAME_LEN 64
+
+/*!
+ * One list of names from an "allocator_driver" object's "match" object.
+ */
+typedef struct manifest_match_list {
+    /*!
+     * Non-zero if the list was given.  Lists that are absent, or that have
+     * more or longer names than fit here, don't restrict which devices the
+     * driver may support.
+     */
+    int present;
+
+    unsigned int num_names;
+    char names[MANIFEST_MAX_MATCH_NAMES][MANIFEST_MAX_MATCH_NAME_LEN];
+} manifest_match_list_t;
+
+/*!
+ * Description of the device nodes a driver can possibly support, used to
+ * avoid probing drivers on nodes they can't support.
+ */
+typedef struct manifest_match {
+    /*! The "subsystems" list, e.g. "drm" or "video4linux" */
+    manifest_match_list_t subsystems;
+
+    /*! The "kernel_drivers" list, e.g. "i915" or "nvidia-drm" */
+    manifest_match_list_t kernel_drivers;
+} manifest_match_t;
+
+/*!
+ * The subset of a driver JSON config file used by the driver manager.
+ *
+ * Manifests are scanned in place rather than parsed into a tree, so only the
+ * values listed here are retained.  Everything else in the file is validated
+ * and then skipped.
+ */
+typedef struct manifest {
+    /*! The top-level "file_format_version" string */
+    char file_format_version[MANIFEST_MAX_VERSION_LEN];
+
+    /*! The "allocator_driver" object's "library_path" string */
+    char library_path[PATH_MAX];
+
+    /*! The "allocator_driver" object's optional "match" object */
+    manifest_match_t match;
+} manifest_t;
+
+extern int manifest_match_list_contains(const manifest_match_list_t *list,
+                                        const char *name);
+
+extern int read_manifest(const char *manifest_file, manifest_t *manifest);
+
+#endif /* __SRC_MANIFEST_H__ */
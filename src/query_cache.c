@@ -0,0 +1,645 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+#include "device_state.h"
+#include "hash.h"
+#include "query_cache.h"
+
+/*! Size of the on-stack buffer used for the keys of typical queries */
+#define QUERY_KEY_STACK_SIZE 256
+
+typedef enum query_kind {
+    QUERY_CAPABILITIES,
+    QUERY_ASSERTION_HINTS,
+} query_kind_t;
+
+struct query_cache_entry {
+    query_kind_t kind;
+
+    /*! Hash of key[] */
+    uint64_t hash;
+
+    /*! device::query_generation when the driver was queried */
+    uint32_t generation;
+
+    /*!
+     * Non-zero if the results were returned to the application as
+     * library-owned data, in which case they can't be freed before the cache
+     * is flushed.
+     */
+    int exposed;
+
+    /*! The driver's results, capability_set_t or assertion_hint_t */
+    uint32_t num_results;
+    void *results;
+
+    struct query_cache_entry *next;
+
+    /*! Links in the cache's LRU list while in a bucket */
+    struct query_cache_entry *lru_prev;
+    struct query_cache_entry *lru_next;
+
+    size_t key_size;
+    unsigned char key[];
+};
+
+void init_query_cache(query_cache_t *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+static void free_entry(query_cache_entry_t *entry)
+{
+    if (entry->kind == QUERY_CAPABILITIES) {
+        free_capability_sets(entry->num_results, entry->results);
+    } else {
+        free_assertion_hints(entry->num_results, entry->results);
+    }
+
+    free(entry);
+}
+
+/*!
+ * Dispose of an entry that has been removed from its bucket.
+ *
+ * Must be called with the cache lock held.
+ */
+static void retire_entry(query_cache_t *cache, query_cache_entry_t *entry)
+{
+    if (entry->exposed) {
+        entry->next = cache->retired;
+        cache->retired = entry;
+    } else {
+        free_entry(entry);
+    }
+}
+
+static void lru_unlink(query_cache_t *cache, query_cache_entry_t *entry)
+{
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push(query_cache_t *cache, query_cache_entry_t *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+
+    cache->lru_head = entry;
+}
+
+/*!
+ * Remove an entry from its bucket and the LRU list, and dispose of it.
+ *
+ * Must be called with the cache lock held.
+ */
+static void remove_entry(query_cache_t *cache, query_cache_entry_t *entry)
+{
+    query_cache_entry_t **e = &cache->buckets[entry->hash %
+                                              QUERY_CACHE_BUCKETS];
+
+    while (*e != entry) {
+        e = &(*e)->next;
+    }
+
+    *e = entry->next;
+    lru_unlink(cache, entry);
+    cache->num_entries--;
+    retire_entry(cache, entry);
+}
+
+/*!
+ * Add an entry to its bucket as the most recently used one, evicting the
+ * least recently used entry if the cache is full.
+ *
+ * Must be called with the cache lock held.
+ */
+static void insert_entry(query_cache_t *cache, query_cache_entry_t *entry)
+{
+    query_cache_entry_t **e = &cache->buckets[entry->hash %
+                                              QUERY_CACHE_BUCKETS];
+
+    if (cache->num_entries >= QUERY_CACHE_MAX_ENTRIES) {
+        remove_entry(cache, cache->lru_tail);
+    }
+
+    entry->next = *e;
+    *e = entry;
+    lru_push(cache, entry);
+    cache->num_entries++;
+}
+
+/*!
+ * Find the entry for a key, disposing of the stale entries found on the way.
+ *
+ * Must be called with the cache lock held.
+ *
+ * \return The entry, or NULL if the key isn't cached for <generation>.
+ */
+static query_cache_entry_t *find_entry(query_cache_t *cache,
+                                       uint32_t generation,
+                                       uint64_t hash,
+                                       const unsigned char *key,
+                                       size_t key_size)
+{
+    query_cache_entry_t *entry = cache->buckets[hash % QUERY_CACHE_BUCKETS];
+
+    while (entry) {
+        query_cache_entry_t *next = entry->next;
+
+        if (entry->generation != generation) {
+            remove_entry(cache, entry);
+        } else if ((entry->hash == hash) &&
+                   (entry->key_size == key_size) &&
+                   !memcmp(entry->key, key, key_size)) {
+            lru_unlink(cache, entry);
+            lru_push(cache, entry);
+            return entry;
+        }
+
+        entry = next;
+    }
+
+    return NULL;
+}
+
+static void free_entries(query_cache_entry_t *entry)
+{
+    while (entry) {
+        query_cache_entry_t *next = entry->next;
+
+        free_entry(entry);
+        entry = next;
+    }
+}
+
+/*!
+ * Free every cached and retired entry.
+ *
+ * Must be called with the cache lock held.
+ */
+static void free_all_entries(query_cache_t *cache)
+{
+    uint32_t i;
+
+    for (i = 0; i < QUERY_CACHE_BUCKETS; i++) {
+        free_entries(cache->buckets[i]);
+        cache->buckets[i] = NULL;
+    }
+
+    free_entries(cache->retired);
+    cache->retired = NULL;
+    cache->lru_head = NULL;
+    cache->lru_tail = NULL;
+    cache->num_entries = 0;
+}
+
+void fini_query_cache(query_cache_t *cache)
+{
+    free_all_entries(cache);
+    pthread_mutex_destroy(&cache->lock);
+}
+
+/*!
+ * Serialize the parameters of a query into a cache key.
+ *
+ * If <d> is NULL, only compute the size of the key.  The key includes the
+ * device pointer of each usage, since the same usage means different things
+ * relative to different devices.
+ *
+ * \return The size of the key in bytes.
+ */
+static size_t build_key(unsigned char *d,
+                        query_kind_t kind,
+                        const assertion_t *assertion,
+                        uint32_t num_uses,
+                        const usage_t *uses)
+{
+    const uint32_t kind_value = kind;
+    size_t size = 0;
+    uint32_t i;
+
+#define APPEND(src, len)                        \
+    do {                                        \
+        if (d) {                                \
+            memcpy(d + size, (src), (len));     \
+        }                                       \
+        size += (len);                          \
+    } while (0)
+
+    APPEND(&kind_value, sizeof(kind_value));
+
+    if (assertion) {
+        const uint32_t has_format = assertion->format ? 1 : 0;
+        const uint32_t format = has_format ? *assertion->format : 0;
+
+        APPEND(&assertion->width, sizeof(assertion->width));
+        APPEND(&assertion->height, sizeof(assertion->height));
+        APPEND(&has_format, sizeof(has_format));
+        APPEND(&format, sizeof(format));
+    }
+
+    APPEND(&num_uses, sizeof(num_uses));
+
+    for (i = 0; i < num_uses; i++) {
+        const usage_header_t *usage = uses[i].usage;
+
+        APPEND(&uses[i].dev, sizeof(uses[i].dev));
+        APPEND(usage, sizeof(*usage) +
+               usage->length_in_words * sizeof(uint32_t));
+    }
+
+#undef APPEND
+
+    return size;
+}
+
+static int call_driver(device_t *dev,
+                       query_kind_t kind,
+                       const assertion_t *assertion,
+                       uint32_t num_uses,
+                       const usage_t *uses,
+                       uint32_t *num_results,
+                       void **results)
+{
+    if (kind == QUERY_CAPABILITIES) {
+        return dev->get_capabilities(dev, assertion, num_uses, uses,
+                                     num_results,
+                                     (capability_set_t **)results);
+    } else {
+        return dev->get_assertion_hints(dev, num_uses, uses,
+                                        num_results,
+                                        (assertion_hint_t **)results);
+    }
+}
+
+static int copy_capability_sets(uint32_t num_capability_sets,
+                                const capability_set_t *capability_sets,
+                                capability_set_t **copy)
+{
+    capability_set_t *sets;
+    uint32_t i, j;
+
+    if (!num_capability_sets) {
+        *copy = NULL;
+        return 0;
+    }
+
+    sets = calloc(num_capability_sets, sizeof(*sets));
+
+    if (!sets) {
+        return -1;
+    }
+
+    for (i = 0; i < num_capability_sets; i++) {
+        const capability_set_t *src = &capability_sets[i];
+        constraint_t *constraints;
+        capability_header_t **capabilities;
+
+        sets[i].num_constraints = src->num_constraints;
+        sets[i].constraints = constraints =
+            calloc(src->num_constraints, sizeof(*constraints));
+        capabilities = calloc(src->num_capabilities, sizeof(*capabilities));
+        sets[i].capabilities = (const capability_header_t *const *)capabilities;
+
+        if ((src->num_constraints && !constraints) ||
+            (src->num_capabilities && !capabilities)) {
+            goto fail;
+        }
+
+        memcpy(constraints, src->constraints,
+               src->num_constraints * sizeof(*constraints));
+
+        for (j = 0; j < src->num_capabilities; j++) {
+            size_t cap_size = sizeof(*src->capabilities[j]) +
+                src->capabilities[j]->common.length_in_words *
+                sizeof(uint32_t);
+
+            capabilities[j] = calloc(1, cap_size);
+
+            if (!capabilities[j]) {
+                goto fail;
+            }
+
+            memcpy(capabilities[j], src->capabilities[j], cap_size);
+            sets[i].num_capabilities++;
+        }
+    }
+
+    *copy = sets;
+
+    return 0;
+
+fail:
+    free_capability_sets(num_capability_sets, sets);
+
+    return -1;
+}
+
+static int copy_assertion_hints(uint32_t num_hints,
+                                const assertion_hint_t *hints,
+                                assertion_hint_t **copy)
+{
+    assertion_hint_t *new_hints;
+    uint32_t i;
+
+    if (!num_hints) {
+        *copy = NULL;
+        return 0;
+    }
+
+    new_hints = calloc(num_hints, sizeof(*new_hints));
+
+    if (!new_hints) {
+        return -1;
+    }
+
+    for (i = 0; i < num_hints; i++) {
+        uint32_t *formats = NULL;
+
+        if (hints[i].num_formats) {
+            formats = malloc(hints[i].num_formats * sizeof(*formats));
+
+            if (!formats) {
+                free_assertion_hints(num_hints, new_hints);
+                return -1;
+            }
+
+            memcpy(formats, hints[i].formats,
+                   hints[i].num_formats * sizeof(*formats));
+        }
+
+        /* Assertion hint members are const, so build each one in place */
+        {
+            const assertion_hint_t hint = {
+                hints[i].max_width,
+                hints[i].max_height,
+                hints[i].num_formats,
+                formats,
+                hints[i].ext
+            };
+
+            memcpy(&new_hints[i], &hint, sizeof(hint));
+        }
+    }
+
+    *copy = new_hints;
+
+    return 0;
+}
+
+static int copy_results(query_kind_t kind,
+                        uint32_t num_results,
+                        const void *results,
+                        void **copy)
+{
+    if (kind == QUERY_CAPABILITIES) {
+        return copy_capability_sets(num_results, results,
+                                    (capability_set_t **)copy);
+    } else {
+        return copy_assertion_hints(num_results, results,
+                                    (assertion_hint_t **)copy);
+    }
+}
+
+/*!
+ * Look up the results of a query, calling into the driver on a cache miss.
+ *
+ * If <copy> is non-zero, the caller receives a copy of the results it owns.
+ * Otherwise it receives the cached results themselves, which remain valid
+ * until the cache is flushed.
+ *
+ * The cache lock isn't held across the driver call, so queries that hit the
+ * cache never wait for the driver.  Concurrent identical queries may each
+ * reach the driver, in which case the first results cached are kept.
+ */
+static int lookup(device_t *dev,
+                  query_kind_t kind,
+                  const assertion_t *assertion,
+                  uint32_t num_uses,
+                  const usage_t *uses,
+                  int copy,
+                  uint32_t *num_results,
+                  void **results)
+{
+    query_cache_t *cache = &get_device_state(dev)->query_cache;
+    const uint32_t disable_flag = (kind == QUERY_CAPABILITIES) ?
+        DEVICE_QUERY_CACHE_DISABLE_CAPABILITIES :
+        DEVICE_QUERY_CACHE_DISABLE_ASSERTION_HINTS;
+    unsigned char stack_key[QUERY_KEY_STACK_SIZE];
+    unsigned char *key = stack_key;
+    query_cache_entry_t *entry = NULL;
+    query_cache_entry_t *created;
+    size_t key_size = 0;
+    uint64_t hash = 0;
+    uint32_t generation;
+    int cacheable;
+    int ret = 0;
+
+    /*
+     * Extended assertions are opaque to the library, so there's no way to
+     * tell whether two of them are equivalent.
+     */
+    cacheable = !(dev->query_cache_flags & disable_flag) &&
+        !(assertion && assertion->ext);
+
+    if (!cacheable && copy) {
+        /* The driver's results already belong to the caller */
+        return call_driver(dev, kind, assertion, num_uses, uses,
+                           num_results, results);
+    }
+
+    if (cacheable) {
+        key_size = build_key(NULL, kind, assertion, num_uses, uses);
+
+        if (key_size > sizeof(stack_key)) {
+            key = malloc(key_size);
+
+            if (!key) {
+                return -1;
+            }
+        }
+
+        build_key(key, kind, assertion, num_uses, uses);
+        hash = hash_bytes(HASH_INIT, key, key_size);
+    }
+
+    /*
+     * Read the generation before calling into the driver, so results computed
+     * while the driver invalidated its earlier ones are never considered
+     * current.
+     */
+    generation = __atomic_load_n(&dev->query_generation, __ATOMIC_ACQUIRE);
+
+    if (cacheable) {
+        pthread_mutex_lock(&cache->lock);
+        entry = find_entry(cache, generation, hash, key, key_size);
+
+        if (entry) {
+            goto found;
+        }
+
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    created = calloc(1, sizeof(*created) + key_size);
+
+    if (!created) {
+        ret = -1;
+        goto out;
+    }
+
+    ret = call_driver(dev, kind, assertion, num_uses, uses,
+                      &created->num_results, &created->results);
+
+    if (ret) {
+        free(created);
+        goto out;
+    }
+
+    created->kind = kind;
+    created->hash = hash;
+    created->generation = generation;
+    created->key_size = key_size;
+    memcpy(created->key, key, key_size);
+
+    cacheable = cacheable &&
+        (generation == __atomic_load_n(&dev->query_generation,
+                                       __ATOMIC_ACQUIRE));
+
+    if (!cacheable && copy) {
+        /* Results already stale are still an answer, but not worth caching */
+        *num_results = created->num_results;
+        *results = created->results;
+        free(created);
+        goto out;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    if (!cacheable) {
+        /* Only kept around so the results stay valid until the next flush */
+        entry = created;
+        entry->next = cache->retired;
+        cache->retired = entry;
+    } else if ((entry = find_entry(cache, generation, hash, key, key_size))) {
+        /* Another thread cached the same query meanwhile */
+        free_entry(created);
+    } else {
+        insert_entry(cache, created);
+        entry = created;
+    }
+
+found:
+    if (copy) {
+        ret = copy_results(kind, entry->num_results, entry->results, results);
+    } else {
+        entry->exposed = 1;
+        *results = entry->results;
+    }
+
+    if (!ret) {
+        *num_results = entry->num_results;
+    }
+
+    pthread_mutex_unlock(&cache->lock);
+
+out:
+    if (key != stack_key) {
+        free(key);
+    }
+
+    return ret;
+}
+
+int get_cached_capabilities(device_t *dev,
+                            const assertion_t *assertion,
+                            uint32_t num_uses,
+                            const usage_t *uses,
+                            uint32_t *num_capability_sets,
+                            capability_set_t **capability_sets)
+{
+    return lookup(dev, QUERY_CAPABILITIES, assertion, num_uses, uses, 1,
+                  num_capability_sets, (void **)capability_sets);
+}
+
+int get_cached_assertion_hints(device_t *dev,
+                               uint32_t num_uses,
+                               const usage_t *uses,
+                               uint32_t *num_hints,
+                               assertion_hint_t **hints)
+{
+    return lookup(dev, QUERY_ASSERTION_HINTS, NULL, num_uses, uses, 1,
+                  num_hints, (void **)hints);
+}
+
+int device_query_capabilities(device_t *dev,
+                              const assertion_t *assertion,
+                              uint32_t num_uses,
+                              const usage_t *uses,
+                              uint32_t *num_capability_sets,
+                              const capability_set_t **capability_sets)
+{
+    return lookup(dev, QUERY_CAPABILITIES, assertion, num_uses, uses, 0,
+                  num_capability_sets, (void **)capability_sets);
+}
+
+int device_query_assertion_hints(device_t *dev,
+                                 uint32_t num_uses,
+                                 const usage_t *uses,
+                                 uint32_t *num_hints,
+                                 const assertion_hint_t **hints)
+{
+    return lookup(dev, QUERY_ASSERTION_HINTS, NULL, num_uses, uses, 0,
+                  num_hints, (void **)hints);
+}
+
+void device_flush_query_cache(device_t *dev)
+{
+    query_cache_t *cache = &get_device_state(dev)->query_cache;
+
+    pthread_mutex_lock(&cache->lock);
+    free_all_entries(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_QUERY_CACHE_H__
+#define __SRC_QUERY_CACHE_H__
+
+#include <pthread.h>
+#include <allocator/common.h>
+
+/*! Number of hash buckets in each device's query cache */
+#define QUERY_CACHE_BUCKETS 32
+
+/*!
+ * Most entries cached per device.  The least recently used one is evicted to
+ * make room, so e.g. a window resized through many sizes can't grow the
+ * cache without bound.
+ */
+#define QUERY_CACHE_MAX_ENTRIES 64
+
+typedef struct query_cache_entry query_cache_entry_t;
+
+/*!
+ * Cache of a device's get_capabilities() and get_assertion_hints() results.
+ *
+ * Results returned by device_query_capabilities() and
+ * device_query_assertion_hints() must stay valid until the cache is flushed,
+ * so entries handed out that way are moved to the retired list instead of
+ * being freed when they go stale.
+ */
+typedef struct query_cache {
+    pthread_mutex_t lock;
+    query_cache_entry_t *buckets[QUERY_CACHE_BUCKETS];
+    query_cache_entry_t *retired;
+
+    /*! Entries in the buckets, most recently used first */
+    query_cache_entry_t *lru_head;
+    query_cache_entry_t *lru_tail;
+    uint32_t num_entries;
+} query_cache_t;
+
+extern void init_query_cache(query_cache_t *cache);
+
+extern void fini_query_cache(query_cache_t *cache);
+
+extern int get_cached_capabilities(device_t *dev,
+                                   const assertion_t *assertion,
+                                   uint32_t num_uses,
+                                   const usage_t *uses,
+                                   uint32_t *num_capability_sets,
+                                   capability_set_t **capability_sets);
+
+extern int get_cached_assertion_hints(device_t *dev,
+                                      uint32_t num_uses,
+                                      const usage_t *uses,
+                                      uint32_t *num_hints,
+                                      assertion_hint_t **hints);
+
+#endif /* __SRC_QUERY_CACHE_H__ */
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "range_set.h"
+
+/*!
+ * Non-zero if a range starting at <start> should be merged with one ending
+ * at <end>.
+ */
+static inline int ranges_touch(uint64_t end, uint64_t start)
+{
+    return (start <= end) || ((start - end) <= RANGE_SET_MERGE_GAP);
+}
+
+/*!
+ * Add a range to a set, merging it with the ranges it overlaps or nearly
+ * touches.
+ *
+ * \return 0 on success, -1 if memory allocation failed, which marks the set
+ *         as overflowed.
+ */
+int range_set_add(range_set_t *set, uint64_t offset, uint64_t size)
+{
+    uint64_t end = offset + size;
+    uint32_t lo = 0;
+    uint32_t hi = set->num_ranges;
+    uint32_t i;
+
+    if (!size || set->overflowed) {
+        return 0;
+    }
+
+    /* Find the first range that doesn't end well before this one starts */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const allocation_range_t *r = &set->ranges[mid];
+
+        if (ranges_touch(r->offset + r->size, offset)) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    for (i = lo; (i < set->num_ranges) &&
+         ranges_touch(end, set->ranges[i].offset); i++) {
+        const allocation_range_t *r = &set->ranges[i];
+
+        if (r->offset < offset) {
+            offset = r->offset;
+        }
+
+        if (r->offset + r->size > end) {
+            end = r->offset + r->size;
+        }
+    }
+
+    if (i > lo) {
+        /* Replace ranges [lo, i) with their union with the new range */
+        set->ranges[lo].offset = offset;
+        set->ranges[lo].size = end - offset;
+        memmove(&set->ranges[lo + 1], &set->ranges[i],
+                sizeof(*set->ranges) * (set->num_ranges - i));
+        set->num_ranges -= i - lo - 1;
+
+        return 0;
+    }
+
+    if (set->num_ranges == RANGE_SET_MAX_RANGES) {
+        const allocation_range_t *last = &set->ranges[set->num_ranges - 1];
+
+        if (set->ranges[0].offset < offset) {
+            offset = set->ranges[0].offset;
+        }
+
+        if (last->offset + last->size > end) {
+            end = last->offset + last->size;
+        }
+
+        set->ranges[0].offset = offset;
+        set->ranges[0].size = end - offset;
+        set->num_ranges = 1;
+
+        return 0;
+    }
+
+    if (set->num_ranges == set->max_ranges) {
+        uint32_t new_max = set->max_ranges ? set->max_ranges * 2 : 16;
+        allocation_range_t *tmp = realloc(set->ranges,
+                                          sizeof(*tmp) * new_max);
+
+        if (!tmp) {
+            set->overflowed = 1;
+            return -1;
+        }
+
+        set->ranges = tmp;
+        set->max_ranges = new_max;
+    }
+
+    memmove(&set->ranges[lo + 1], &set->ranges[lo],
+            sizeof(*set->ranges) * (set->num_ranges - lo));
+    set->ranges[lo].offset = offset;
+    set->ranges[lo].size = size;
+    set->num_ranges++;
+
+    return 0;
+}
+
+/*!
+ * Remove every range from a set, keeping its storage.
+ */
+void range_set_clear(range_set_t *set)
+{
+    set->num_ranges = 0;
+    set->overflowed = 0;
+}
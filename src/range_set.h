@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_RANGE_SET_H__
+#define __SRC_RANGE_SET_H__
+
+#include <stdint.h>
+#include <allocator/common.h>
+
+/*!
+ * Ranges closer than this many bytes are merged, since syncing the bytes
+ * between them costs less than another range.
+ */
+#define RANGE_SET_MERGE_GAP 64
+
+/*!
+ * Once a set holds this many ranges, it collapses into the one range
+ * covering them all, bounding the memory and sync overhead of scattered
+ * updates.
+ */
+#define RANGE_SET_MAX_RANGES 1024
+
+/*!
+ * Sorted, non-overlapping byte ranges.
+ */
+typedef struct range_set {
+    uint32_t num_ranges;
+    uint32_t max_ranges;
+    allocation_range_t *ranges;
+
+    /*!
+     * Set when a range couldn't be added.  The set must then be treated as
+     * covering everything until it is cleared.
+     */
+    int overflowed;
+} range_set_t;
+
+extern int range_set_add(range_set_t *set, uint64_t offset, uint64_t size);
+
+extern void range_set_clear(range_set_t *set);
+
+#endif /* __SRC_RANGE_SET_H__ */
@@ -0,0 +1,458 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <unistd.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+
+/*! Smallest block handed out, as a power of two: 256 bytes */
+#define SUBALLOCATOR_MIN_ORDER 8
+
+/*!
+ * Largest part of a backing allocation managed, as a power of two: 64 MiB.
+ * Bounds the size of the free block bitmaps.
+ */
+#define SUBALLOCATOR_MAX_ORDER 26
+
+/*!
+ * A backing allocation, managed as a binary buddy system.
+ *
+ * A free block of size 2^order at offset o is recorded as bit o >> order of
+ * free_bits[order].  Blocks are naturally aligned to their size, so every
+ * block of at least the suballocator's minimum order honors its address
+ * alignment, given the backing allocation itself does.
+ */
+typedef struct backing {
+    allocation_t *allocation;
+
+    /*! Order of the single block covering the managed part of allocation */
+    unsigned int max_order;
+
+    /*! Number of suballocations carved from this backing allocation */
+    uint32_t num_used;
+
+    uint32_t num_free[SUBALLOCATOR_MAX_ORDER + 1];
+    uint64_t *free_bits[SUBALLOCATOR_MAX_ORDER + 1];
+
+    struct backing *next;
+} backing_t;
+
+struct suballocator {
+    device_t *dev;
+
+    pthread_mutex_t lock;
+
+    /*! Used to create the backing allocations */
+    assertion_t assertion;
+    uint32_t format;
+    capability_set_t *capability_set;
+
+    /*! The capability set's constraints, or 1, 1, and 0 if absent */
+    uint64_t address_alignment;
+    uint32_t pitch_alignment;
+    uint32_t max_pitch;
+
+    /*! Order of the smallest block, at least the address alignment */
+    unsigned int min_order;
+
+    /*!
+     * max_order of the backing allocations, which all have the same size, or
+     * 0 until the first one is created
+     */
+    unsigned int backing_order;
+
+    backing_t *backings;
+};
+
+static uint64_t num_bits(const backing_t *b, unsigned int order)
+{
+    return (uint64_t)1 << (b->max_order - order);
+}
+
+static int test_bit(const uint64_t *bits, uint64_t index)
+{
+    return (bits[index / 64] >> (index % 64)) & 1;
+}
+
+static void set_bit(uint64_t *bits, uint64_t index)
+{
+    bits[index / 64] |= (uint64_t)1 << (index % 64);
+}
+
+static void clear_bit(uint64_t *bits, uint64_t index)
+{
+    bits[index / 64] &= ~((uint64_t)1 << (index % 64));
+}
+
+static void free_backing(device_t *dev, backing_t *b)
+{
+    unsigned int order;
+
+    for (order = 0; order <= SUBALLOCATOR_MAX_ORDER; order++) {
+        free(b->free_bits[order]);
+    }
+
+    device_destroy_allocation(dev, b->allocation);
+    free(b);
+}
+
+/*!
+ * Create a backing allocation with its whole managed range free.
+ *
+ * Must be called with the suballocator lock held.
+ */
+static backing_t *create_backing(suballocator_t *sa)
+{
+    backing_t *b = calloc(1, sizeof(*b));
+    unsigned int order;
+
+    if (!b) {
+        return NULL;
+    }
+
+    if (device_create_allocation(sa->dev, &sa->assertion,
+                                 sa->capability_set, &b->allocation)) {
+        free(b);
+        return NULL;
+    }
+
+    for (b->max_order = SUBALLOCATOR_MAX_ORDER;
+         (b->max_order >= sa->min_order) &&
+         (((uint64_t)1 << b->max_order) > b->allocation->size);
+         b->max_order--);
+
+    if (b->max_order < sa->min_order) {
+        goto fail;
+    }
+
+    for (order = sa->min_order; order <= b->max_order; order++) {
+        b->free_bits[order] = calloc((num_bits(b, order) + 63) / 64,
+                                     sizeof(uint64_t));
+
+        if (!b->free_bits[order]) {
+            goto fail;
+        }
+    }
+
+    set_bit(b->free_bits[b->max_order], 0);
+    b->num_free[b->max_order] = 1;
+
+    return b;
+
+fail:
+    free_backing(sa->dev, b);
+
+    return NULL;
+}
+
+/*!
+ * Take a free block of the given order, splitting a larger one if needed.
+ *
+ * \return 0 and the block's offset on success, -1 if no block is big enough.
+ */
+static int take_block(backing_t *b, unsigned int order, uint64_t *offset)
+{
+    const uint64_t *bits;
+    unsigned int o;
+    uint64_t index;
+    uint64_t i;
+
+    for (o = order; (o <= b->max_order) && !b->num_free[o]; o++);
+
+    if (o > b->max_order) {
+        return -1;
+    }
+
+    bits = b->free_bits[o];
+
+    for (i = 0; !bits[i]; i++);
+
+    index = i * 64 + __builtin_ctzll(bits[i]);
+    clear_bit(b->free_bits[o], index);
+    b->num_free[o]--;
+
+    /* Keep the lower half of each split, and free the upper half */
+    while (o > order) {
+        o--;
+        index <<= 1;
+        set_bit(b->free_bits[o], index + 1);
+        b->num_free[o]++;
+    }
+
+    *offset = index << order;
+
+    return 0;
+}
+
+/*!
+ * Free a block, merging it with its buddy for as long as the buddy is free.
+ */
+static void free_block(backing_t *b, uint64_t offset, unsigned int order)
+{
+    uint64_t index = offset >> order;
+
+    while (order < b->max_order) {
+        uint64_t buddy = index ^ 1;
+
+        if (!test_bit(b->free_bits[order], buddy)) {
+            break;
+        }
+
+        clear_bit(b->free_bits[order], buddy);
+        b->num_free[order]--;
+        index >>= 1;
+        order++;
+    }
+
+    set_bit(b->free_bits[order], index);
+    b->num_free[order]++;
+}
+
+static unsigned int order_for_size(const suballocator_t *sa, uint64_t size)
+{
+    unsigned int order = sa->min_order;
+
+    while ((order < 64) && (((uint64_t)1 << order) < size)) {
+        order++;
+    }
+
+    return order;
+}
+
+suballocator_t *device_create_suballocator(device_t *dev,
+                                           const assertion_t *assertion,
+                                           const capability_set_t *set)
+{
+    suballocator_t *sa;
+    size_t data_size;
+    void *data;
+    uint32_t i;
+    int status;
+
+    if (assertion->ext) {
+        return NULL;
+    }
+
+    sa = calloc(1, sizeof(*sa));
+
+    if (!sa) {
+        return NULL;
+    }
+
+    if (serialize_capability_set(set, &data_size, &data)) {
+        free(sa);
+        return NULL;
+    }
+
+    status = deserialize_capability_set(data_size, data,
+                                        &sa->capability_set);
+    free(data);
+
+    if (status) {
+        free(sa);
+        return NULL;
+    }
+
+    sa->dev = dev;
+    sa->assertion = *assertion;
+
+    if (assertion->format) {
+        sa->format = *assertion->format;
+        sa->assertion.format = &sa->format;
+    }
+
+    sa->address_alignment = 1;
+    sa->pitch_alignment = 1;
+
+    for (i = 0; i < set->num_constraints; i++) {
+        const constraint_t *c = &set->constraints[i];
+
+        switch (c->name) {
+        case CONSTRAINT_ADDRESS_ALIGNMENT:
+            sa->address_alignment = c->u.address_alignment.value;
+            break;
+        case CONSTRAINT_PITCH_ALIGNMENT:
+            sa->pitch_alignment = c->u.pitch_alignment.value;
+            break;
+        case CONSTRAINT_MAX_PITCH:
+            sa->max_pitch = c->u.max_pitch.value;
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* Buddy blocks can only guarantee power-of-two alignments */
+    if (!sa->address_alignment || !sa->pitch_alignment ||
+        (sa->address_alignment & (sa->address_alignment - 1))) {
+        goto fail;
+    }
+
+    for (sa->min_order = SUBALLOCATOR_MIN_ORDER;
+         ((uint64_t)1 << sa->min_order) < sa->address_alignment;
+         sa->min_order++);
+
+    if (sa->min_order > SUBALLOCATOR_MAX_ORDER) {
+        goto fail;
+    }
+
+    pthread_mutex_init(&sa->lock, NULL);
+
+    return sa;
+
+fail:
+    free_capability_sets(1, sa->capability_set);
+    free(sa);
+
+    return NULL;
+}
+
+void suballocator_destroy(suballocator_t *sa)
+{
+    while (sa->backings) {
+        backing_t *next = sa->backings->next;
+
+        free_backing(sa->dev, sa->backings);
+        sa->backings = next;
+    }
+
+    pthread_mutex_destroy(&sa->lock);
+    free_capability_sets(1, sa->capability_set);
+    free(sa);
+}
+
+int suballocator_alloc(suballocator_t *sa,
+                       uint32_t width,
+                       uint32_t height,
+                       uint32_t bytes_per_pixel,
+                       suballocation_t *suballocation)
+{
+    uint64_t pitch = (uint64_t)width * bytes_per_pixel;
+    uint64_t offset = 0;
+    unsigned int order;
+    backing_t *b;
+    int ret = -1;
+
+    pitch = (pitch + sa->pitch_alignment - 1) / sa->pitch_alignment *
+        sa->pitch_alignment;
+
+    if (!pitch || !height || (pitch > UINT32_MAX) ||
+        (sa->max_pitch && (pitch > sa->max_pitch))) {
+        return -1;
+    }
+
+    order = order_for_size(sa, pitch * height);
+
+    if (order > SUBALLOCATOR_MAX_ORDER) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&sa->lock);
+
+    /* No backing allocation, existing or new, can hold a larger block */
+    if (sa->backing_order && (order > sa->backing_order)) {
+        goto done;
+    }
+
+    for (b = sa->backings; b; b = b->next) {
+        if ((b->max_order >= order) && !take_block(b, order, &offset)) {
+            break;
+        }
+    }
+
+    if (!b) {
+        b = create_backing(sa);
+
+        if (!b) {
+            goto done;
+        }
+
+        sa->backing_order = b->max_order;
+
+        if ((b->max_order < order) || take_block(b, order, &offset)) {
+            free_backing(sa->dev, b);
+            goto done;
+        }
+
+        b->next = sa->backings;
+        sa->backings = b;
+    }
+
+    b->num_used++;
+
+    suballocation->allocation = b->allocation;
+    suballocation->offset = offset;
+    suballocation->size = pitch * height;
+    suballocation->pitch = (uint32_t)pitch;
+    suballocation->library_private = b;
+    ret = 0;
+
+done:
+    pthread_mutex_unlock(&sa->lock);
+
+    return ret;
+}
+
+void suballocator_free(suballocator_t *sa,
+                       const suballocation_t *suballocation)
+{
+    backing_t *b = suballocation->library_private;
+    backing_t **e;
+
+    pthread_mutex_lock(&sa->lock);
+
+    free_block(b, suballocation->offset,
+               order_for_size(sa, suballocation->size));
+
+    /* Release empty backing allocations, but keep one for the next request */
+    if (!--b->num_used && (sa->backings != b || b->next)) {
+        for (e = &sa->backings; *e != b; e = &(*e)->next);
+
+        *e = b->next;
+        free_backing(sa->dev, b);
+    }
+
+    pthread_mutex_unlock(&sa->lock);
+}
+
+int suballocator_export(suballocator_t *sa,
+                        const suballocation_t *suballocation,
+                        uint64_t *allocation_size,
+                        uint64_t *offset,
+                        size_t *metadata_size,
+                        void **metadata,
+                        int *fd)
+{
+    if (device_export_allocation(sa->dev, suballocation->allocation,
+                                 allocation_size, metadata_size, metadata,
+                                 fd)) {
+        return -1;
+    }
+
+    *offset = suballocation->offset;
+
+    return 0;
+}
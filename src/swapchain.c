@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <allocator/allocator.h>
+#include <allocator/driver.h>
+
+struct swapchain {
+    device_t *dev;
+
+    uint32_t num_buffers;
+    allocation_t *allocations[SWAPCHAIN_MAX_BUFFERS];
+
+    /*! Bit i is set while buffer i is available, updated atomically */
+    uint64_t available;
+
+    /*! Where the next search for an available buffer starts */
+    uint32_t next;
+};
+
+swapchain_t *device_create_swapchain(device_t *dev,
+                                     const assertion_t *assertion,
+                                     const capability_set_t *capability_set,
+                                     uint32_t num_buffers)
+{
+    swapchain_t *sc;
+
+    if (!num_buffers || (num_buffers > SWAPCHAIN_MAX_BUFFERS)) {
+        return NULL;
+    }
+
+    sc = calloc(1, sizeof(*sc));
+
+    if (!sc) {
+        return NULL;
+    }
+
+    if (device_create_allocations(dev, assertion, capability_set,
+                                  num_buffers, sc->allocations)) {
+        free(sc);
+        return NULL;
+    }
+
+    sc->dev = dev;
+    sc->num_buffers = num_buffers;
+    sc->available = (num_buffers == 64) ?
+        UINT64_MAX : ((uint64_t)1 << num_buffers) - 1;
+
+    return sc;
+}
+
+void swapchain_destroy(swapchain_t *sc)
+{
+    uint32_t i;
+
+    if (!sc) {
+        return;
+    }
+
+    for (i = 0; i < sc->num_buffers; i++) {
+        device_destroy_allocation(sc->dev, sc->allocations[i]);
+    }
+
+    free(sc);
+}
+
+uint32_t swapchain_get_num_buffers(const swapchain_t *sc)
+{
+    return sc->num_buffers;
+}
+
+allocation_t *swapchain_get_allocation(const swapchain_t *sc, uint32_t index)
+{
+    return (index < sc->num_buffers) ? sc->allocations[index] : NULL;
+}
+
+/*!
+ * Claim the first available buffer at or after the one following the last
+ * buffer acquired, wrapping around, with a compare-and-swap on the
+ * availability mask.  The acquire ordering pairs with the release ordering
+ * in swapchain_release(), so the new owner sees everything the releasing
+ * thread did before releasing the buffer.
+ */
+int swapchain_acquire_next(swapchain_t *sc, uint32_t *index)
+{
+    uint64_t available = __atomic_load_n(&sc->available, __ATOMIC_RELAXED);
+
+    while (available) {
+        uint32_t start = __atomic_load_n(&sc->next, __ATOMIC_RELAXED);
+        uint64_t after = available & (UINT64_MAX << start);
+        uint32_t i = __builtin_ctzll(after ? after : available);
+
+        if (__atomic_compare_exchange_n(&sc->available, &available,
+                                        available & ~((uint64_t)1 << i),
+                                        1, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            __atomic_store_n(&sc->next, (i + 1) % sc->num_buffers,
+                             __ATOMIC_RELAXED);
+            *index = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int swapchain_release(swapchain_t *sc, uint32_t index)
+{
+    uint64_t bit;
+
+    if (index >= sc->num_buffers) {
+        return -1;
+    }
+
+    bit = (uint64_t)1 << index;
+
+    return (__atomic_fetch_or(&sc->available, bit, __ATOMIC_RELEASE) & bit) ?
+        -1 : 0;
+}
+
+int swapchain_export(swapchain_t *sc,
+                     uint64_t *allocation_sizes,
+                     size_t *metadata_size,
+                     void **metadata,
+                     int *fds)
+{
+    return device_export_allocations(sc->dev, sc->num_buffers,
+                                     sc->allocations, allocation_sizes,
+                                     metadata_size, metadata, fds);
+}
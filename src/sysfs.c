@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <allocator/driver.h>
+#include "driver_manager.h"
+#include "sysfs.h"
+
+const char *const sysfs_subsystems[SYSFS_NUM_SUBSYSTEMS] = {
+    "drm",
+    "accel",
+    "video4linux",
+    "dma_heap",
+};
+
+const char *get_sysfs_root(void)
+{
+    const char *root = get_user_env(SYSFS_ROOT_ENV);
+
+    return root ? root : DEFAULT_SYSFS_ROOT;
+}
+
+const char *get_dev_root(void)
+{
+    const char *root = get_user_env(DEV_ROOT_ENV);
+
+    return root ? root : DEFAULT_DEV_ROOT;
+}
+
+/*!
+ * Read a small sysfs attribute into a nul-terminated buffer.
+ *
+ * \return 0 on success, -1 if the attribute can't be read.
+ */
+static int read_attribute(const char *path, char *buf, size_t buf_size)
+{
+    ssize_t len;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    len = read(fd, buf, buf_size - 1);
+    close(fd);
+
+    if (len < 0) {
+        return -1;
+    }
+
+    buf[len] = '\0';
+
+    return 0;
+}
+
+/*!
+ * Read the last component of a symlink's target, e.g. the name of the
+ * driver a device's "driver" link points to.
+ *
+ * \return 0 on success, -1 if the link can't be read or the name doesn't fit
+ *         in SYSFS_MAX_NAME_LEN bytes.
+ */
+static int read_link_name(const char *path, char *name)
+{
+    char target[PATH_MAX];
+    const char *base;
+    ssize_t len = readlink(path, target, sizeof(target) - 1);
+
+    if (len < 0) {
+        return -1;
+    }
+
+    target[len] = '\0';
+    base = strrchr(target, '/');
+    base = base ? base + 1 : target;
+
+    if (strlen(base) >= SYSFS_MAX_NAME_LEN) {
+        return -1;
+    }
+
+    strcpy(name, base);
+
+    return 0;
+}
+
+/*!
+ * Find the device node name in the contents of a uevent attribute.
+ *
+ * \return 0 if <uevent> contains a DEVNAME line, -1 otherwise.
+ */
+static int find_devname(char *uevent, const char **devname)
+{
+    char *line = uevent;
+
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+
+        if (next) {
+            *next++ = '\0';
+        }
+
+        if (!strncmp(line, "DEVNAME=", 8) && line[8]) {
+            *devname = line + 8;
+            return 0;
+        }
+
+        line = next;
+    }
+
+    return -1;
+}
+
+static int compare_nodes(const void *a, const void *b)
+{
+    return strverscmp(((const sysfs_node_t *)a)->path,
+                      ((const sysfs_node_t *)b)->path);
+}
+
+/*!
+ * Describe the device node behind one entry of a sysfs class directory.
+ *
+ * \return 0 on success, -1 if the entry isn't a device node (e.g. a DRM
+ *         connector) or memory allocation failed.
+ */
+static int read_node(const char *class_dir,
+                     const char *name,
+                     const char *dev_root,
+                     const char *subsystem,
+                     sysfs_node_t *node)
+{
+    char path[PATH_MAX];
+    char attr[512];
+    char kernel_driver[SYSFS_MAX_NAME_LEN];
+    const char *devname = name;
+    unsigned int major, minor;
+    int len;
+
+    if (snprintf(path, sizeof(path), "%s/%s/dev", class_dir, name) >=
+        (int)sizeof(path)) {
+        return -1;
+    }
+
+    if (read_attribute(path, attr, sizeof(attr)) ||
+        (sscanf(attr, "%u:%u", &major, &minor) != 2)) {
+        return -1;
+    }
+
+    if ((snprintf(path, sizeof(path), "%s/%s/uevent", class_dir, name) <
+         (int)sizeof(path)) &&
+        !read_attribute(path, attr, sizeof(attr))) {
+        find_devname(attr, &devname);
+    }
+
+    memset(node, 0, sizeof(*node));
+    node->subsystem = subsystem;
+    node->rdev = makedev(major, minor);
+
+    if ((snprintf(path, sizeof(path), "%s/%s/device/driver",
+                  class_dir, name) < (int)sizeof(path)) &&
+        !read_link_name(path, kernel_driver) &&
+        !(node->kernel_driver = strdup(kernel_driver))) {
+        return -1;
+    }
+
+    len = snprintf(NULL, 0, "%s/%s", dev_root, devname);
+    node->path = malloc(len + 1);
+
+    if (!node->path) {
+        free(node->kernel_driver);
+        return -1;
+    }
+
+    snprintf(node->path, len + 1, "%s/%s", dev_root, devname);
+
+    return 0;
+}
+
+/*!
+ * List the device nodes of every class in sysfs_subsystems[].
+ *
+ * Nodes are grouped by subsystem in sysfs_subsystems[] order, then sorted by
+ * path in natural order, so renderD129 follows renderD128 and card10
+ * follows card9.
+ *
+ * \param[in] sysfs_root Where sysfs is mounted.
+ *
+ * \param[in] dev_root The directory device nodes are created in.
+ *
+ * \return 0 on success, -1 on failure.  Missing classes are not an error.
+ */
+int scan_sysfs_nodes(const char *sysfs_root,
+                     const char *dev_root,
+                     uint32_t *num_nodes,
+                     sysfs_node_t **nodes)
+{
+    sysfs_node_t *list = NULL;
+    uint32_t count = 0;
+    uint32_t max = 0;
+    unsigned int i;
+
+    for (i = 0; i < SYSFS_NUM_SUBSYSTEMS; i++) {
+        char class_dir[PATH_MAX];
+        uint32_t first = count;
+        struct dirent *ent;
+        DIR *dir;
+
+        snprintf(class_dir, sizeof(class_dir), "%s/class/%s",
+                 sysfs_root, sysfs_subsystems[i]);
+
+        dir = opendir(class_dir);
+
+        if (!dir) {
+            continue;
+        }
+
+        while ((ent = readdir(dir))) {
+            if (ent->d_name[0] == '.') {
+                continue;
+            }
+
+            if (count == max) {
+                uint32_t new_max = max ? max * 2 : 16;
+                sysfs_node_t *tmp = realloc(list, sizeof(*list) * new_max);
+
+                if (!tmp) {
+                    closedir(dir);
+                    free_sysfs_nodes(count, list);
+                    return -1;
+                }
+
+                list = tmp;
+                max = new_max;
+            }
+
+            if (!read_node(class_dir, ent->d_name, dev_root,
+                           sysfs_subsystems[i], &list[count])) {
+                count++;
+            }
+        }
+
+        closedir(dir);
+
+        qsort(list + first, count - first, sizeof(*list), compare_nodes);
+    }
+
+    *num_nodes = count;
+    *nodes = list;
+
+    return 0;
+}
+
+void free_sysfs_nodes(uint32_t num_nodes, sysfs_node_t *nodes)
+{
+    uint32_t i;
+
+    for (i = 0; i < num_nodes; i++) {
+        free(nodes[i].path);
+        free(nodes[i].kernel_driver);
+    }
+
+    free(nodes);
+}
+
+/*!
+ * Record the identity and modification time of each scanned class directory.
+ */
+void get_sysfs_stamp(const char *sysfs_root, sysfs_stamp_t *stamp)
+{
+    unsigned int i;
+
+    memset(stamp, 0, sizeof(*stamp));
+
+    for (i = 0; i < SYSFS_NUM_SUBSYSTEMS; i++) {
+        char class_dir[PATH_MAX];
+        struct stat stats;
+
+        snprintf(class_dir, sizeof(class_dir), "%s/class/%s",
+                 sysfs_root, sysfs_subsystems[i]);
+
+        if (!stat(class_dir, &stats)) {
+            stamp->dirs[i].exists = 1;
+            stamp->dirs[i].ino = stats.st_ino;
+            stamp->dirs[i].nlink = stats.st_nlink;
+            stamp->dirs[i].size = stats.st_size;
+            stamp->dirs[i].mtime = stats.st_mtim;
+            stamp->dirs[i].ctime = stats.st_ctim;
+        }
+    }
+}
+
+/*!
+ * Look up the subsystem and kernel driver of the device node a file
+ * descriptor refers to.
+ *
+ * \param[out] subsystem Receives the subsystem name.  Must hold
+ *                       SYSFS_MAX_NAME_LEN bytes.
+ *
+ * \param[out] kernel_driver Receives the kernel driver name, or an empty
+ *                           string if no driver is bound to the device.
+ *                           Must hold SYSFS_MAX_NAME_LEN bytes.
+ *
+ * \return 0 on success, -1 if <fd> isn't a character device known to sysfs.
+ */
+int get_fd_sysfs_info(int fd, char *subsystem, char *kernel_driver)
+{
+    const char *sysfs_root = get_sysfs_root();
+    char path[PATH_MAX];
+    struct stat stats;
+
+    if (fstat(fd, &stats) || !S_ISCHR(stats.st_mode)) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/dev/char/%u:%u/subsystem", sysfs_root,
+             major(stats.st_rdev), minor(stats.st_rdev));
+
+    if (read_link_name(path, subsystem)) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/dev/char/%u:%u/device/driver",
+             sysfs_root, major(stats.st_rdev), minor(stats.st_rdev));
+
+    if (read_link_name(path, kernel_driver)) {
+        kernel_driver[0] = '\0';
+    }
+
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_SYSFS_H__
+#define __SRC_SYSFS_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+/*!
+ * Environment variable overriding the sysfs mount point, so enumeration can
+ * run against a fake sysfs tree.  It is ignored in setuid and setgid
+ * processes.
+ */
+#define SYSFS_ROOT_ENV "ALLOCATOR_SYSFS_ROOT"
+
+/*!
+ * Environment variable overriding the directory device nodes are created
+ * in.  It is ignored in setuid and setgid processes.
+ */
+#define DEV_ROOT_ENV "ALLOCATOR_DEV_ROOT"
+
+#define DEFAULT_SYSFS_ROOT "/sys"
+#define DEFAULT_DEV_ROOT "/dev"
+
+/*! Longest subsystem or kernel driver name read, including the terminator */
+#define SYSFS_MAX_NAME_LEN 64
+
+/*! Number of device classes scanned for device nodes */
+#define SYSFS_NUM_SUBSYSTEMS 4
+
+/*! The device classes scanned for device nodes */
+extern const char *const sysfs_subsystems[SYSFS_NUM_SUBSYSTEMS];
+
+/*!
+ * A device node found in sysfs.
+ */
+typedef struct sysfs_node {
+    char *path;
+    const char *subsystem;
+    char *kernel_driver;
+    dev_t rdev;
+} sysfs_node_t;
+
+/*!
+ * Identifies the state of one scanned sysfs class directory.
+ *
+ * Timestamps alone may miss changes made within one tick of a coarse
+ * filesystem clock, so the link count and size are recorded as well.
+ */
+typedef struct sysfs_dir_stamp {
+    int exists;
+    ino_t ino;
+    nlink_t nlink;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+} sysfs_dir_stamp_t;
+
+/*!
+ * Identifies the state of the scanned sysfs class directories, so changes
+ * can be detected when sysfs is a regular directory tree.
+ */
+typedef struct sysfs_stamp {
+    sysfs_dir_stamp_t dirs[SYSFS_NUM_SUBSYSTEMS];
+} sysfs_stamp_t;
+
+extern const char *get_sysfs_root(void);
+
+extern const char *get_dev_root(void);
+
+extern int scan_sysfs_nodes(const char *sysfs_root,
+                            const char *dev_root,
+                            uint32_t *num_nodes,
+                            sysfs_node_t **nodes);
+
+extern void free_sysfs_nodes(uint32_t num_nodes, sysfs_node_t *nodes);
+
+extern void get_sysfs_stamp(const char *sysfs_root, sysfs_stamp_t *stamp);
+
+extern int get_fd_sysfs_info(int fd,
+                             char *subsystem,
+                             char *kernel_driver);
+
+#endif /* __SRC_SYSFS_H__ */
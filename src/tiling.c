@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Copies between pitch linear and CAP_BASE_BLOCK_TILED planes.
+ *
+ * Either direction copies each tile as tile_height rows of tile_width
+ * pixels, with a stride of the linear pitch on one side and of the tile's
+ * row size on the other.  Whole tiles whose rows are 16, 32 or 64 bytes
+ * wide, like 4x4 and 8x8 tiles of 32-bit pixels, are copied with vector
+ * loads and stores.  Other tiles, and the partial tiles at the right and
+ * bottom edges of a surface, are copied row by row with memcpy().
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+#include <allocator/allocator.h>
+#include "cpu.h"
+
+/*!
+ * Copy <rows> rows of <row_size> bytes between buffers with the given
+ * strides.
+ */
+typedef void (*copy_block_func)(uint8_t *dst,
+                                size_t dst_stride,
+                                const uint8_t *src,
+                                size_t src_stride,
+                                uint32_t rows,
+                                size_t row_size);
+
+static void copy_block_scalar(uint8_t *dst,
+                              size_t dst_stride,
+                              const uint8_t *src,
+                              size_t src_stride,
+                              uint32_t rows,
+                              size_t row_size)
+{
+    uint32_t y;
+
+    for (y = 0; y < rows; y++) {
+        memcpy(dst + y * dst_stride, src + y * src_stride, row_size);
+    }
+}
+
+#if defined(__SSE2__)
+static void copy_block_16(uint8_t *dst,
+                          size_t dst_stride,
+                          const uint8_t *src,
+                          size_t src_stride,
+                          uint32_t rows,
+                          size_t row_size)
+{
+    uint32_t y;
+
+    for (y = 0; y < rows; y++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + y * src_stride));
+
+        _mm_storeu_si128((__m128i *)(dst + y * dst_stride), v);
+    }
+}
+#elif defined(__ARM_NEON)
+static void copy_block_16(uint8_t *dst,
+                          size_t dst_stride,
+                          const uint8_t *src,
+                          size_t src_stride,
+                          uint32_t rows,
+                          size_t row_size)
+{
+    uint32_t y;
+
+    for (y = 0; y < rows; y++) {
+        vst1q_u8(dst + y * dst_stride, vld1q_u8(src + y * src_stride));
+    }
+}
+
+static void copy_block_32(uint8_t *dst,
+                          size_t dst_stride,
+                          const uint8_t *src,
+                          size_t src_stride,
+                          uint32_t rows,
+                          size_t row_size)
+{
+    uint32_t y;
+
+    for (y = 0; y < rows; y++) {
+        const uint8_t *s = src + y * src_stride;
+        uint8_t *d = dst + y * dst_stride;
+        uint8x16_t v0 = vld1q_u8(s);
+        uint8x16_t v1 = vld1q_u8(s + 16);
+
+        vst1q_u8(d, v0);
+        vst1q_u8(d + 16, v1);
+    }
+}
+
+static void copy_block_64(uint8_t *dst,
+                          size_t dst_stride,
+                          const uint8_t *src,
+                          size_t src_stride,
+                          uint32_t rows,
+                          size_t row_size)
+{
+    uint32_t y;
+
+    for (y = 0; y < rows; y++) {
+        const uint8_t *s = src + y * src_stride;
+        uint8_t *d = dst + y * dst_stride;
+        uint8x16_t v0 = vld1q_u8(s);
+        uint8x16_t v1 = vld1q_u8(s + 16);
+        uint8x16_t v2 = vld1q_u8(s + 32);
+        uint8x16_t v3 = vld1q_u8(s + 48);
+
+        vst1q_u8(d, v0);
+        vst1q_u8(d + 16, v1);
+        vst1q_u8(d + 32, v2);
+        vst1q_u8(d + 48, v3);
+    }
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2_KERNELS 1
+
+__attribute__((target("avx2")))
+static void copy_block_32_avx2(uint8_t *dst,
+                               size_t dst_stride,
+                               const uint8_t *src,
+                               size_t src_stride,
+                               uint32_t rows,
+                               size_t row_size)
+{
+    uint32_t y;
+
+    for (y = 0; y < rows; y++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src +
+                                                         y * src_stride));
+
+        _mm256_storeu_si256((__m256i *)(dst + y * dst_stride), v);
+    }
+}
+
+__attribute__((target("avx2")))
+static void copy_block_64_avx2(uint8_t *dst,
+                               size_t dst_stride,
+                               const uint8_t *src,
+                               size_t src_stride,
+                               uint32_t rows,
+                               size_t row_size)
+{
+    uint32_t y;
+
+    for (y = 0; y < rows; y++) {
+        const __m256i *s = (const __m256i *)(src + y * src_stride);
+        __m256i *d = (__m256i *)(dst + y * dst_stride);
+        __m256i v0 = _mm256_loadu_si256(s);
+        __m256i v1 = _mm256_loadu_si256(s + 1);
+
+        _mm256_storeu_si256(d, v0);
+        _mm256_storeu_si256(d + 1, v1);
+    }
+}
+
+#endif
+
+/*!
+ * Pick the fastest way to copy whole tiles with rows of <row_size> bytes.
+ */
+static copy_block_func get_tile_copy_func(size_t row_size)
+{
+#ifdef HAVE_AVX2_KERNELS
+    if (((row_size == 32) || (row_size == 64)) && cpu_has_avx2()) {
+        return (row_size == 32) ? copy_block_32_avx2 : copy_block_64_avx2;
+    }
+#endif
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    if (row_size == 16) {
+        return copy_block_16;
+    }
+#endif
+
+#ifdef __ARM_NEON
+    if (row_size == 32) {
+        return copy_block_32;
+    }
+
+    if (row_size == 64) {
+        return copy_block_64;
+    }
+#endif
+
+    return copy_block_scalar;
+}
+
+/*!
+ * Copy between a pitch linear plane and a block tiled one.
+ *
+ * \param[in] to_tiled Non-zero to copy from <linear> to <tiled>, zero to
+ *                     copy the other way.
+ */
+static int copy_block_tiled(uint32_t tile_width,
+                            uint32_t tile_height,
+                            uint32_t bytes_per_pixel,
+                            uint32_t width,
+                            uint32_t height,
+                            uint8_t *linear,
+                            uint32_t linear_pitch,
+                            uint8_t *tiled,
+                            uint32_t tiled_pitch,
+                            int to_tiled)
+{
+    size_t tile_row_size = (size_t)tile_width * bytes_per_pixel;
+    size_t tile_size = tile_row_size * tile_height;
+    uint32_t tiles_x, tiles_y, tx, ty;
+    copy_block_func copy_tile;
+
+    if (!tile_width || !tile_height || !bytes_per_pixel) {
+        return -1;
+    }
+
+    tiles_x = (width + tile_width - 1) / tile_width;
+    tiles_y = (height + tile_height - 1) / tile_height;
+
+    if (((uint64_t)width * bytes_per_pixel > linear_pitch) ||
+        ((uint64_t)tiles_x * tile_row_size > tiled_pitch)) {
+        return -1;
+    }
+
+    copy_tile = get_tile_copy_func(tile_row_size);
+
+    for (ty = 0; ty < tiles_y; ty++) {
+        uint32_t rows = tile_height;
+        uint8_t *linear_row = linear +
+            (size_t)ty * tile_height * linear_pitch;
+        uint8_t *tiled_row = tiled + (size_t)ty * tile_height * tiled_pitch;
+
+        if ((ty + 1) * (uint64_t)tile_height > height) {
+            rows = height - ty * tile_height;
+        }
+
+        for (tx = 0; tx < tiles_x; tx++) {
+            uint8_t *l = linear_row + tx * tile_row_size;
+            uint8_t *t = tiled_row + tx * tile_size;
+            copy_block_func copy = copy_tile;
+            size_t row_size = tile_row_size;
+
+            /* Partial tiles at the edges of the surface */
+            if ((tx + 1) * (uint64_t)tile_width > width) {
+                row_size = (size_t)(width - tx * tile_width) *
+                    bytes_per_pixel;
+                copy = copy_block_scalar;
+            } else if (rows < tile_height) {
+                copy = copy_block_scalar;
+            }
+
+            if (to_tiled) {
+                copy(t, tile_row_size, l, linear_pitch, rows, row_size);
+            } else {
+                copy(l, linear_pitch, t, tile_row_size, rows, row_size);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int copy_to_block_tiled(uint32_t tile_width,
+                        uint32_t tile_height,
+                        uint32_t bytes_per_pixel,
+                        uint32_t width,
+                        uint32_t height,
+                        const void *linear,
+                        uint32_t linear_pitch,
+                        void *tiled,
+                        uint32_t tiled_pitch)
+{
+    return copy_block_tiled(tile_width, tile_height, bytes_per_pixel,
+                            width, height, (uint8_t *)linear, linear_pitch,
+                            tiled, tiled_pitch, 1);
+}
+
+int copy_from_block_tiled(uint32_t tile_width,
+                          uint32_t tile_height,
+                          uint32_t bytes_per_pixel,
+                          uint32_t width,
+                          uint32_t height,
+                          const void *tiled,
+                          uint32_t tiled_pitch,
+                          void *linear,
+                          uint32_t linear_pitch)
+{
+    return copy_block_tiled(tile_width, tile_height, bytes_per_pixel,
+                            width, height, linear, linear_pitch,
+                            (uint8_t *)tiled, tiled_pitch, 0);
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <allocator/allocator.h>
+#include "timing.h"
+
+int timing_enabled = 0;
+
+static pthread_once_t timing_once = PTHREAD_ONCE_INIT;
+
+/*! Protects the record list */
+static pthread_mutex_t timing_lock = PTHREAD_MUTEX_INITIALIZER;
+static timing_record_t *records = NULL;
+static uint32_t num_records = 0;
+static uint32_t max_records = 0;
+
+static const char *const phase_names[] = {
+    "directory scan",   /* TIMING_PHASE_DIRECTORY_SCAN */
+    "manifest parse",   /* TIMING_PHASE_MANIFEST_PARSE */
+    "dlopen",           /* TIMING_PHASE_DLOPEN */
+    "driver init",      /* TIMING_PHASE_DRIVER_INIT */
+    "fd probe",         /* TIMING_PHASE_FD_PROBE */
+};
+
+#define NUM_PHASES (sizeof(phase_names) / sizeof(phase_names[0]))
+
+/*!
+ * Check whether a comma-separated option list contains an option.
+ */
+static int has_debug_option(const char *options, const char *option)
+{
+    size_t option_len = strlen(option);
+
+    while (*options) {
+        size_t len = strcspn(options, ",");
+
+        if ((len == option_len) && !strncmp(options, option, len)) {
+            return 1;
+        }
+
+        options += len;
+
+        if (*options == ',') {
+            options++;
+        }
+    }
+
+    return 0;
+}
+
+static void print_timing_summary(void)
+{
+    uint64_t totals[NUM_PHASES] = { 0 };
+    uint32_t counts[NUM_PHASES] = { 0 };
+    uint64_t first_start;
+    uint32_t i;
+
+    pthread_mutex_lock(&timing_lock);
+
+    fprintf(stderr, "liballocator: timing summary\n");
+
+    first_start = num_records ? records[0].start_ns : 0;
+
+    for (i = 0; i < num_records; i++) {
+        const timing_record_t *r = &records[i];
+
+        fprintf(stderr, "  +%10.3f ms %10.3f ms  %-14s %s%s\n",
+                (r->start_ns - first_start) / 1e6,
+                r->duration_ns / 1e6,
+                phase_names[r->phase],
+                r->subject ? r->subject : "",
+                r->result ? " (failed)" : "");
+
+        totals[r->phase] += r->duration_ns;
+        counts[r->phase]++;
+    }
+
+    fprintf(stderr, "  totals:\n");
+
+    for (i = 0; i < NUM_PHASES; i++) {
+        fprintf(stderr, "    %-14s %10.3f ms in %u call%s\n",
+                phase_names[i], totals[i] / 1e6, counts[i],
+                counts[i] == 1 ? "" : "s");
+    }
+
+    pthread_mutex_unlock(&timing_lock);
+}
+
+static void do_init_timing(void)
+{
+    const char *options = getenv("ALLOCATOR_DEBUG");
+
+    if (options && has_debug_option(options, "timing")) {
+        timing_enabled = 1;
+        atexit(print_timing_summary);
+    }
+}
+
+/*!
+ * Enable timing records if ALLOCATOR_DEBUG contains "timing".
+ *
+ * This must run before the first phase worth timing.  Calling it again has
+ * no effect.
+ */
+void init_timing(void)
+{
+    pthread_once(&timing_once, do_init_timing);
+}
+
+/*!
+ * Read the monotonic clock, in nanoseconds.
+ */
+uint64_t timing_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*!
+ * Append a record for a phase that started at <start_ns> and ends now.
+ *
+ * Use the TIMING_END() macro rather than calling this directly, so nothing
+ * is evaluated when timing is disabled.  Records that can't be stored due to
+ * memory allocation failures are dropped.
+ */
+void record_timing(uint32_t phase,
+                   uint64_t start_ns,
+                   const char *subject,
+                   int result)
+{
+    uint64_t end_ns = timing_now();
+    timing_record_t *r;
+
+    pthread_mutex_lock(&timing_lock);
+
+    if (num_records == max_records) {
+        uint32_t new_max = max_records ? max_records * 2 : 64;
+        timing_record_t *tmp = realloc(records, sizeof(*records) * new_max);
+
+        if (!tmp) {
+            goto done;
+        }
+
+        records = tmp;
+        max_records = new_max;
+    }
+
+    r = &records[num_records++];
+    r->phase = phase;
+    r->result = result;
+    r->start_ns = start_ns;
+    r->duration_ns = end_ns - start_ns;
+    r->subject = subject ? strdup(subject) : NULL;
+
+done:
+    pthread_mutex_unlock(&timing_lock);
+}
+
+int get_timing_records(uint32_t *num_timing_records,
+                       timing_record_t **timing_records)
+{
+    timing_record_t *copy = NULL;
+    uint32_t i;
+    int ret = 0;
+
+    init_timing();
+
+    pthread_mutex_lock(&timing_lock);
+
+    if (num_records) {
+        copy = calloc(num_records, sizeof(*copy));
+
+        if (!copy) {
+            ret = -1;
+            goto done;
+        }
+
+        for (i = 0; i < num_records; i++) {
+            copy[i] = records[i];
+
+            if (records[i].subject) {
+                copy[i].subject = strdup(records[i].subject);
+
+                if (!copy[i].subject) {
+                    free_timing_records(i, copy);
+                    ret = -1;
+                    goto done;
+                }
+            }
+        }
+    }
+
+    *num_timing_records = num_records;
+    *timing_records = copy;
+
+done:
+    pthread_mutex_unlock(&timing_lock);
+
+    return ret;
+}
+
+void free_timing_records(uint32_t num_timing_records,
+                         timing_record_t *timing_records)
+{
+    uint32_t i;
+
+    if (timing_records) {
+        for (i = 0; i < num_timing_records; i++) {
+            free((void *)timing_records[i].subject);
+        }
+
+        free(timing_records);
+    }
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_TIMING_H__
+#define __SRC_TIMING_H__
+
+#include <stdint.h>
+
+/*! Non-zero if ALLOCATOR_DEBUG requested timing records */
+extern int timing_enabled;
+
+extern void init_timing(void);
+
+extern uint64_t timing_now(void);
+
+extern void record_timing(uint32_t phase,
+                          uint64_t start_ns,
+                          const char *subject,
+                          int result);
+
+/*!
+ * Start timing a phase.  Evaluates to 0 without reading the clock when
+ * timing is disabled.
+ */
+#define TIMING_BEGIN() (timing_enabled ? timing_now() : 0)
+
+/*!
+ * Record a phase started with TIMING_BEGIN().  Does nothing, and doesn't
+ * evaluate <subject>, when timing is disabled.
+ */
+#define TIMING_END(phase, start_ns, subject, result)                    \
+    do {                                                                \
+        if (timing_enabled) {                                           \
+            record_timing((phase), (start_ns), (subject), (result));    \
+        }                                                               \
+    } while (0)
+
+#endif /* __SRC_TIMING_H__ */
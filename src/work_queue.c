@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include "work_queue.h"
+
+/*!
+ * A queued call to func(arg).
+ */
+typedef struct work_item {
+    work_func_t func;
+    void *arg;
+
+    /*! The batch the task belongs to, if any, so its waiter can run it */
+    work_batch_t *batch;
+
+    struct work_item *next;
+} work_item_t;
+
+/*! Protects all of the work queue state */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*! Signaled when work is queued */
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+static work_item_t *queue_head = NULL;
+static work_item_t **queue_tail = &queue_head;
+static unsigned int num_queued = 0;
+
+static unsigned int num_threads = 0;
+static unsigned int num_idle = 0;
+
+static pthread_once_t fork_handlers_once = PTHREAD_ONCE_INIT;
+
+void init_work_batch(work_batch_t *batch, unsigned int num_tasks)
+{
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->done, NULL);
+    batch->pending = num_tasks;
+}
+
+void fini_work_batch(work_batch_t *batch)
+{
+    pthread_cond_destroy(&batch->done);
+    pthread_mutex_destroy(&batch->lock);
+}
+
+/*!
+ * Mark one task of a batch as done.
+ */
+void complete_work_batch(work_batch_t *batch)
+{
+    pthread_mutex_lock(&batch->lock);
+
+    if (--batch->pending == 0) {
+        pthread_cond_broadcast(&batch->done);
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/*!
+ * Remove the first queued task of a batch.
+ *
+ * Must be called with queue_lock held.
+ */
+static work_item_t *dequeue_batch_item(work_batch_t *batch)
+{
+    work_item_t **i;
+
+    for (i = &queue_head; *i; i = &(*i)->next) {
+        if ((*i)->batch == batch) {
+            work_item_t *item = *i;
+
+            *i = item->next;
+
+            if (queue_tail == &item->next) {
+                queue_tail = i;
+            }
+
+            num_queued--;
+
+            return item;
+        }
+    }
+
+    return NULL;
+}
+
+/*!
+ * Wait for every task of a batch to complete.
+ *
+ * Tasks of the batch still in the queue are run on the calling thread rather
+ * than waiting for a worker.  This keeps a batch from stalling behind
+ * unrelated work, and from deadlocking when it is waited for on a worker
+ * thread.
+ */
+void wait_work_batch(work_batch_t *batch)
+{
+    work_item_t *item;
+
+    pthread_mutex_lock(&queue_lock);
+
+    while ((item = dequeue_batch_item(batch))) {
+        pthread_mutex_unlock(&queue_lock);
+
+        item->func(item->arg);
+        free(item);
+
+        pthread_mutex_lock(&queue_lock);
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    pthread_mutex_lock(&batch->lock);
+
+    while (batch->pending > 0) {
+        pthread_cond_wait(&batch->done, &batch->lock);
+    }
+
+    pthread_mutex_unlock(&batch->lock);
+}
+
+static void *worker_main(void *unused)
+{
+    pthread_mutex_lock(&queue_lock);
+
+    while (1) {
+        work_item_t *item;
+
+        while (!queue_head) {
+            num_idle++;
+            pthread_cond_wait(&queue_cond, &queue_lock);
+            num_idle--;
+        }
+
+        item = queue_head;
+        queue_head = item->next;
+
+        if (!queue_head) {
+            queue_tail = &queue_head;
+        }
+
+        num_queued--;
+
+        pthread_mutex_unlock(&queue_lock);
+
+        item->func(item->arg);
+        free(item);
+
+        pthread_mutex_lock(&queue_lock);
+    }
+
+    return NULL;
+}
+
+static void prepare_fork(void)
+{
+    pthread_mutex_lock(&queue_lock);
+}
+
+static void parent_fork(void)
+{
+    pthread_mutex_unlock(&queue_lock);
+}
+
+/*!
+ * A forked child has none of the parent's workers, so the next task queued
+ * starts new ones.  Tasks still queued are kept for them to run.
+ */
+static void child_fork(void)
+{
+    num_threads = 0;
+    num_idle = 0;
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void register_fork_handlers(void)
+{
+    pthread_atfork(prepare_fork, parent_fork, child_fork);
+}
+
+/*!
+ * Start another worker thread.
+ *
+ * Workers block all signals, which are meant for the application's threads.
+ * They are detached and live as long as the process.
+ *
+ * Must be called with queue_lock held.
+ */
+static int start_worker(void)
+{
+    sigset_t all_signals, old_signals;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int ret;
+
+    if (pthread_attr_init(&attr)) {
+        return -1;
+    }
+
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+    ret = pthread_create(&thread, &attr, worker_main, NULL) ? -1 : 0;
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    pthread_attr_destroy(&attr);
+
+    if (ret == 0) {
+        num_threads++;
+    }
+
+    return ret;
+}
+
+/*!
+ * Run func(arg) on a worker thread.
+ *
+ * A worker is started whenever no idle one is available, up to
+ * WORK_QUEUE_MAX_THREADS.  Tasks mostly wait on drivers and the kernel
+ * rather than use the CPU, so the number of CPUs doesn't limit the number of
+ * workers.
+ *
+ * \param[in] batch The batch the task belongs to, or NULL.  The task itself
+ *                  must call complete_work_batch() on it.
+ *
+ * \return 0 if the task was queued.  -1 if it wasn't, in which case the
+ *         caller should run it some other way.
+ */
+int queue_work(work_batch_t *batch, work_func_t func, void *arg)
+{
+    work_item_t *item = malloc(sizeof(*item));
+
+    if (!item) {
+        return -1;
+    }
+
+    pthread_once(&fork_handlers_once, register_fork_handlers);
+
+    item->func = func;
+    item->arg = arg;
+    item->batch = batch;
+    item->next = NULL;
+
+    pthread_mutex_lock(&queue_lock);
+
+    if ((num_queued >= num_idle) && (num_threads < WORK_QUEUE_MAX_THREADS) &&
+        start_worker() && (num_threads == 0)) {
+        /* No thread will ever run the task */
+        pthread_mutex_unlock(&queue_lock);
+        free(item);
+        return -1;
+    }
+
+    *queue_tail = item;
+    queue_tail = &item->next;
+    num_queued++;
+
+    pthread_cond_signal(&queue_cond);
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return 0;
+}
+
+/*!
+ * Remove a queued call to func(arg) that hasn't started yet.
+ *
+ * \return 0 if the call was removed and will never run, -1 if it wasn't
+ *         queued, e.g. because a worker already took it.
+ */
+int cancel_work(work_func_t func, void *arg)
+{
+    work_item_t **i;
+
+    pthread_mutex_lock(&queue_lock);
+
+    for (i = &queue_head; *i; i = &(*i)->next) {
+        if (((*i)->func == func) && ((*i)->arg == arg)) {
+            work_item_t *item = *i;
+
+            *i = item->next;
+
+            if (queue_tail == &item->next) {
+                queue_tail = i;
+            }
+
+            num_queued--;
+            pthread_mutex_unlock(&queue_lock);
+            free(item);
+
+            return 0;
+        }
+    }
+
+    pthread_mutex_unlock(&queue_lock);
+
+    return -1;
+}
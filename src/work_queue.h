@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __SRC_WORK_QUEUE_H__
+#define __SRC_WORK_QUEUE_H__
+
+#include <pthread.h>
+
+/*! Most worker threads the library starts */
+#define WORK_QUEUE_MAX_THREADS 16
+
+typedef void (*work_func_t)(void *arg);
+
+/*!
+ * A set of tasks a thread waits for together.
+ *
+ * Each task must call complete_work_batch() once it's done, whether it ran
+ * on a worker thread, on a caller-supplied executor, or inline.
+ */
+typedef struct work_batch {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    unsigned int pending;
+} work_batch_t;
+
+extern void init_work_batch(work_batch_t *batch, unsigned int num_tasks);
+
+extern void fini_work_batch(work_batch_t *batch);
+
+extern void complete_work_batch(work_batch_t *batch);
+
+extern void wait_work_batch(work_batch_t *batch);
+
+extern int queue_work(work_batch_t *batch, work_func_t func, void *arg);
+
+extern int cancel_work(work_func_t func, void *arg);
+
+#endif /* __SRC_WORK_QUEUE_H__ */
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Measures how much reporting damage saves when a small part of a large
+ * surface is updated through a CPU mapping, by timing map/write/unmap
+ * cycles with and without damage rectangles.  By default the software
+ * driver is asked to emulate a device that doesn't snoop CPU caches, so
+ * every synced byte costs a cache flush.
+ */
+
+/* For getopt_long */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <allocator/allocator.h>
+
+#include "test_utils.h"
+
+#define SURFACE_WIDTH 3840
+#define SURFACE_HEIGHT 2160
+#define NUM_RECTS 4
+#define RECT_SIZE 64
+
+static void usage(void)
+{
+    printf("\nUsage: bench_dirty_ranges [-d|--device] DEVICE_FILE_NAME "
+           "[-i|--iterations] COUNT\n");
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*!
+ * Time <iterations> cycles of mapping an allocation, writing a few small
+ * rectangles, and unmapping it.
+ *
+ * \return Nanoseconds per cycle.
+ */
+static uint64_t run_cycles(device_t *dev,
+                           allocation_t *allocation,
+                           const layout_t *layout,
+                           uint32_t iterations,
+                           int damage)
+{
+    allocation_rect_t rects[NUM_RECTS];
+    uint64_t start;
+    uint32_t i, j, y;
+
+    start = now_ns();
+
+    for (i = 0; i < iterations; i++) {
+        unsigned char *ptr;
+
+        if (device_map_allocation(dev, allocation, ALLOCATION_MAP_WRITE,
+                                  (void **)&ptr)) {
+            FAIL("Couldn't map the allocation\n");
+        }
+
+        /* Rectangles spread over the surface, like a cursor or a clock */
+        for (j = 0; j < NUM_RECTS; j++) {
+            rects[j].x = (j * 997 + i * 13) % (SURFACE_WIDTH - RECT_SIZE);
+            rects[j].y = (j * 541 + i * 7) % (SURFACE_HEIGHT - RECT_SIZE);
+            rects[j].width = RECT_SIZE;
+            rects[j].height = RECT_SIZE;
+
+            for (y = 0; y < RECT_SIZE; y++) {
+                memset(ptr + layout->planes[0].offset +
+                       (uint64_t)(rects[j].y + y) * layout->planes[0].pitch +
+                       rects[j].x * 4, i & 0xff, RECT_SIZE * 4);
+            }
+        }
+
+        if (damage &&
+            device_damage_allocation_rects(dev, allocation, 0, NUM_RECTS,
+                                           rects)) {
+            FAIL("Couldn't report damage\n");
+        }
+
+        device_unmap_allocation(dev, allocation, ALLOCATION_MAP_WRITE);
+    }
+
+    return (now_ns() - start) / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {"iterations", required_argument, NULL, 'i'},
+        {NULL, 0, NULL, 0}
+    };
+
+    static const uint32_t format = 0x34325241; /* DRM_FORMAT_ARGB8888 */
+
+    static assertion_t assertion = {
+        SURFACE_WIDTH,  /* width */
+        SURFACE_HEIGHT, /* height */
+        &format,        /* format */
+        NULL            /* ext */
+    };
+
+    static usage_texture_t texture_usage = {
+        { /* header */
+            VENDOR_BASE,                            /* usage vendor */
+            USAGE_BASE_TEXTURE,                     /* usage name */
+            USAGE_LENGTH_IN_WORDS(usage_texture_t)  /* length_in_word */
+        }
+    };
+
+    static usage_t uses = {
+        NULL,                   /* dev, overidden below */
+        &texture_usage.header   /* usage */
+    };
+
+    uint32_t num_capability_sets;
+    capability_set_t *capability_sets;
+    uint32_t iterations = 200;
+    const char *dev_file_name = "/dev/zero";
+    allocation_t *allocation;
+    layout_t layout;
+    uint64_t whole_ns, damage_ns;
+    device_t *dev;
+    int dev_fd;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "d:i:", long_options,
+                              NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_file_name = optarg;
+            break;
+
+        case 'i':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+
+        case '?':
+            usage();
+            exit(1);
+
+        default:
+            FAIL("Invalid option\n");
+            break;
+        }
+    }
+
+    if (!iterations) {
+        usage();
+        exit(1);
+    }
+
+    /* Must be set before the device is created; an explicit 0 is kept */
+    setenv("ALLOCATOR_SOFTWARE_NONCOHERENT", "1", 0);
+
+    dev_fd = open(dev_file_name, O_RDWR);
+
+    if (dev_fd < 0) {
+        FAIL("Couldn't open device file %s\n", dev_file_name);
+    }
+
+    dev = device_create(dev_fd);
+
+    if (!dev) {
+        FAIL("Couldn't create allocator device from device FD\n");
+    }
+
+    uses.dev = dev;
+
+    if (device_get_capabilities(dev, &assertion, 1, &uses,
+                                &num_capability_sets, &capability_sets) ||
+        !num_capability_sets) {
+        FAIL("Couldn't get capabilities from device %s\n", dev_file_name);
+    }
+
+    if (device_plan_layout(dev, &assertion, &capability_sets[0], &layout)) {
+        FAIL("The device's surfaces aren't pitch linear\n");
+    }
+
+    if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                 &allocation)) {
+        FAIL("Couldn't create an allocation\n");
+    }
+
+    /* Warm up the mapping and the page tables */
+    run_cycles(dev, allocation, &layout, 1, 0);
+
+    whole_ns = run_cycles(dev, allocation, &layout, iterations, 0);
+    damage_ns = run_cycles(dev, allocation, &layout, iterations, 1);
+
+    printf("%ux%u, %u %ux%u rectangles per update, %u updates\n",
+           assertion.width, assertion.height, NUM_RECTS, RECT_SIZE, RECT_SIZE,
+           iterations);
+    printf("  whole allocation synced: %10llu ns/update\n",
+           (unsigned long long)whole_ns);
+    printf("  damage synced:           %10llu ns/update\n",
+           (unsigned long long)damage_ns);
+
+    device_destroy_allocation(dev, allocation);
+    free_capability_sets(num_capability_sets, capability_sets);
+    device_destroy(dev);
+    close(dev_fd);
+
+    return 0;
+}
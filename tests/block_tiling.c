@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* For getopt_long */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <allocator/allocator.h>
+
+#include "test_utils.h"
+
+static void usage(void)
+{
+    printf("\nUsage: block_tiling [[-d|--device] DEVICE_FILE_NAME]\n");
+}
+
+/*!
+ * Where pixel (x, y) of a block tiled plane is, per CAP_BASE_BLOCK_TILED.
+ */
+static size_t tiled_offset(uint32_t tile_width,
+                           uint32_t tile_height,
+                           uint32_t bpp,
+                           uint32_t pitch,
+                           uint32_t x,
+                           uint32_t y)
+{
+    size_t tile_size = (size_t)tile_width * tile_height * bpp;
+
+    return (size_t)(y / tile_height) * tile_height * pitch +
+        (size_t)(x / tile_width) * tile_size +
+        (size_t)(y % tile_height) * tile_width * bpp +
+        (size_t)(x % tile_width) * bpp;
+}
+
+/*!
+ * Tile and detile a patterned surface, checking every pixel lands where the
+ * capability says it should and that padding is left alone.
+ */
+static void check_round_trip(uint32_t tile_width,
+                             uint32_t tile_height,
+                             uint32_t bpp,
+                             uint32_t width,
+                             uint32_t height)
+{
+    uint32_t tiles_x = (width + tile_width - 1) / tile_width;
+    uint32_t tiles_y = (height + tile_height - 1) / tile_height;
+    uint32_t linear_pitch = width * bpp + 3;
+    uint32_t tiled_pitch = tiles_x * tile_width * bpp + 64;
+    size_t linear_size = (size_t)linear_pitch * height;
+    size_t tiled_size = (size_t)tiled_pitch * tiles_y * tile_height;
+    unsigned char *linear = malloc(linear_size);
+    unsigned char *tiled = malloc(tiled_size);
+    unsigned char *expected = malloc(tiled_size);
+    unsigned char *result = calloc(1, linear_size);
+    uint32_t x, y;
+    size_t i;
+
+    if (!linear || !tiled || !expected || !result) {
+        FAIL("Couldn't allocate test surfaces\n");
+    }
+
+    for (i = 0; i < linear_size; i++) {
+        linear[i] = (unsigned char)(i * 7 + i / 251);
+    }
+
+    memset(tiled, 0xee, tiled_size);
+    memset(expected, 0xee, tiled_size);
+
+    if (copy_to_block_tiled(tile_width, tile_height, bpp, width, height,
+                            linear, linear_pitch, tiled, tiled_pitch)) {
+        FAIL("Couldn't tile a %ux%u surface of %u-byte pixels into %ux%u "
+             "tiles\n", width, height, bpp, tile_width, tile_height);
+    }
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            memcpy(&expected[tiled_offset(tile_width, tile_height, bpp,
+                                          tiled_pitch, x, y)],
+                   &linear[(size_t)y * linear_pitch + x * bpp], bpp);
+        }
+    }
+
+    /* Padding must be left untouched */
+    if (memcmp(tiled, expected, tiled_size)) {
+        FAIL("A %ux%u surface of %u-byte pixels was misplaced in %ux%u "
+             "tiles\n", width, height, bpp, tile_width, tile_height);
+    }
+
+    if (copy_from_block_tiled(tile_width, tile_height, bpp, width, height,
+                              tiled, tiled_pitch, result, linear_pitch)) {
+        FAIL("Couldn't detile a surface\n");
+    }
+
+    for (y = 0; y < height; y++) {
+        if (memcmp(&result[(size_t)y * linear_pitch],
+                   &linear[(size_t)y * linear_pitch], (size_t)width * bpp)) {
+            FAIL("Row %u of a %ux%u surface changed in a round trip through "
+                 "%ux%u tiles of %u-byte pixels\n", y, width, height,
+                 tile_width, tile_height, bpp);
+        }
+    }
+
+    free(result);
+    free(expected);
+    free(tiled);
+    free(linear);
+}
+
+static void check_kernels(void)
+{
+    static const uint32_t tiles[][2] = {
+        { 4, 4 }, { 8, 8 }, { 16, 4 }, { 3, 5 }, { 1, 1 }
+    };
+    static const uint32_t bpps[] = { 1, 2, 4, 8 };
+    static const uint32_t sizes[][2] = {
+        { 1, 1 }, { 64, 64 }, { 37, 29 }, { 130, 3 }
+    };
+    unsigned char buf[64];
+    uint32_t t, b, s;
+
+    for (t = 0; t < sizeof(tiles) / sizeof(tiles[0]); t++) {
+        for (b = 0; b < sizeof(bpps) / sizeof(bpps[0]); b++) {
+            for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+                check_round_trip(tiles[t][0], tiles[t][1], bpps[b],
+                                 sizes[s][0], sizes[s][1]);
+            }
+        }
+    }
+
+    /* Tiled rows must hold whole tiles */
+    if (!copy_to_block_tiled(8, 8, 4, 9, 8, buf, 36, buf, 32) ||
+        !copy_to_block_tiled(0, 8, 4, 8, 8, buf, 32, buf, 32)) {
+        FAIL("Invalid tiling parameters were accepted\n");
+    }
+}
+
+/*!
+ * Check that the device offers block tiled surfaces where it should, and
+ * that they survive being written and read back through a mapping.
+ */
+static void check_device(const char *dev_file_name)
+{
+    static const uint32_t format = 0x34325241; /* DRM_FORMAT_ARGB8888 */
+
+    static assertion_t assertion = {
+        100,            /* width */
+        50,             /* height */
+        &format,        /* format */
+        NULL            /* ext */
+    };
+
+    static usage_texture_t texture_usage = {
+        { /* header */
+            VENDOR_BASE,                            /* usage vendor */
+            USAGE_BASE_TEXTURE,                     /* usage name */
+            USAGE_LENGTH_IN_WORDS(usage_texture_t)  /* length_in_word */
+        }
+    };
+
+    static usage_display_t display_usage = {
+        { /* header */
+            VENDOR_BASE,                            /* usage vendor */
+            USAGE_BASE_DISPLAY,                     /* usage name */
+            USAGE_LENGTH_IN_WORDS(usage_display_t)  /* length_in_word */
+        },
+        USAGE_BASE_DISPLAY_ROTATION_0               /* rotation_types */
+    };
+
+    uint32_t num_texture_sets, num_display_sets, num_derived_sets;
+    capability_set_t *texture_sets, *display_sets, *derived_sets;
+    const capability_block_tiled_t *tiling = NULL;
+    const capability_set_t *tiled_set = NULL;
+    int display_tiled = 0;
+    allocation_t *allocation;
+    unsigned char *linear, *result;
+    layout_t layout;
+    usage_t uses;
+    device_t *dev;
+    void *mapped;
+    int dev_fd;
+    uint32_t i;
+
+    dev_fd = open(dev_file_name, O_RDWR);
+
+    if (dev_fd < 0) {
+        FAIL("Couldn't open device file %s\n", dev_file_name);
+    }
+
+    dev = device_create(dev_fd);
+
+    if (!dev) {
+        FAIL("Couldn't create allocator device from device FD\n");
+    }
+
+    uses.dev = dev;
+    uses.usage = &texture_usage.header;
+
+    if (device_get_capabilities(dev, &assertion, 1, &uses,
+                                &num_texture_sets, &texture_sets)) {
+        FAIL("Couldn't get texture capabilities\n");
+    }
+
+    for (i = 0; i < num_texture_sets; i++) {
+        const capability_header_t *cap =
+            find_capability(&texture_sets[i], VENDOR_BASE,
+                            CAP_BASE_BLOCK_TILED);
+
+        if (cap) {
+            tiled_set = &texture_sets[i];
+            tiling = (const capability_block_tiled_t *)cap;
+        }
+    }
+
+    if (!tiled_set) {
+        printf("Device %s offers no block tiled surfaces\n", dev_file_name);
+        goto done;
+    }
+
+    uses.usage = &display_usage.header;
+
+    if (device_get_capabilities(dev, &assertion, 1, &uses,
+                                &num_display_sets, &display_sets)) {
+        FAIL("Couldn't get display capabilities\n");
+    }
+
+    /* Tiled sets can't combine with sets that only allow linear surfaces */
+    if (derive_capabilities(num_texture_sets, texture_sets,
+                            num_display_sets, display_sets,
+                            &num_derived_sets, &derived_sets)) {
+        FAIL("Couldn't derive texture and display capabilities\n");
+    }
+
+    for (i = 0; i < num_display_sets; i++) {
+        if (find_capability(&display_sets[i], VENDOR_BASE,
+                            CAP_BASE_BLOCK_TILED)) {
+            display_tiled = 1;
+        }
+    }
+
+    for (i = 0; i < num_derived_sets; i++) {
+        if (!display_tiled &&
+            find_capability(&derived_sets[i], VENDOR_BASE,
+                            CAP_BASE_BLOCK_TILED)) {
+            FAIL("A block tiled set survived intersection with display "
+                 "sets that have none\n");
+        }
+    }
+
+    free_capability_sets(num_derived_sets, derived_sets);
+    free_capability_sets(num_display_sets, display_sets);
+
+    /* Planes are padded to whole tiles */
+    if (device_plan_layout(dev, &assertion, tiled_set, &layout) ||
+        (layout.planes[0].pitch < ((assertion.width + tiling->tile_width - 1) /
+                                   tiling->tile_width) *
+                                  tiling->tile_width * 4) ||
+        (layout.planes[0].size < (uint64_t)layout.planes[0].pitch *
+         ((assertion.height + tiling->tile_height - 1) /
+          tiling->tile_height) * tiling->tile_height)) {
+        FAIL("Block tiled layout isn't padded to whole tiles\n");
+    }
+
+    if (device_create_allocation(dev, &assertion, tiled_set, &allocation)) {
+        FAIL("Couldn't create a block tiled allocation\n");
+    }
+
+    linear = malloc((size_t)assertion.width * 4 * assertion.height);
+    result = malloc((size_t)assertion.width * 4 * assertion.height);
+
+    if (!linear || !result) {
+        FAIL("Couldn't allocate a linear copy of the surface\n");
+    }
+
+    for (i = 0; i < assertion.width * 4 * assertion.height; i++) {
+        linear[i] = (unsigned char)(i * 13);
+    }
+
+    if (!device_map_allocation(dev, allocation,
+                               ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE,
+                               &mapped)) {
+        unsigned char *plane = (unsigned char *)mapped +
+            layout.planes[0].offset;
+
+        if (copy_to_block_tiled(tiling->tile_width, tiling->tile_height, 4,
+                                assertion.width, assertion.height,
+                                linear, assertion.width * 4,
+                                plane, layout.planes[0].pitch) ||
+            copy_from_block_tiled(tiling->tile_width, tiling->tile_height, 4,
+                                  assertion.width, assertion.height,
+                                  plane, layout.planes[0].pitch,
+                                  result, assertion.width * 4)) {
+            FAIL("Couldn't copy through a block tiled allocation\n");
+        }
+
+        if (memcmp(linear, result, (size_t)assertion.width * 4 *
+                   assertion.height)) {
+            FAIL("A surface changed in a block tiled allocation\n");
+        }
+
+        device_unmap_allocation(dev, allocation,
+                                ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE);
+    }
+
+    free(result);
+    free(linear);
+    device_destroy_allocation(dev, allocation);
+
+done:
+    free_capability_sets(num_texture_sets, texture_sets);
+    device_destroy(dev);
+    close(dev_fd);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}
+    };
+
+    const char *dev_file_name = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "d:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_file_name = optarg;
+            break;
+
+        case '?':
+            usage();
+            exit(1);
+
+        default:
+            FAIL("Invalid option\n");
+            break;
+        }
+    }
+
+    check_kernels();
+
+    if (dev_file_name) {
+        check_device(dev_file_name);
+    }
+
+    return 0;
+}
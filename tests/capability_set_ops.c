@@ -63,10 +63,6 @@ int main(int argc, char *argv[])
         }
     };
 
-    static usage_t uses = {
-        NULL,                   /* dev, overidden below */
-        &texture_usage.header   /* usage */
-    };
     static const uint32_t num_uses = 1;
 
     uint32_t num_assertion_hints = 0;
@@ -75,6 +71,10 @@ int main(int argc, char *argv[])
     uint32_t *num_capability_sets;
     capability_set_t **capability_sets;
 
+    assertion_t *assertions;
+    usage_t *uses;
+    capability_query_t *queries;
+
     uint32_t tmp_num_sets[2];
     capability_set_t *tmp_sets[2];
 
@@ -129,8 +129,12 @@ int main(int argc, char *argv[])
     devs = malloc(sizeof(devs[0]) * num_devices);
     num_capability_sets = malloc(sizeof(num_capability_sets[0]) * num_devices);
     capability_sets = malloc(sizeof(capability_sets[0]) * num_devices);
+    assertions = malloc(sizeof(assertions[0]) * num_devices);
+    uses = malloc(sizeof(uses[0]) * num_devices);
+    queries = calloc(num_devices, sizeof(queries[0]));
 
-    if (!dev_fds || !devs || !num_capability_sets || !capability_sets) {
+    if (!dev_fds || !devs || !num_capability_sets || !capability_sets ||
+        !assertions || !uses || !queries) {
         FAIL("Couldn't allocate memory for device lists\n");
     }
 
@@ -147,10 +151,11 @@ int main(int argc, char *argv[])
             FAIL("Couldn't create allocator device from device FD\n");
         }
 
-        uses.dev = devs[i];
+        uses[i].dev = devs[i];
+        uses[i].usage = &texture_usage.header;
 
         /* Query assertion hints and use maximum surface size reported */
-        if (device_get_assertion_hints(devs[i], num_uses, &uses,
+        if (device_get_assertion_hints(devs[i], num_uses, &uses[i],
                                        &num_assertion_hints,
                                        &assertion_hints) ||
             (num_assertion_hints == 0)) {
@@ -158,19 +163,30 @@ int main(int argc, char *argv[])
                  "device %i\n", i);
         }
 
-        assertion.width = assertion_hints[0].max_width;
-        assertion.height = assertion_hints[0].max_height;
+        assertions[i] = assertion;
+        assertions[i].width = assertion_hints[0].max_width;
+        assertions[i].height = assertion_hints[0].max_height;
 
         free_assertion_hints(num_assertion_hints, assertion_hints);
 
-        /* Query capabilities for a common usage case from the device */
-        if (device_get_capabilities(devs[i], &assertion, num_uses, &uses,
-                                    &num_capability_sets[i],
-                                    &capability_sets[i])) {
+        queries[i].dev = devs[i];
+        queries[i].assertion = &assertions[i];
+        queries[i].num_uses = num_uses;
+        queries[i].uses = &uses[i];
+    }
+
+    /* Query capabilities for a common usage case from all devices at once */
+    device_get_capabilities_multi(num_devices, queries, NULL);
+
+    for (i = 0; i < num_devices; i++) {
+        if (queries[i].status) {
             FAIL("Couldn't get capabilities for given usage from device %i\n",
                  i);
         }
 
+        num_capability_sets[i] = queries[i].num_capability_sets;
+        capability_sets[i] = queries[i].capability_sets;
+
         /* Print initial capability sets */
         if (verbose) {
             uint32_t n;
@@ -23,9 +23,11 @@
 /* For getopt_long */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <getopt.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -126,7 +128,11 @@ int main(int argc, char *argv[])
         int allocation_fd;
         size_t metadata_size;
         void *metadata;
+        const void *shared_metadata[2];
         uint64_t allocation_size;
+        layout_t layout;
+        void *mapped[2];
+        uint32_t j;
 
         if (device_create_allocation(dev,
                                      &assertion,
@@ -148,9 +154,616 @@ int main(int argc, char *argv[])
         close(allocation_fd);
         free(metadata);
 
+        /* Drivers may not know every layout, but known ones must fit */
+        if (!device_plan_layout(dev, &assertion, &capability_sets[i],
+                                &layout) &&
+            (layout.size > allocation_size)) {
+            FAIL("Allocation created from capability set %u is smaller than "
+                 "its planned layout\n", i);
+        }
+
+        /* Later exports should share the metadata of the first */
+        for (j = 0; j < 2; j++) {
+            if (device_export_allocation_shared(dev,
+                                                allocation,
+                                                &allocation_size,
+                                                &metadata_size,
+                                                &shared_metadata[j],
+                                                &allocation_fd)) {
+                FAIL("Couldn't export an allocation created from capability "
+                     "set %u with shared metadata\n", i);
+            }
+
+            close(allocation_fd);
+        }
+
+        if (shared_metadata[0] != shared_metadata[1]) {
+            FAIL("Exports of the same allocation didn't share metadata\n");
+        }
+
+        /* Importing the same buffer twice should return one allocation */
+        if (!device_export_allocation(dev, allocation, &allocation_size,
+                                      &metadata_size, &metadata,
+                                      &allocation_fd)) {
+            allocation_t *imported[2];
+
+            if (!device_import_allocation(dev, allocation_size,
+                                          metadata_size, metadata,
+                                          allocation_fd, &imported[0])) {
+                if (device_import_allocation(dev, allocation_size,
+                                             metadata_size, metadata,
+                                             allocation_fd, &imported[1])) {
+                    FAIL("Couldn't import an allocation a second time\n");
+                }
+
+                if (imported[0] != imported[1]) {
+                    FAIL("Imports of the same buffer weren't shared\n");
+                }
+
+                device_destroy_allocation(dev, imported[1]);
+                device_destroy_allocation(dev, imported[0]);
+            }
+
+            close(allocation_fd);
+            free(metadata);
+        }
+
+        /* Mappings are reused, and writes are visible to later mappings */
+        if (!device_map_allocation(dev, allocation, ALLOCATION_MAP_WRITE,
+                                   &mapped[0])) {
+            allocation_range_t ranges[2] = {
+                { 0, 64 },
+                { allocation_size - 1, 2 }
+            };
+            allocation_rect_t rects[2] = {
+                { 0, 0, 16, 1 },
+                { 1, 0, assertion.width, 1 }
+            };
+
+            memset(mapped[0], 0x5a, 64);
+
+            /* Damage is only accepted if it lies within the allocation */
+            if (device_damage_allocation_ranges(dev, allocation, 1,
+                                                &ranges[0])) {
+                FAIL("Couldn't report a damaged range\n");
+            }
+
+            if (!device_damage_allocation_ranges(dev, allocation, 1,
+                                                 &ranges[1])) {
+                FAIL("Damage past the end of an allocation was accepted\n");
+            }
+
+            if (!device_plan_layout(dev, &assertion, &capability_sets[i],
+                                    &layout) &&
+                !device_damage_allocation_rects(dev, allocation, 0, 1,
+                                                &rects[0]) &&
+                !device_damage_allocation_rects(dev, allocation, 0, 1,
+                                                &rects[1])) {
+                FAIL("Damage past the edge of a surface was accepted\n");
+            }
+
+            device_unmap_allocation(dev, allocation, ALLOCATION_MAP_WRITE);
+
+            if (device_map_allocation(dev, allocation, ALLOCATION_MAP_READ,
+                                      &mapped[1])) {
+                FAIL("Couldn't map an allocation a second time\n");
+            }
+
+            if (mapped[0] != mapped[1]) {
+                FAIL("Mappings of the same allocation weren't reused\n");
+            }
+
+            if (((unsigned char *)mapped[1])[63] != 0x5a) {
+                FAIL("Writes through a mapping were lost\n");
+            }
+
+            device_unmap_allocation(dev, allocation, ALLOCATION_MAP_READ);
+        }
+
         device_destroy_allocation(dev, allocation);
     }
 
+    /* Create and export a swapchain's worth of allocations at once */
+    if (num_capability_sets) {
+        allocation_t *allocations[3];
+        uint64_t allocation_sizes[3];
+        int allocation_fds[3];
+        size_t metadata_size;
+        void *metadata;
+
+        if (device_create_allocations(dev, &assertion, &capability_sets[0],
+                                      3, allocations)) {
+            FAIL("Couldn't create a batch of allocations\n");
+        }
+
+        if (device_export_allocations(dev, 3, allocations, allocation_sizes,
+                                      &metadata_size, &metadata,
+                                      allocation_fds)) {
+            FAIL("Couldn't export a batch of allocations\n");
+        }
+
+        for (i = 0; i < 3; i++) {
+            close(allocation_fds[i]);
+            device_destroy_allocation(dev, allocations[i]);
+        }
+
+        free(metadata);
+    }
+
+    /* Carve a few cursor-sized images out of one backing allocation */
+    if (num_capability_sets) {
+        suballocator_t *suballocator;
+        suballocation_t cursors[3];
+        suballocation_t too_big;
+        memory_usage_t before, after;
+        uint64_t allocation_size;
+        uint64_t offset;
+        int allocation_fd;
+        size_t metadata_size;
+        void *metadata;
+
+        suballocator = device_create_suballocator(dev, &assertion,
+                                                  &capability_sets[0]);
+
+        if (!suballocator) {
+            FAIL("Couldn't create a suballocator\n");
+        }
+
+        /* A backing allocation too small for the request must not be kept */
+        device_get_memory_usage(dev, &before);
+
+        if (!suballocator_alloc(suballocator, assertion.width * 2,
+                                assertion.height * 2, 4, &too_big)) {
+            FAIL("A suballocation larger than its backing succeeded\n");
+        }
+
+        device_get_memory_usage(dev, &after);
+
+        if (after.num_live != before.num_live) {
+            FAIL("A failed suballocation leaked its backing allocation\n");
+        }
+
+        for (i = 0; i < 3; i++) {
+            if (suballocator_alloc(suballocator, 64, 64, 4, &cursors[i])) {
+                FAIL("Couldn't create suballocation %u\n", i);
+            }
+
+            if ((i > 0) &&
+                (cursors[i].allocation == cursors[i - 1].allocation) &&
+                (cursors[i].offset < cursors[i - 1].offset +
+                 cursors[i - 1].size) &&
+                (cursors[i - 1].offset < cursors[i].offset +
+                 cursors[i].size)) {
+                FAIL("Suballocations %u and %u overlap\n", i - 1, i);
+            }
+        }
+
+        if (suballocator_export(suballocator, &cursors[1], &allocation_size,
+                                &offset, &metadata_size, &metadata,
+                                &allocation_fd)) {
+            FAIL("Couldn't export a suballocation\n");
+        }
+
+        if (offset != cursors[1].offset) {
+            FAIL("Exported suballocation offset is wrong\n");
+        }
+
+        close(allocation_fd);
+        free(metadata);
+
+        for (i = 0; i < 3; i++) {
+            suballocator_free(suballocator, &cursors[i]);
+        }
+
+        suballocator_destroy(suballocator);
+    }
+
+    /*
+     * Query more sizes than the query cache keeps.  Library-owned results
+     * must stay valid after their entries are evicted.
+     */
+    {
+        const capability_set_t *first_sets = NULL;
+        const capability_set_t *sets;
+        uint32_t num_first_sets = 0;
+        uint32_t num_sets;
+        assertion_t sized = assertion;
+
+        for (i = 0; i < 100; i++) {
+            sized.width = 64 + i;
+
+            if (device_query_capabilities(dev, &sized, num_uses, &uses,
+                                          &num_sets, &sets)) {
+                FAIL("Couldn't query capabilities for width %u\n",
+                     sized.width);
+            }
+
+            if (!i) {
+                first_sets = sets;
+                num_first_sets = num_sets;
+            }
+        }
+
+        sized.width = 64;
+
+        if (device_query_capabilities(dev, &sized, num_uses, &uses,
+                                      &num_sets, &sets) ||
+            (num_sets != num_first_sets)) {
+            FAIL("Requerying an evicted size gave different results\n");
+        }
+
+        for (i = 0; i < num_first_sets; i++) {
+            if (first_sets[i].num_constraints != sets[i].num_constraints) {
+                FAIL("Evicted query results were freed\n");
+            }
+        }
+    }
+
+    /* Cycle the buffers of a swapchain */
+    if (num_capability_sets) {
+        uint64_t allocation_sizes[3];
+        int fds[3];
+        size_t metadata_size;
+        void *metadata;
+        swapchain_t *swapchain;
+        uint32_t index;
+
+        swapchain = device_create_swapchain(dev, &assertion,
+                                            &capability_sets[0], 3);
+
+        if (!swapchain || (swapchain_get_num_buffers(swapchain) != 3)) {
+            FAIL("Couldn't create a swapchain\n");
+        }
+
+        for (i = 0; i < 3; i++) {
+            if (swapchain_acquire_next(swapchain, &index) || (index != i)) {
+                FAIL("Swapchain buffers weren't acquired in order\n");
+            }
+        }
+
+        if (!swapchain_acquire_next(swapchain, &index)) {
+            FAIL("A swapchain buffer was acquired twice\n");
+        }
+
+        if (swapchain_release(swapchain, 1) ||
+            !swapchain_release(swapchain, 1) ||
+            !swapchain_release(swapchain, 3)) {
+            FAIL("Releasing swapchain buffers didn't work as expected\n");
+        }
+
+        if (swapchain_acquire_next(swapchain, &index) || (index != 1)) {
+            FAIL("A released swapchain buffer wasn't acquired again\n");
+        }
+
+        if (swapchain_release(swapchain, 0) ||
+            swapchain_release(swapchain, 2) ||
+            swapchain_acquire_next(swapchain, &index) || (index != 2)) {
+            FAIL("Swapchain buffers weren't acquired in ring order\n");
+        }
+
+        if (!swapchain_get_allocation(swapchain, 0) ||
+            swapchain_get_allocation(swapchain, 3)) {
+            FAIL("Swapchain allocations weren't returned as expected\n");
+        }
+
+        if (swapchain_export(swapchain, allocation_sizes, &metadata_size,
+                             &metadata, fds)) {
+            FAIL("Couldn't export a swapchain\n");
+        }
+
+        for (i = 0; i < 3; i++) {
+            close(fds[i]);
+        }
+
+        free(metadata);
+        swapchain_destroy(swapchain);
+    }
+
+    /* Resize an allocation created with headroom in place */
+    if (num_capability_sets) {
+        assertion_t resized = assertion;
+        memory_usage_t before, after;
+        layout_t layout;
+
+        device_set_allocation_headroom(dev, 64, 25);
+
+        if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                     &allocation)) {
+            FAIL("Couldn't create an allocation with headroom\n");
+        }
+
+        /* 256 plus 25% rounds up to 320 */
+        resized.width = 320;
+        resized.height = 300;
+        device_get_memory_usage(dev, &before);
+
+        if (device_reassert_allocation(dev, allocation, &resized)) {
+            FAIL("Couldn't grow an allocation within its headroom\n");
+        }
+
+        device_get_memory_usage(dev, &after);
+
+        if ((after.live_bytes != before.live_bytes) ||
+            (after.num_live != before.num_live)) {
+            FAIL("Reasserting an allocation changed the memory usage\n");
+        }
+
+        resized.width = 4 * assertion.width;
+        resized.height = 4 * assertion.height;
+
+        if (!device_reassert_allocation(dev, allocation, &resized)) {
+            FAIL("An allocation was grown beyond its memory\n");
+        }
+
+        resized.width = assertion.width / 2;
+        resized.height = assertion.height / 2;
+
+        if (device_reassert_allocation(dev, allocation, &resized)) {
+            FAIL("Couldn't shrink an allocation\n");
+        }
+
+        device_destroy_allocation(dev, allocation);
+
+        /* Headroom is dropped rather than exceed a budget */
+        if (device_plan_layout(dev, &assertion, &capability_sets[0],
+                               &layout)) {
+            FAIL("Couldn't plan the layout of an allocation\n");
+        }
+
+        device_get_memory_usage(dev, &before);
+        device_set_memory_budget(dev, 0, before.live_bytes +
+                                 before.pooled_bytes + layout.size);
+
+        if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                     &allocation)) {
+            FAIL("Headroom over the budget failed the allocation\n");
+        }
+
+        resized.width = 320;
+        resized.height = 300;
+
+        if (!device_reassert_allocation(dev, allocation, &resized)) {
+            FAIL("An allocation over the budget kept its headroom\n");
+        }
+
+        device_destroy_allocation(dev, allocation);
+        device_set_memory_budget(dev, 0, 0);
+        device_set_allocation_headroom(dev, 0, 0);
+    }
+
+    /* Create an allocation in the background and wait for it with poll() */
+    if (num_capability_sets) {
+        allocation_request_t *request;
+        struct pollfd pfd;
+
+        request = device_create_allocation_async(dev, &assertion,
+                                                 &capability_sets[0]);
+
+        if (!request) {
+            FAIL("Couldn't start an asynchronous allocation\n");
+        }
+
+        pfd.fd = allocation_request_get_fd(request);
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, -1) != 1) {
+            FAIL("Couldn't poll for an asynchronous allocation\n");
+        }
+
+        if (allocation_request_wait(request, &allocation)) {
+            FAIL("Asynchronous allocation failed\n");
+        }
+
+        allocation_request_destroy(request);
+        device_destroy_allocation(dev, allocation);
+    }
+
+    /*
+     * A forked child has none of the parent's worker threads, and must start
+     * its own to complete an asynchronous allocation.
+     */
+    if (num_capability_sets) {
+        allocation_request_t *request;
+        struct pollfd pfd;
+        pid_t child;
+        int status;
+
+        child = fork();
+
+        if (child < 0) {
+            FAIL("Couldn't fork\n");
+        }
+
+        if (!child) {
+            request = device_create_allocation_async(dev, &assertion,
+                                                     &capability_sets[0]);
+
+            if (!request) {
+                FAIL("Couldn't start an asynchronous allocation in a child\n");
+            }
+
+            pfd.fd = allocation_request_get_fd(request);
+            pfd.events = POLLIN;
+
+            if (poll(&pfd, 1, 10000) != 1) {
+                FAIL("A child's asynchronous allocation never completed\n");
+            }
+
+            if (allocation_request_wait(request, &allocation)) {
+                FAIL("Asynchronous allocation failed in a child\n");
+            }
+
+            allocation_request_destroy(request);
+            device_destroy_allocation(dev, allocation);
+            exit(0);
+        }
+
+        if ((waitpid(child, &status, 0) != child) || !WIFEXITED(status) ||
+            WEXITSTATUS(status)) {
+            FAIL("Asynchronous allocation failed after forking\n");
+        }
+    }
+
+    /* Released allocations should be recycled while pooling is enabled */
+    if (num_capability_sets) {
+        allocation_t *recycled;
+        memory_usage_t usage, before;
+        layout_t layout;
+        size_t metadata_size;
+        void *metadata;
+        uint64_t size;
+        void *mapped;
+        int fd;
+
+        device_set_allocation_pool_limits(dev, 4, UINT64_MAX);
+
+        if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                     &allocation)) {
+            FAIL("Couldn't create an allocation to pool\n");
+        }
+
+        device_destroy_allocation(dev, allocation);
+
+        device_get_memory_usage(dev, &usage);
+
+        if ((usage.num_pooled != 1) ||
+            !usage.pooled_bytes) {
+            FAIL("The pooled allocation wasn't accounted for\n");
+        }
+
+        if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                     &recycled)) {
+            FAIL("Couldn't create an allocation with pooling enabled\n");
+        }
+
+        if (recycled != allocation) {
+            FAIL("A released allocation wasn't recycled\n");
+        }
+
+        if (device_allocation_contents_discarded(dev, recycled)) {
+            FAIL("An allocation that wasn't purged lost its contents\n");
+        }
+
+        if (!device_plan_layout(dev, &assertion, &capability_sets[0],
+                                &layout) &&
+            !device_map_allocation(dev, recycled, ALLOCATION_MAP_WRITE,
+                                   &mapped)) {
+            memset(mapped, 0xa5, layout.size);
+            device_unmap_allocation(dev, recycled, ALLOCATION_MAP_WRITE);
+        } else {
+            layout.size = 0;
+        }
+
+        device_destroy_allocation(dev, recycled);
+        device_trim_allocation_pool(dev, 0);
+
+        /* Trimming either purges pooled allocations or destroys them */
+        device_get_memory_usage(dev, &usage);
+
+        if (usage.pooled_bytes || (usage.num_pooled > 1)) {
+            FAIL("Trimming the pool didn't release its memory\n");
+        }
+
+        if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                     &allocation)) {
+            FAIL("Couldn't create an allocation after trimming the pool\n");
+        }
+
+        if (usage.num_pooled) {
+            const unsigned char *bytes;
+            uint64_t j;
+
+            if (allocation != recycled) {
+                FAIL("A purged allocation wasn't recycled\n");
+            }
+
+            if (!device_allocation_contents_discarded(dev, allocation)) {
+                FAIL("A purged allocation wasn't reported as such\n");
+            }
+
+            if (layout.size &&
+                !device_map_allocation(dev, allocation, ALLOCATION_MAP_READ,
+                                       &mapped)) {
+                bytes = mapped;
+
+                for (j = 0; j < layout.size; j++) {
+                    if (bytes[j]) {
+                        FAIL("A purged allocation kept its contents\n");
+                    }
+                }
+
+                device_unmap_allocation(dev, allocation, ALLOCATION_MAP_READ);
+            }
+        }
+
+        /* Exported allocations may be in use elsewhere, so aren't pooled */
+        if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                     &recycled)) {
+            FAIL("Couldn't create an allocation to export\n");
+        }
+
+        if (!device_export_allocation(dev, recycled, &size, &metadata_size,
+                                      &metadata, &fd)) {
+            device_get_memory_usage(dev, &before);
+            device_destroy_allocation(dev, recycled);
+            device_get_memory_usage(dev, &usage);
+
+            if (usage.num_pooled != before.num_pooled) {
+                FAIL("An exported allocation was pooled\n");
+            }
+
+            free(metadata);
+            close(fd);
+        } else {
+            device_destroy_allocation(dev, recycled);
+        }
+
+        /* Leave this one pooled, for device_destroy() to clean up */
+        device_destroy_allocation(dev, allocation);
+    }
+
+    /*
+     * Purge and reuse an allocation large enough to be backed by huge pages.
+     * Writing all of it must not fault in memory that is no longer reserved.
+     */
+    if (num_capability_sets) {
+        assertion_t large = { 1024, 1024, NULL, NULL };
+        layout_t layout;
+        void *mapped;
+
+        device_set_allocation_pool_limits(dev, 4, UINT64_MAX);
+
+        if (device_plan_layout(dev, &large, &capability_sets[0], &layout) ||
+            device_create_allocation(dev, &large, &capability_sets[0],
+                                     &allocation)) {
+            FAIL("Couldn't create a large allocation to purge\n");
+        }
+
+        if (layout.size < 2 * 1024 * 1024) {
+            FAIL("The large allocation is smaller than a huge page\n");
+        }
+
+        device_destroy_allocation(dev, allocation);
+        device_trim_allocation_pool(dev, 0);
+
+        if (device_create_allocation(dev, &large, &capability_sets[0],
+                                     &allocation)) {
+            FAIL("Couldn't create a large allocation after trimming\n");
+        }
+
+        if (device_map_allocation(dev, allocation, ALLOCATION_MAP_WRITE,
+                                  &mapped)) {
+            FAIL("Couldn't map a large allocation after trimming\n");
+        }
+
+        memset(mapped, 0x5a, layout.size);
+        device_unmap_allocation(dev, allocation, ALLOCATION_MAP_WRITE);
+        device_destroy_allocation(dev, allocation);
+        device_set_allocation_pool_limits(dev, 0, 0);
+    }
+
+    free_capability_sets(num_capability_sets, capability_sets);
+
     device_destroy(dev);
 
     close(dev_fd);
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <allocator/allocator.h>
+
+#include "test_utils.h"
+
+static char root[] = "/tmp/allocator-enumerate-XXXXXX";
+
+static void usage(void)
+{
+    printf("\nUsage: device_enumerate [-l|--driver] DRIVER_LIBRARY\n");
+    printf("\nDRIVER_LIBRARY defaults to $ALLOCATOR_TEST_DRIVER.\n");
+}
+
+/*!
+ * Create any missing parent directories of a path below the fake root.
+ */
+static void make_parent_dirs(char *path)
+{
+    char *p;
+
+    for (p = strchr(path + strlen(root) + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+}
+
+/*!
+ * Create a file below the fake root.
+ */
+static void make_file(const char *rel_path, const char *contents)
+{
+    char path[PATH_MAX];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", root, rel_path);
+    make_parent_dirs(path);
+
+    f = fopen(path, "w");
+
+    if (!f || (fputs(contents, f) < 0) || fclose(f)) {
+        FAIL("Couldn't write %s\n", path);
+    }
+}
+
+static void make_link(const char *rel_path, const char *target)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", root, rel_path);
+    make_parent_dirs(path);
+
+    if (symlink(target, path)) {
+        FAIL("Couldn't create symlink %s\n", path);
+    }
+}
+
+/*!
+ * Create a fake PCI device bound to a kernel driver.
+ */
+static void make_pci_device(const char *name, const char *kernel_driver)
+{
+    char rel_path[PATH_MAX];
+    char target[PATH_MAX];
+
+    snprintf(rel_path, sizeof(rel_path), "sys/devices/pci0/%s/vendor", name);
+    make_file(rel_path, "0x10de\n");
+
+    snprintf(rel_path, sizeof(rel_path), "sys/devices/pci0/%s/driver", name);
+    snprintf(target, sizeof(target), "../../../bus/pci/drivers/%s",
+             kernel_driver);
+    make_link(rel_path, target);
+}
+
+/*!
+ * Create a fake class device, with a device node if <dev> is non-NULL.
+ */
+static void make_class_device(const char *subsystem,
+                              const char *name,
+                              const char *dev,
+                              const char *devname,
+                              const char *pci_device)
+{
+    char rel_path[PATH_MAX];
+    char contents[PATH_MAX];
+
+    snprintf(rel_path, sizeof(rel_path), "sys/class/%s/%s/uevent",
+             subsystem, name);
+    snprintf(contents, sizeof(contents), "DEVNAME=%s\n",
+             devname ? devname : name);
+    make_file(rel_path, contents);
+
+    if (dev) {
+        snprintf(rel_path, sizeof(rel_path), "sys/class/%s/%s/dev",
+                 subsystem, name);
+        snprintf(contents, sizeof(contents), "%s\n", dev);
+        make_file(rel_path, contents);
+    }
+
+    if (pci_device) {
+        snprintf(rel_path, sizeof(rel_path), "sys/class/%s/%s/device",
+                 subsystem, name);
+        snprintf(contents, sizeof(contents), "%s/sys/devices/pci0/%s",
+                 root, pci_device);
+        make_link(rel_path, contents);
+    }
+}
+
+static void remove_tree(void)
+{
+    char cmd[PATH_MAX];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", root);
+
+    if (system(cmd)) {
+        fprintf(stderr, "Couldn't remove %s\n", root);
+    }
+}
+
+/*!
+ * Check that device_enumerate() returns exactly the given node names,
+ * relative to the fake device root, in order.
+ */
+static void check_nodes(const char *const *expected, uint32_t num_expected)
+{
+    device_node_t *nodes;
+    uint32_t num_nodes;
+    uint32_t i;
+
+    if (device_enumerate(&num_nodes, &nodes)) {
+        FAIL("device_enumerate() failed\n");
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        printf("  %s (%s, %s, %u:%u)\n", nodes[i].path, nodes[i].subsystem,
+               nodes[i].kernel_driver ? nodes[i].kernel_driver : "no driver",
+               nodes[i].major, nodes[i].minor);
+    }
+
+    if (num_nodes != num_expected) {
+        FAIL("Expected %u device nodes, got %u\n", num_expected, num_nodes);
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        char path[PATH_MAX];
+
+        snprintf(path, sizeof(path), "%s/dev/%s", root, expected[i]);
+
+        if (strcmp(nodes[i].path, path)) {
+            FAIL("Expected device node %s, got %s\n", path, nodes[i].path);
+        }
+    }
+
+    free_device_nodes(num_nodes, nodes);
+}
+
+/*!
+ * Count the drivers probed on a device file.
+ */
+static uint32_t count_probes(const char *dev_file_name)
+{
+    timing_record_t *records;
+    uint32_t num_before, num_after;
+    uint32_t i, probes = 0;
+    int fd;
+
+    if (get_timing_records(&num_before, &records)) {
+        FAIL("Couldn't get timing records\n");
+    }
+
+    free_timing_records(num_before, records);
+
+    fd = open(dev_file_name, O_RDWR);
+
+    if (fd < 0) {
+        FAIL("Couldn't open device file %s\n", dev_file_name);
+    }
+
+    if (device_create(fd)) {
+        FAIL("The null driver created a device\n");
+    }
+
+    close(fd);
+
+    if (get_timing_records(&num_after, &records)) {
+        FAIL("Couldn't get timing records\n");
+    }
+
+    for (i = num_before; i < num_after; i++) {
+        if (records[i].phase == TIMING_PHASE_FD_PROBE) {
+            probes++;
+        }
+    }
+
+    free_timing_records(num_after, records);
+
+    return probes;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"driver", required_argument, NULL, 'l'},
+        {NULL, 0, NULL, 0}
+    };
+
+    const char *driver_file_name = getenv("ALLOCATOR_TEST_DRIVER");
+    char path[PATH_MAX];
+    char contents[PATH_MAX];
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "l:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'l':
+            driver_file_name = optarg;
+            break;
+
+        case '?':
+            usage();
+            exit(1);
+
+        default:
+            FAIL("Invalid option\n");
+            break;
+        }
+    }
+
+    if (!driver_file_name) {
+        usage();
+        exit(1);
+    }
+
+    if (!mkdtemp(root)) {
+        FAIL("Couldn't create a temporary directory\n");
+    }
+
+    atexit(remove_tree);
+
+    /*
+     * One driver for DRM devices bound to "testgpu", and one for DMA heaps,
+     * which have no kernel driver.
+     */
+    snprintf(contents, sizeof(contents),
+             "{\n"
+             "    \"file_format_version\": \"1.0.0\",\n"
+             "    \"allocator_driver\": {\n"
+             "        \"library_path\": \"%s\",\n"
+             "        \"match\": {\n"
+             "            \"subsystems\": [ \"drm\" ],\n"
+             "            \"kernel_drivers\": [ \"testgpu\" ]\n"
+             "        }\n"
+             "    }\n"
+             "}\n", driver_file_name);
+    make_file("drivers/testgpu.json", contents);
+
+    snprintf(contents, sizeof(contents),
+             "{\n"
+             "    \"file_format_version\": \"1.0.0\",\n"
+             "    \"allocator_driver\": {\n"
+             "        \"library_path\": \"%s\",\n"
+             "        \"match\": { \"subsystems\": [ \"dma_heap\" ] }\n"
+             "    }\n"
+             "}\n", driver_file_name);
+    make_file("drivers/heap.json", contents);
+
+    make_pci_device("0000:01:00.0", "testgpu");
+    make_pci_device("0000:02:00.0", "othergpu");
+
+    make_class_device("drm", "card0", "226:0", "dri/card0", "0000:01:00.0");
+    make_class_device("drm", "card0-DP-1", NULL, NULL, "0000:01:00.0");
+    make_class_device("drm", "renderD128", "226:128", "dri/renderD128",
+                      "0000:01:00.0");
+    make_class_device("drm", "card1", "226:1", "dri/card1", "0000:02:00.0");
+    make_class_device("video4linux", "video0", "81:0", NULL, "0000:01:00.0");
+    make_class_device("dma_heap", "system", "249:0", "dma_heap/system", NULL);
+
+    /* Let /dev/zero pose as a testgpu node, and /dev/null as a mem node */
+    make_link("sys/dev/char/1:5", "../../class/drm/renderD128");
+    make_file("sys/class/mem/null/dev", "1:3\n");
+    make_link("sys/class/drm/renderD128/subsystem", "../../../class/drm");
+    make_link("sys/class/mem/null/subsystem", "../../../class/mem");
+    make_link("sys/dev/char/1:3", "../../class/mem/null");
+
+    snprintf(path, sizeof(path), "%s/sys", root);
+    setenv("ALLOCATOR_SYSFS_ROOT", path, 1);
+    snprintf(path, sizeof(path), "%s/dev", root);
+    setenv("ALLOCATOR_DEV_ROOT", path, 1);
+    snprintf(path, sizeof(path), "%s/drivers", root);
+    setenv("ALLOCATOR_DRIVER_DIRS", path, 1);
+    setenv("ALLOCATOR_DEBUG", "timing", 1);
+
+    printf("Initial enumeration:\n");
+    {
+        static const char *const expected[] = {
+            "dri/card0", "dri/renderD128", "dma_heap/system"
+        };
+
+        check_nodes(expected, 3);
+    }
+
+    printf("After adding renderD129:\n");
+    make_class_device("drm", "renderD129", "226:129", "dri/renderD129",
+                      "0000:01:00.0");
+    {
+        static const char *const expected[] = {
+            "dri/card0", "dri/renderD128", "dri/renderD129", "dma_heap/system"
+        };
+
+        check_nodes(expected, 4);
+    }
+
+    printf("After removing card0:\n");
+    snprintf(path, sizeof(path), "rm -rf '%s/sys/class/drm/card0'", root);
+
+    if (system(path)) {
+        FAIL("Couldn't remove card0\n");
+    }
+
+    {
+        static const char *const expected[] = {
+            "dri/renderD128", "dri/renderD129", "dma_heap/system"
+        };
+
+        check_nodes(expected, 3);
+    }
+
+    /* Only the testgpu driver may support a testgpu node */
+    if (count_probes("/dev/zero") != 1) {
+        FAIL("Expected one driver to be probed on a testgpu node\n");
+    }
+
+    /* Neither driver may support a mem node */
+    if (count_probes("/dev/null") != 0) {
+        FAIL("Expected no drivers to be probed on a mem node\n");
+    }
+
+    printf("Success\n");
+
+    return 0;
+}
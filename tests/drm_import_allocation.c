@@ -86,11 +86,6 @@ int main(int argc, char *argv[])
     int drm_fd;
     uint32_t drm_fb;
 
-    uint32_t bpp = 4; /* allocator assumes ARGB8888 allocations for now */
-    const constraint_t *pitch_alignment_cons;
-    uint32_t pitch_alignment = 1;
-    uint32_t pitch;
-
     uint32_t i;
 
     while ((opt = getopt_long(argc, argv, "f:d:c:l", long_options, NULL)) != -1) {
@@ -153,9 +148,20 @@ int main(int argc, char *argv[])
         void *metadata;
         uint64_t allocation_size;
         uint32_t drm_gem_handle;
+        uint32_t handles[4] = { 0 };
+        uint32_t pitches[4] = { 0 };
+        uint32_t offsets[4] = { 0 };
         struct drm_gem_close gemCloseArgs;
+        layout_t layout;
+        uint32_t j;
         int ret;
 
+        if (device_plan_layout(dev, &assertion, &capability_sets[i],
+                               &layout)) {
+            printf("Skipping capability set %d, its layout is unknown\n", i);
+            continue;
+        }
+
         if (device_create_allocation(dev,
                                      &assertion,
                                      &capability_sets[i],
@@ -173,6 +179,11 @@ int main(int argc, char *argv[])
                  "%d\n", i);
         }
 
+        if (layout.size > allocation_size) {
+            FAIL("Allocation created from capability set %d is smaller than "
+                 "its planned layout\n", i);
+        }
+
         /* Create a DRM FB */
         ret = drmPrimeFDToHandle(drm_fd, allocation_fd, &drm_gem_handle);
         if (ret != 0) {
@@ -180,19 +191,15 @@ int main(int argc, char *argv[])
                  "capability set %d (error = %d)\n", i, ret);
         }
 
-        pitch_alignment_cons =
-            find_constraint(&capability_sets[i], CONSTRAINT_PITCH_ALIGNMENT);
-        if (pitch_alignment_cons) {
-            pitch_alignment = pitch_alignment_cons->u.pitch_alignment.value;
+        for (j = 0; j < layout.num_planes; j++) {
+            handles[j] = drm_gem_handle;
+            pitches[j] = layout.planes[j].pitch;
+            offsets[j] = (uint32_t)layout.planes[j].offset;
         }
 
-        pitch = assertion.width * bpp;
-        pitch += (pitch_alignment - 1);
-        pitch &= ~(pitch_alignment - 1);
-
-        // TODO: Use a more versatile API that allows to pass allocator metadata
-        ret = drmModeAddFB(drm_fd, assertion.width, assertion.height, 0, 8 * bpp,
-                           pitch, drm_gem_handle, &drm_fb);
+        ret = drmModeAddFB2(drm_fd, assertion.width, assertion.height,
+                            DRM_FORMAT_ARGB8888, handles, pitches, offsets,
+                            &drm_fb, 0);
         if (ret != 0) {
             FAIL("Couldn't create DRM FB from allocation created from "
                  "capability set %d (error = %d)\n", i, ret);
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* For getopt_long */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <allocator/allocator.h>
+
+#include "test_utils.h"
+
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+     ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+static void usage(void)
+{
+    printf("\nUsage: fill_allocation [-d|--device] DEVICE_FILE_NAME\n");
+}
+
+/*!
+ * Where pixel (x, y) of a plane is, for pitch linear and block tiled
+ * layouts.
+ */
+static uint64_t pixel_offset(const capability_set_t *set,
+                             const plane_layout_t *plane,
+                             uint32_t bpp,
+                             uint32_t x,
+                             uint32_t y)
+{
+    const capability_block_tiled_t *tiled = (const capability_block_tiled_t *)
+        find_capability(set, VENDOR_BASE, CAP_BASE_BLOCK_TILED);
+    uint32_t tw = tiled ? tiled->tile_width : 1;
+    uint32_t th = tiled ? tiled->tile_height : 1;
+
+    return plane->offset +
+        (uint64_t)(y / th) * th * plane->pitch +
+        (uint64_t)(x / tw) * tw * th * bpp +
+        (uint64_t)(y % th) * tw * bpp +
+        (uint64_t)(x % tw) * bpp;
+}
+
+/*!
+ * Fill one plane of every allocation the device offers for a surface, and
+ * check that exactly its visible pixels changed.
+ */
+static void check_fill(device_t *dev,
+                       uint32_t format,
+                       uint32_t width,
+                       uint32_t height,
+                       uint32_t plane,
+                       uint32_t plane_width,
+                       uint32_t plane_height,
+                       uint32_t bpp,
+                       const unsigned char *pixel)
+{
+    static usage_texture_t texture_usage = {
+        { /* header */
+            VENDOR_BASE,                            /* usage vendor */
+            USAGE_BASE_TEXTURE,                     /* usage name */
+            USAGE_LENGTH_IN_WORDS(usage_texture_t)  /* length_in_word */
+        }
+    };
+
+    assertion_t assertion = { width, height, &format, NULL };
+    usage_t uses = { dev, &texture_usage.header };
+    uint32_t num_capability_sets;
+    capability_set_t *capability_sets;
+    uint32_t i, x, y;
+
+    if (device_get_capabilities(dev, &assertion, 1, &uses,
+                                &num_capability_sets, &capability_sets)) {
+        FAIL("Couldn't get capabilities for a %ux%u surface\n", width,
+             height);
+    }
+
+    for (i = 0; i < num_capability_sets; i++) {
+        allocation_t *allocation;
+        unsigned char *mapped;
+        unsigned char *expected;
+        layout_t layout;
+
+        if (device_plan_layout(dev, &assertion, &capability_sets[i],
+                               &layout)) {
+            continue;
+        }
+
+        if (device_create_allocation(dev, &assertion, &capability_sets[i],
+                                     &allocation)) {
+            FAIL("Couldn't create a %ux%u allocation\n", width, height);
+        }
+
+        if (device_map_allocation(dev, allocation, ALLOCATION_MAP_WRITE,
+                                  (void **)&mapped)) {
+            device_destroy_allocation(dev, allocation);
+            continue;
+        }
+
+        memset(mapped, 0xcc, layout.size);
+        device_unmap_allocation(dev, allocation, ALLOCATION_MAP_WRITE);
+
+        expected = malloc(layout.size);
+
+        if (!expected) {
+            FAIL("Couldn't allocate a copy of the surface\n");
+        }
+
+        memset(expected, 0xcc, layout.size);
+
+        for (y = 0; y < plane_height; y++) {
+            for (x = 0; x < plane_width; x++) {
+                memcpy(&expected[pixel_offset(&capability_sets[i],
+                                              &layout.planes[plane], bpp,
+                                              x, y)], pixel, bpp);
+            }
+        }
+
+        if (device_fill_allocation(dev, allocation, plane, pixel)) {
+            FAIL("Couldn't fill plane %u of a %ux%u allocation\n", plane,
+                 width, height);
+        }
+
+        if (device_map_allocation(dev, allocation, ALLOCATION_MAP_READ,
+                                  (void **)&mapped)) {
+            FAIL("Couldn't map a filled allocation\n");
+        }
+
+        if (memcmp(mapped, expected, layout.size)) {
+            FAIL("Filling plane %u of a %ux%u allocation from capability "
+                 "set %u didn't write exactly its pixels\n", plane, width,
+                 height, i);
+        }
+
+        device_unmap_allocation(dev, allocation, ALLOCATION_MAP_READ);
+        free(expected);
+        device_destroy_allocation(dev, allocation);
+    }
+
+    free_capability_sets(num_capability_sets, capability_sets);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}
+    };
+
+    static const unsigned char argb[4] = { 0x10, 0x20, 0x30, 0xff };
+    static const unsigned char black[4] = { 0, 0, 0, 0 };
+    static const unsigned char cbcr[2] = { 0x80, 0x40 };
+    static const unsigned char rgb[3] = { 0x01, 0x02, 0x03 };
+
+    int opt;
+    char *dev_file_name = NULL;
+    device_t *dev;
+    int dev_fd;
+
+    while ((opt = getopt_long(argc, argv, "d:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_file_name = strdup(optarg);
+            if (!dev_file_name) {
+                FAIL("Failed to make a copy of the device string\n");
+            }
+            break;
+
+        case '?':
+            usage();
+            exit(1);
+
+        default:
+            FAIL("Invalid option\n");
+            break;
+        }
+    }
+
+    if (!dev_file_name) {
+        usage();
+        exit(1);
+    }
+
+    dev_fd = open(dev_file_name, O_RDWR);
+
+    if (dev_fd < 0) {
+        FAIL("Couldn't open device file %s\n", dev_file_name);
+    }
+
+    dev = device_create(dev_fd);
+
+    if (!dev) {
+        FAIL("Couldn't create allocator device from device FD\n");
+    }
+
+    /* Rows narrower than the pitch, and partial tiles */
+    check_fill(dev, FOURCC('A', 'R', '2', '4'), 100, 51, 0, 100, 51, 4, argb);
+    check_fill(dev, FOURCC('A', 'R', '2', '4'), 100, 51, 0, 100, 51, 4,
+               black);
+
+    /* Pixels that don't divide the fill pattern */
+    check_fill(dev, FOURCC('R', 'G', '2', '4'), 37, 9, 0, 37, 9, 3, rgb);
+
+    /* Subsampled planes */
+    check_fill(dev, FOURCC('N', 'V', '1', '2'), 63, 33, 1, 32, 17, 2, cbcr);
+
+    /* Large enough to be split between threads */
+    check_fill(dev, FOURCC('A', 'R', '2', '4'), 1920, 1080, 0, 1920, 1080,
+               4, argb);
+
+    device_destroy(dev);
+    close(dev_fd);
+    free(dev_file_name);
+
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * A driver that loads but supports no devices, for tests that only exercise
+ * driver discovery.
+ */
+
+#include <stddef.h>
+#include <allocator/driver.h>
+
+static int null_is_fd_supported(driver_t *driver, int dev_fd)
+{
+    return 0;
+}
+
+static device_t *null_device_create_from_fd(driver_t *driver, int dev_fd)
+{
+    return NULL;
+}
+
+static void null_destroy(driver_t *driver)
+{
+}
+
+int allocator_driver_init(driver_t *driver)
+{
+    driver->is_fd_supported = null_is_fd_supported;
+    driver->device_create_from_fd = null_device_create_from_fd;
+    driver->destroy = null_destroy;
+
+    return 0;
+}
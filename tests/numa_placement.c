@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* For getopt_long */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <allocator/allocator.h>
+
+#include "test_utils.h"
+
+static void usage(void)
+{
+    printf("\nUsage: numa_placement [-d|--device] DEVICE_FILE_NAME "
+           "[-n|--node] NODE\n");
+}
+
+/*!
+ * Count the system's NUMA nodes, from the highest ID online.
+ */
+static uint32_t get_real_numa_nodes(void)
+{
+    FILE *f = fopen("/sys/devices/system/node/online", "r");
+    uint32_t count = 1;
+    unsigned long id;
+    int c;
+
+    if (!f) {
+        return 1;
+    }
+
+    while ((c = fgetc(f)) != EOF) {
+        if ((c >= '0') && (c <= '9')) {
+            ungetc(c, f);
+
+            if (fscanf(f, "%lu", &id) == 1 && (id + 1 > count)) {
+                count = id + 1;
+            }
+        }
+    }
+
+    fclose(f);
+
+    return count;
+}
+
+static int query_placement(device_t *dev,
+                           const assertion_t *assertion,
+                           uint32_t node,
+                           uint32_t *num_capability_sets,
+                           capability_set_t **capability_sets)
+{
+    static usage_texture_t texture_usage = {
+        { /* header */
+            VENDOR_BASE,                            /* usage vendor */
+            USAGE_BASE_TEXTURE,                     /* usage name */
+            USAGE_LENGTH_IN_WORDS(usage_texture_t)  /* length_in_word */
+        }
+    };
+
+    usage_numa_placement_t numa_usage = {
+        { /* header */
+            VENDOR_BASE,                                    /* usage vendor */
+            USAGE_BASE_NUMA_PLACEMENT,                      /* usage name */
+            USAGE_LENGTH_IN_WORDS(usage_numa_placement_t)   /* length_in_word */
+        },
+        node,                                               /* node */
+        USAGE_BASE_NUMA_PREFAULT                            /* flags */
+    };
+
+    usage_t uses[2] = {
+        { dev, &texture_usage.header },
+        { dev, &numa_usage.header }
+    };
+
+    return device_get_capabilities(dev, assertion, 2, uses,
+                                   num_capability_sets, capability_sets);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {"node",   required_argument, NULL, 'n'},
+        {NULL, 0, NULL, 0}
+    };
+
+    static assertion_t assertion = {
+        256,            /* width */
+        256,            /* height */
+        NULL,           /* format */
+        NULL            /* ext */
+    };
+
+    uint32_t num_capability_sets;
+    capability_set_t *capability_sets;
+    uint32_t num_other_sets;
+    capability_set_t *other_sets;
+    uint32_t num_derived_sets;
+    capability_set_t *derived_sets;
+    const constraint_t *placement;
+
+    int opt;
+    char *dev_file_name = NULL;
+    uint32_t node = 1;
+
+    device_t *dev;
+    allocation_t *allocation;
+    uint64_t allocation_size;
+    size_t metadata_size;
+    void *metadata;
+    int allocation_fd;
+    unsigned char *addr;
+    unsigned char resident;
+    int page_node;
+    int dev_fd;
+
+    while ((opt = getopt_long(argc, argv, "d:n:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_file_name = strdup(optarg);
+            if (!dev_file_name) {
+                FAIL("Failed to make a copy of the device string\n");
+            }
+            break;
+
+        case 'n':
+            node = strtoul(optarg, NULL, 0);
+            break;
+
+        case '?':
+            usage();
+            exit(1);
+
+        default:
+            FAIL("Invalid option\n");
+            break;
+        }
+    }
+
+    if (!dev_file_name) {
+        usage();
+        exit(1);
+    }
+
+    dev_fd = open(dev_file_name, O_RDWR);
+
+    if (dev_fd < 0) {
+        FAIL("Couldn't open device file %s\n", dev_file_name);
+    }
+
+    dev = device_create(dev_fd);
+
+    if (!dev) {
+        FAIL("Couldn't create allocator device from device FD\n");
+    }
+
+    if (query_placement(dev, &assertion, node, &num_capability_sets,
+                        &capability_sets) || !num_capability_sets) {
+        FAIL("Couldn't get capabilities placing memory on node %u\n", node);
+    }
+
+    placement = find_constraint(&capability_sets[0], CONSTRAINT_NUMA_NODE);
+
+    if (!placement || (placement->u.numa_node.node != node) ||
+        !(placement->u.numa_node.flags & USAGE_BASE_NUMA_PREFAULT)) {
+        FAIL("Capability set doesn't place memory on node %u\n", node);
+    }
+
+    /* Sets placing memory on different nodes can't be combined */
+    if (query_placement(dev, &assertion, USAGE_BASE_NUMA_NODE_LOCAL,
+                        &num_other_sets, &other_sets) || !num_other_sets) {
+        FAIL("Couldn't get capabilities placing memory on the local node\n");
+    }
+
+    if (derive_capabilities(num_capability_sets, capability_sets,
+                            num_other_sets, other_sets,
+                            &num_derived_sets, &derived_sets)) {
+        FAIL("Couldn't derive capabilities\n");
+    }
+
+    if (num_derived_sets) {
+        FAIL("Combined capability sets placing memory on different nodes\n");
+    }
+
+    free_capability_sets(num_other_sets, other_sets);
+
+    /* ...but those placing memory on the same node can */
+    if (derive_capabilities(num_capability_sets, capability_sets,
+                            num_capability_sets, capability_sets,
+                            &num_derived_sets, &derived_sets) ||
+        !num_derived_sets ||
+        !find_constraint(&derived_sets[0], CONSTRAINT_NUMA_NODE)) {
+        FAIL("Couldn't combine capability sets placing memory on one node\n");
+    }
+
+    free_capability_sets(num_derived_sets, derived_sets);
+
+    if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                 &allocation)) {
+        FAIL("Couldn't create an allocation placed on node %u\n", node);
+    }
+
+    if (device_export_allocation(dev, allocation, &allocation_size,
+                                 &metadata_size, &metadata,
+                                 &allocation_fd)) {
+        FAIL("Couldn't export an allocation placed on node %u\n", node);
+    }
+
+    addr = mmap(NULL, allocation_size, PROT_READ, MAP_SHARED,
+                allocation_fd, 0);
+
+    if (addr == MAP_FAILED) {
+        FAIL("Couldn't map an allocation placed on node %u\n", node);
+    }
+
+    /* Prefaulted memory is resident before anything touches it */
+    if (mincore(addr, 1, &resident) || !(resident & 1)) {
+        FAIL("Allocation placed on node %u wasn't prefaulted\n", node);
+    }
+
+    if (!syscall(SYS_get_mempolicy, &page_node, NULL, 0, addr,
+                 MPOL_F_NODE | MPOL_F_ADDR)) {
+        if (page_node != (int)(node % get_real_numa_nodes())) {
+            FAIL("Allocation placed on node %u is on node %d\n", node,
+                 page_node);
+        }
+    } else if (errno != ENOSYS) {
+        FAIL("Couldn't get the node of an allocation\n");
+    }
+
+    munmap(addr, allocation_size);
+    close(allocation_fd);
+    free(metadata);
+
+    device_destroy_allocation(dev, allocation);
+
+    /* Nodes the system doesn't have can't be requested */
+    if (query_placement(dev, &assertion, 1024, &num_other_sets,
+                        &other_sets)) {
+        FAIL("Couldn't get capabilities placing memory on node 1024\n");
+    }
+
+    if (num_other_sets) {
+        FAIL("Got capabilities placing memory on a nonexistent node\n");
+    }
+
+    free_capability_sets(num_capability_sets, capability_sets);
+
+    device_destroy(dev);
+
+    close(dev_fd);
+    free(dev_file_name);
+
+    printf("Success\n");
+
+    return 0;
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+# Run the device tests against the software driver on /dev/zero.  Skipped if
+# the driver wasn't built.
+
+if [ -z "$ALLOCATOR_SOFTWARE_DRIVER" ] ||
+   [ ! -f "$ALLOCATOR_SOFTWARE_DRIVER" ] || [ ! -c /dev/zero ]; then
+    exit 77
+fi
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/software.json" <<JSON
+{
+    "file_format_version" : "1.0.0",
+    "allocator_driver" : {
+        "library_path" : "$ALLOCATOR_SOFTWARE_DRIVER"
+    }
+}
+JSON
+
+ALLOCATOR_DRIVER_DIRS="$dir"
+export ALLOCATOR_DRIVER_DIRS
+
+./device_alloc -d /dev/zero &&
+./create_allocation -d /dev/zero &&
+ALLOCATOR_SOFTWARE_NONCOHERENT=1 ./create_allocation -d /dev/zero &&
+./capability_set_ops -d /dev/zero -d /dev/zero &&
+./block_tiling -d /dev/zero &&
+./fill_allocation -d /dev/zero &&
+./zeroed_allocation -d /dev/zero &&
+ALLOCATOR_SOFTWARE_ZERO_POOL=0 ./zeroed_allocation -d /dev/zero &&
+ALLOCATOR_FAKE_NUMA_NODES=2 ./numa_placement -d /dev/zero -n 1
@@ -84,6 +84,22 @@ const constraint_t *find_constraint(const capability_set_t *set, uint32_t name)
     return NULL;
 }
 
+const capability_header_t *find_capability(const capability_set_t *set,
+                                           uint32_t vendor,
+                                           uint16_t name)
+{
+    int i;
+
+    for (i = 0; i < set->num_capabilities; i++) {
+        if ((set->capabilities[i]->common.vendor == vendor) &&
+            (set->capabilities[i]->common.name == name)) {
+            return set->capabilities[i];
+        }
+    }
+
+    return NULL;
+}
+
 void print_constraint(const constraint_t *constraint)
 {
     int i;
@@ -99,6 +115,18 @@ void print_constraint(const constraint_t *constraint)
     DO_PRINT_CONSTRAINT(ADDRESS_ALIGNMENT, PRIu64, address_alignment);
     DO_PRINT_CONSTRAINT(PITCH_ALIGNMENT, PRIu32, pitch_alignment);
     DO_PRINT_CONSTRAINT(MAX_PITCH, PRIu32, max_pitch);
+    case CONSTRAINT_NUMA_NODE:
+        printf("         name:  CONSTRAINT_NUMA_NODE (0x%x)\n",
+               constraint->name);
+        printf("         node:  %" PRIu32 "\n", constraint->u.numa_node.node);
+        printf("         flags: 0x%" PRIx32 "\n", constraint->u.numa_node.flags);
+        break;
+    case CONSTRAINT_UNINITIALIZED:
+        printf("         name:  CONSTRAINT_UNINITIALIZED (0x%x)\n",
+               constraint->name);
+        printf("         flags: 0x%" PRIx32 "\n",
+               constraint->u.uninitialized.flags);
+        break;
     default:
         printf("         name:  UNKNOWN (0x%x)\n", constraint->name);
         printf("         value: ");
@@ -142,6 +170,7 @@ void print_capability_header(const capability_header_t *capability)
 
     switch (capability->common.name) {
     DO_PRINT_CAP(PITCH_LINEAR);
+    DO_PRINT_CAP(BLOCK_TILED);
     default:
         PRINT_CAP(UNKNOWN);
     }
@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2017 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* For getopt_long */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <allocator/allocator.h>
+
+#include "test_utils.h"
+
+#define FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+     ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/*! Allocations created of each size */
+#define NUM_ALLOCATIONS 16
+
+static usage_texture_t texture_usage = {
+    { /* header */
+        VENDOR_BASE,                            /* usage vendor */
+        USAGE_BASE_TEXTURE,                     /* usage name */
+        USAGE_LENGTH_IN_WORDS(usage_texture_t)  /* length_in_word */
+    }
+};
+
+static usage_uninitialized_t uninitialized_usage = {
+    { /* header */
+        VENDOR_BASE,                                    /* usage vendor */
+        USAGE_BASE_UNINITIALIZED,                       /* usage name */
+        USAGE_LENGTH_IN_WORDS(usage_uninitialized_t)    /* length_in_word */
+    }
+};
+
+static void usage(void)
+{
+    printf("\nUsage: zeroed_allocation [-d|--device] DEVICE_FILE_NAME\n");
+}
+
+static double get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int is_zeroed(const unsigned char *data, uint64_t size)
+{
+    uint64_t i;
+
+    for (i = 0; i < size; i++) {
+        if (data[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*!
+ * Create allocations of the same size over and over, dirtying each before
+ * destroying it, and check that every new one reads back as zeroes.
+ */
+static void check_zeroed(device_t *dev, uint32_t width, uint32_t height)
+{
+    uint32_t format = FOURCC('A', 'R', '2', '4');
+    assertion_t assertion = { width, height, &format, NULL };
+    usage_t uses = { dev, &texture_usage.header };
+    uint32_t num_capability_sets;
+    capability_set_t *capability_sets;
+    double total = 0.0;
+    uint32_t i;
+
+    if (device_get_capabilities(dev, &assertion, 1, &uses,
+                                &num_capability_sets, &capability_sets) ||
+        !num_capability_sets) {
+        FAIL("Couldn't get capabilities for a %ux%u surface\n", width,
+             height);
+    }
+
+    for (i = 0; i < NUM_ALLOCATIONS; i++) {
+        allocation_t *allocation;
+        unsigned char *mapped;
+        layout_t layout;
+        double start;
+
+        if (device_plan_layout(dev, &assertion, &capability_sets[0],
+                               &layout)) {
+            FAIL("Couldn't plan the layout of a %ux%u surface\n", width,
+                 height);
+        }
+
+        start = get_time_us();
+
+        if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                     &allocation)) {
+            FAIL("Couldn't create a %ux%u allocation\n", width, height);
+        }
+
+        total += get_time_us() - start;
+
+        if (device_map_allocation(dev, allocation,
+                                  ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE,
+                                  (void **)&mapped)) {
+            FAIL("Couldn't map a %ux%u allocation\n", width, height);
+        }
+
+        if (!is_zeroed(mapped, layout.size)) {
+            FAIL("Allocation %u of %ux%u wasn't zeroed\n", i, width, height);
+        }
+
+        memset(mapped, 0xa5, layout.size);
+        device_unmap_allocation(dev, allocation,
+                                ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE);
+        device_destroy_allocation(dev, allocation);
+
+        /* Give the pool a chance to refill, as an application would */
+        usleep(10000);
+    }
+
+    printf("Created %u %ux%u allocations in %.1f us on average\n",
+           NUM_ALLOCATIONS, width, height, total / NUM_ALLOCATIONS);
+
+    free_capability_sets(num_capability_sets, capability_sets);
+}
+
+/*!
+ * Create an allocation from a pool warmed before fork() in both the parent
+ * and the child, and check that the two don't share memory.
+ */
+static void check_fork(device_t *dev)
+{
+    uint32_t format = FOURCC('A', 'R', '2', '4');
+    assertion_t assertion = { 512, 512, &format, NULL };
+    usage_t uses = { dev, &texture_usage.header };
+    uint32_t num_capability_sets;
+    capability_set_t *capability_sets;
+    allocation_t *allocation;
+    unsigned char *mapped;
+    unsigned char pattern;
+    layout_t layout;
+    int to_parent[2];
+    int to_child[2];
+    char token = 0;
+    uint64_t i;
+    pid_t child;
+    int status;
+
+    if (device_get_capabilities(dev, &assertion, 1, &uses,
+                                &num_capability_sets, &capability_sets) ||
+        !num_capability_sets ||
+        device_plan_layout(dev, &assertion, &capability_sets[0], &layout)) {
+        FAIL("Couldn't get capabilities for the fork check\n");
+    }
+
+    /* Teach the pool the size, and give it time to fill */
+    if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                 &allocation)) {
+        FAIL("Couldn't create an allocation before forking\n");
+    }
+
+    device_destroy_allocation(dev, allocation);
+    usleep(100000);
+
+    if (pipe(to_parent) || pipe(to_child)) {
+        FAIL("Couldn't create pipes for the fork check\n");
+    }
+
+    child = fork();
+
+    if (child < 0) {
+        FAIL("Couldn't fork\n");
+    }
+
+    /* Keep one end of each pipe, so either process sees the other exit */
+    close(child ? to_parent[1] : to_parent[0]);
+    close(child ? to_child[0] : to_child[1]);
+
+    pattern = child ? 0x3c : 0xc3;
+
+    if (device_create_allocation(dev, &assertion, &capability_sets[0],
+                                 &allocation) ||
+        device_map_allocation(dev, allocation,
+                              ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE,
+                              (void **)&mapped)) {
+        FAIL("Couldn't create an allocation after forking\n");
+    }
+
+    if (!is_zeroed(mapped, layout.size)) {
+        FAIL("An allocation created after forking wasn't zeroed\n");
+    }
+
+    memset(mapped, pattern, layout.size);
+
+    /* Check once both processes have written their allocations */
+    if (child) {
+        if ((read(to_parent[0], &token, 1) != 1) ||
+            (write(to_child[1], &token, 1) != 1)) {
+            FAIL("Couldn't synchronize with the child\n");
+        }
+    } else {
+        if ((write(to_parent[1], &token, 1) != 1) ||
+            (read(to_child[0], &token, 1) != 1)) {
+            FAIL("Couldn't synchronize with the parent\n");
+        }
+    }
+
+    for (i = 0; i < layout.size; i++) {
+        if (mapped[i] != pattern) {
+            FAIL("The %s's allocation shares memory with the %s's\n",
+                 child ? "parent" : "child", child ? "child" : "parent");
+        }
+    }
+
+    device_unmap_allocation(dev, allocation,
+                            ALLOCATION_MAP_READ | ALLOCATION_MAP_WRITE);
+    device_destroy_allocation(dev, allocation);
+
+    if (!child) {
+        exit(0);
+    }
+
+    if ((waitpid(child, &status, 0) != child) || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+        FAIL("The child failed the fork check\n");
+    }
+
+    close(to_parent[0]);
+    close(to_child[1]);
+    free_capability_sets(num_capability_sets, capability_sets);
+}
+
+/*!
+ * Check that allocations that needn't be cleared are reported as such, and
+ * can still be created and written.
+ */
+static void check_uninitialized(device_t *dev)
+{
+    uint32_t format = FOURCC('A', 'R', '2', '4');
+    assertion_t assertion = { 640, 480, &format, NULL };
+    usage_t uses[2] = {
+        { dev, &texture_usage.header },
+        { dev, &uninitialized_usage.header },
+    };
+    uint32_t num_capability_sets;
+    capability_set_t *capability_sets;
+    const constraint_t *constraint;
+    allocation_t *allocation;
+    unsigned char *mapped;
+    layout_t layout;
+    uint32_t i;
+
+    if (device_get_capabilities(dev, &assertion, 2, uses,
+                                &num_capability_sets, &capability_sets) ||
+        !num_capability_sets) {
+        FAIL("Couldn't get capabilities for uninitialized allocations\n");
+    }
+
+    for (i = 0; i < num_capability_sets; i++) {
+        print_capability_set(&capability_sets[i]);
+    }
+
+    constraint = find_constraint(&capability_sets[0],
+                                 CONSTRAINT_UNINITIALIZED);
+
+    if (!constraint || constraint->u.uninitialized.flags) {
+        FAIL("Uninitialized allocations weren't reported as such\n");
+    }
+
+    if (device_plan_layout(dev, &assertion, &capability_sets[0], &layout) ||
+        device_create_allocation(dev, &assertion, &capability_sets[0],
+                                 &allocation)) {
+        FAIL("Couldn't create an uninitialized allocation\n");
+    }
+
+    if (device_map_allocation(dev, allocation, ALLOCATION_MAP_WRITE,
+                              (void **)&mapped)) {
+        FAIL("Couldn't map an uninitialized allocation\n");
+    }
+
+    memset(mapped, 0x5a, layout.size);
+    device_unmap_allocation(dev, allocation, ALLOCATION_MAP_WRITE);
+    device_destroy_allocation(dev, allocation);
+    free_capability_sets(num_capability_sets, capability_sets);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"device", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int opt;
+    char *dev_file_name = NULL;
+    device_t *dev;
+    int dev_fd;
+
+    while ((opt = getopt_long(argc, argv, "d:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            dev_file_name = strdup(optarg);
+            if (!dev_file_name) {
+                FAIL("Failed to make a copy of the device string\n");
+            }
+            break;
+
+        case '?':
+            usage();
+            exit(1);
+
+        default:
+            FAIL("Invalid option\n");
+            break;
+        }
+    }
+
+    if (!dev_file_name) {
+        usage();
+        exit(1);
+    }
+
+    dev_fd = open(dev_file_name, O_RDWR);
+
+    if (dev_fd < 0) {
+        FAIL("Couldn't open device file %s\n", dev_file_name);
+    }
+
+    dev = device_create(dev_fd);
+
+    if (!dev) {
+        FAIL("Couldn't create allocator device from device FD\n");
+    }
+
+    /* Smaller than a huge page, and large enough to be backed by them */
+    check_zeroed(dev, 256, 256);
+    check_zeroed(dev, 1920, 1080);
+
+    check_fork(dev);
+    check_uninitialized(dev);
+
+    device_destroy(dev);
+    close(dev_fd);
+    free(dev_file_name);
+
+    return 0;
+}